@@ -0,0 +1,262 @@
+#pragma once
+#ifndef INCLUDED_FRAMING_HPP
+#define INCLUDED_FRAMING_HPP
+
+#include "packets.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Framed packet protocol (FramingMode::SyncCRC16), shared by the firmware and
+ * the host. Each packet is sent as:
+ *
+ *  Offset  Size  Description
+ *  ------  ----  -----------
+ *  0       2     Sync word: 0xa5 0x5a
+ *  2       N     Packet, including its header (which may be extended)
+ *  2+N     2     CRC-16/CCITT-FALSE of the packet, little endian
+ *
+ * Bare packets give no way to find the next header once a byte has been lost
+ * or corrupted. Here, the receiver instead drops bytes until it finds a sync
+ * word followed by a packet with a valid CRC, so it is back in step by the
+ * start of the next intact frame. A sync word inside a packet is only taken
+ * for the start of a frame if the CRC happens to match as well.
+ *
+ * Framing is switched on and off with a SetFraming packet, which is always
+ * sent unframed. The firmware recognizes it, and Hello, in either mode so
+ * that a host can return the link to a known state, e.g., after restarting
+ * without the board being reset.
+ */
+
+static const constexpr uint8_t FrameSync[2] = { 0xa5, 0x5a };
+static const constexpr size_t FrameOverhead = sizeof(FrameSync) + sizeof(uint16_t);
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xffff), computed a
+// nibble at a time to keep the table small enough for the firmware
+inline uint16_t frame_crc(const uint8_t *data, size_t size)
+{
+  static const uint16_t table[16] =
+  {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+  };
+  uint16_t crc = 0xffff;
+  for (size_t i = 0; i < size; i++)
+  {
+    crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)];
+    crc = (crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0xf)];
+  }
+  return crc;
+}
+
+// Outputs a packet as a frame through write(const uint8_t *data, size_t size)
+template <typename Write>
+void write_frame(const uint8_t *packet, size_t size, Write write)
+{
+  uint16_t crc = frame_crc(packet, size);
+  uint8_t trailer[2] = { uint8_t(crc & 0xff), uint8_t(crc >> 8) };
+  write(FrameSync, sizeof(FrameSync));
+  write(packet, size);
+  write(trailer, sizeof(trailer));
+}
+
+// Size of the packets that are accepted unframed in framed mode, or 0
+inline size_t unframed_control_packet_size(uint8_t id)
+{
+  switch (id)
+  {
+  default:                    return 0;
+  case PacketID::SetFraming:  return sizeof(set_framing_packet);
+  case PacketID::Hello:       return sizeof(hello_packet);
+  }
+}
+
+/*
+ * Extracts packets from a stream of frames. Bytes are fed in as they arrive
+ * and each intact packet is passed to a callback:
+ *
+ *  void on_packet(const uint8_t *packet, size_t size)
+ *
+ * No more than one frame is ever buffered and nothing is allocated. Bytes are
+ * copied in only as far as needed to complete the frame being examined, so
+ * that after a bad frame the search can restart at the byte after its sync
+ * word. The buffer holds a frame of up to MaxPacketSize bytes of packet.
+ * Frames with larger packets are dropped as invalid. The firmware, which
+ * never receives extended packets, uses MAX_PACKET_SIZE to save memory.
+ */
+template <size_t MaxPacketSize>
+class basic_frame_decoder
+{
+public:
+  static const constexpr size_t MaxFrameSize = FrameOverhead + MaxPacketSize;
+
+  // If accept_unframed_control is set, unframed control packets (see
+  // unframed_control_packet_size()) are passed on as well
+  basic_frame_decoder(bool accept_unframed_control = false)
+    : m_accept_unframed_control(accept_unframed_control)
+  {
+  }
+
+  template <typename Callback>
+  void feed(const uint8_t *data, size_t size, Callback on_packet)
+  {
+    size_t required = 1;
+    while (size > 0)
+    {
+      // Take as much as is needed to decide whether there is a frame
+      size_t count = required > m_size ? required - m_size : 1;
+      count = count < size ? count : size;
+      memcpy(&m_buffer[m_size], data, count);
+      m_size += count;
+      data += count;
+      size -= count;
+
+      while (m_size > 0)
+      {
+        size_t offset;
+        result r = check(&offset, &required);
+        if (r == result::incomplete)
+        {
+          break;
+        }
+        else if (r == result::invalid)
+        {
+          // Resynchronize from the next byte
+          discard(1);
+          m_discarded_bytes++;
+        }
+        else
+        {
+          on_packet(&m_buffer[offset], required);
+          m_packets++;
+          discard(offset + required + (offset > 0 ? sizeof(uint16_t) : 0));
+        }
+      }
+      if (m_size == 0)
+      {
+        required = 1;
+      }
+    }
+  }
+
+  // Discards any partially received frame
+  void reset()
+  {
+    m_size = 0;
+  }
+
+  uint32_t packets() const
+  {
+    return m_packets;
+  }
+
+  // Frames whose CRC did not match
+  uint32_t crc_errors() const
+  {
+    return m_crc_errors;
+  }
+
+  // Bytes skipped while looking for a frame
+  uint32_t discarded_bytes() const
+  {
+    return m_discarded_bytes;
+  }
+
+private:
+  enum class result
+  {
+    incomplete,
+    invalid,
+    packet
+  };
+
+  uint8_t m_buffer[MaxFrameSize];
+  size_t m_size = 0;
+  bool m_accept_unframed_control;
+  uint32_t m_packets = 0;
+  uint32_t m_crc_errors = 0;
+  uint32_t m_discarded_bytes = 0;
+
+  // Looks for a complete frame (or unframed control packet) at the start of
+  // the buffer. Gives the size of the packet found or, if incomplete, the
+  // number of bytes needed to continue.
+  result check(size_t *offset, size_t *size)
+  {
+    if (m_buffer[0] != FrameSync[0])
+    {
+      return check_unframed(offset, size);
+    }
+    if (m_size >= 2 && m_buffer[1] != FrameSync[1])
+    {
+      return result::invalid;
+    }
+    const uint8_t *packet = &m_buffer[sizeof(FrameSync)];
+    if (m_size < sizeof(FrameSync) + sizeof(packet_header))
+    {
+      *size = sizeof(FrameSync) + sizeof(packet_header);
+      return result::incomplete;
+    }
+    if (m_size < sizeof(FrameSync) + packet_header_size(packet))
+    {
+      *size = sizeof(FrameSync) + packet_header_size(packet);
+      return result::incomplete;
+    }
+
+    size_t packet_bytes = packet_size(packet);
+    if (packet_bytes == 0 || packet_bytes > MaxPacketSize)
+    {
+      return result::invalid;
+    }
+    size_t frame_size = FrameOverhead + packet_bytes;
+    if (m_size < frame_size)
+    {
+      *size = frame_size;
+      return result::incomplete;
+    }
+
+    const uint8_t *trailer = &m_buffer[frame_size - sizeof(uint16_t)];
+    uint16_t crc = trailer[0] | (trailer[1] << 8);
+    if (crc != frame_crc(packet, packet_bytes))
+    {
+      m_crc_errors++;
+      return result::invalid;
+    }
+    *offset = sizeof(FrameSync);
+    *size = packet_bytes;
+    return result::packet;
+  }
+
+  result check_unframed(size_t *offset, size_t *size)
+  {
+    if (!m_accept_unframed_control)
+    {
+      return result::invalid;
+    }
+    if (m_size < sizeof(packet_header))
+    {
+      *size = sizeof(packet_header);
+      return result::incomplete;
+    }
+
+    const packet_header *header = reinterpret_cast<const packet_header *>(m_buffer);
+    size_t expected_size = unframed_control_packet_size(header->id);
+    if (expected_size == 0 || header->size() != expected_size)
+    {
+      return result::invalid;
+    }
+    *offset = 0;
+    *size = expected_size;
+    return m_size < expected_size ? result::incomplete : result::packet;
+  }
+
+  void discard(size_t count)
+  {
+    m_size -= count;
+    memmove(m_buffer, &m_buffer[count], m_size);
+  }
+};
+
+typedef basic_frame_decoder<MAX_EXTENDED_PACKET_SIZE> frame_decoder;
+
+#endif  // INCLUDED_FRAMING_HPP
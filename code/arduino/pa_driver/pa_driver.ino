@@ -39,11 +39,63 @@
 
 #include "pixart.hpp"
 #include "packets.hpp"
+#include "framing.hpp"
 #include "cooperative_task.hpp"
 
 static util::cooperative_task<util::millisecond::resolution> s_led_blinker;
 static util::cooperative_task<util::microsecond::resolution> s_frame_reader;
-static bool s_send_object_report = false;
+static const constexpr uint32_t k_initial_baud_rate = 115200;
+static const constexpr uint32_t k_max_baud_rate = 1000000;   // nRF52832 UART limit
+static uint32_t s_baud_rate = k_initial_baud_rate;
+static uint32_t s_previous_baud_rate = k_initial_baud_rate;
+static bool s_baud_rate_unconfirmed = false;
+static uint32_t s_baud_rate_changed_millis = 0;
+static uint16_t s_report_credits = 0;   // reports to send as frames are read, one per frame
+static bool s_subscribed = false;
+static ReportEncoding s_report_encoding = ReportEncoding::FullReport;
+static uint8_t s_report_format = 1;
+static uint8_t s_report_batch_size = 0;   // subscribed reports per batch, 0 or 1 if not batching
+static object_report_batch_packet s_report_batch;
+static uint32_t s_frame_period_micros = 0;
+static uint32_t s_last_frame_micros = 0;
+static FramingMode s_framing = FramingMode::Unframed;
+static basic_frame_decoder<MAX_PACKET_SIZE> s_frame_decoder(true);
+
+static void send_packet(const void *packet, size_t size)
+{
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(packet);
+  if (s_framing == FramingMode::SyncCRC16)
+  {
+    write_frame(bytes, size, [](const uint8_t *data, size_t size) { Serial.write(data, size); });
+  }
+  else
+  {
+    Serial.write(bytes, size);
+  }
+}
+
+static void send_report_batch()
+{
+  if (s_report_batch.count > 0)
+  {
+    send_packet(&s_report_batch, s_report_batch.size());
+    s_report_batch.clear();
+  }
+}
+
+static void add_to_report_batch(const compact_object_report_packet &report)
+{
+  if (!s_report_batch.append(report))
+  {
+    // Out of room
+    send_report_batch();
+    s_report_batch.append(report);
+  }
+  if (s_report_batch.count >= s_report_batch_size)
+  {
+    send_report_batch();
+  }
+}
 
 static void blink_led(util::time::duration<util::microsecond::resolution> delta, size_t count)
 {
@@ -54,12 +106,44 @@ static void blink_led(util::time::duration<util::microsecond::resolution> delta,
 
 static void read_frame(util::time::duration<util::microsecond::resolution> delta, size_t count)
 {
-  object_report_packet report(1);
-  PA_read_report(report.data, 1);
-  if (s_send_object_report)
+  // If the loop was held up (e.g., by a blocking serial write), the task is
+  // run once per missed frame period in quick succession. Only the first run
+  // reads a new frame. The others are skipped, which shows up as a gap in the
+  // sequence numbers of the reports.
+  uint32_t now = micros();
+  if (count > 0 && now - s_last_frame_micros < s_frame_period_micros / 2)
   {
-    Serial.write(reinterpret_cast<const uint8_t *>(&report), sizeof(report));
-    s_send_object_report = false;
+    return;
+  }
+  s_last_frame_micros = now;
+
+  object_report_packet report(s_report_format);
+  PA_read_report(report.data, s_report_format);
+  report.sequence = uint8_t(count);
+  report.frame_timing.timestamp_micros = now;
+  report.frame_timing.frame = uint32_t(count);
+  if (s_report_credits > 0 || s_subscribed)
+  {
+    if (s_subscribed && s_report_batch_size > 1)
+    {
+      compact_object_report_packet compact(report.data, report.format, report.frame_timing);
+      compact.sequence = report.sequence;
+      add_to_report_batch(compact);
+    }
+    else if (s_report_encoding == ReportEncoding::CompactReport)
+    {
+      compact_object_report_packet compact(report.data, report.format, report.frame_timing);
+      compact.sequence = report.sequence;
+      send_packet(&compact, compact.size());
+    }
+    else
+    {
+      send_packet(&report, sizeof(report));
+    }
+    if (!s_subscribed)
+    {
+      s_report_credits--;
+    }
   }
 
   /*
@@ -81,6 +165,34 @@ static void read_frame(util::time::duration<util::microsecond::resolution> delta
   */
 }
 
+static bool is_supported_baud_rate(uint32_t baud_rate)
+{
+  switch (baud_rate)
+  {
+  default:
+    return false;
+  case 115200:
+  case 230400:
+  case 460800:
+  case 921600:
+  case 1000000:
+    return baud_rate <= k_max_baud_rate;
+  }
+}
+
+static void switch_baud_rate(uint32_t baud_rate)
+{
+  // Finish sending at the old rate and drop anything garbled by the switch
+  Serial.flush();
+  Serial.end();
+  Serial.begin(baud_rate);
+  while (Serial.available() > 0)
+  {
+    Serial.read();
+  }
+  s_baud_rate = baud_rate;
+}
+
 static void process_packet(const uint8_t *buffer)
 {
   const packet_header *header = reinterpret_cast<const packet_header *>(buffer);
@@ -98,39 +210,220 @@ static void process_packet(const uint8_t *buffer)
   {
     const peek_packet *peek = reinterpret_cast<const peek_packet *>(buffer);
     peek_response_packet peek_response(peek->bank, peek->address, PA_read(peek->bank, peek->address));
-    Serial.write(reinterpret_cast<const uint8_t *>(&peek_response), sizeof(peek_response));
+    send_packet(&peek_response, sizeof(peek_response));
+    break;
+  }
+  case PacketID::PeekRange:
+  {
+    const peek_range_packet *peek = reinterpret_cast<const peek_range_packet *>(buffer);
+    peek_range_response_packet response(peek->sequence, peek->bank, peek->start, is_valid_register_range(peek->start, peek->count) ? peek->count : 0);
+    PA_read_range(response.bank, response.start, response.data, response.count);
+    send_packet(&response, response.size());
+    break;
+  }
+  case PacketID::PokeBlock:
+  {
+    const poke_block_packet *poke = reinterpret_cast<const poke_block_packet *>(buffer);
+    uint8_t count = poke->complete(poke->size()) && is_valid_register_range(poke->start, poke->count) ? poke->count : 0;
+    if (count > 0)
+    {
+      PA_write_range(poke->bank, poke->start, poke->data, count);
+    }
+    poke_block_response_packet response(poke->sequence, count);
+    send_packet(&response, sizeof(response));
     break;
   }
   case PacketID::ObjectReportRequest:
   {
-    s_send_object_report = true;
+    if (s_report_credits == 0)
+    {
+      s_report_credits = 1;
+    }
+    break;
+  }
+  case PacketID::GrantReportCredits:
+  {
+    const grant_report_credits_packet *grant = reinterpret_cast<const grant_report_credits_packet *>(buffer);
+    s_report_credits = grant->credits < 0xffff - s_report_credits ? s_report_credits + grant->credits : 0xffff;
+    break;
+  }
+  case PacketID::ClockSyncPing:
+  {
+    const clock_sync_ping_packet *ping = reinterpret_cast<const clock_sync_ping_packet *>(buffer);
+    clock_sync_response_packet response(ping->host_time_ns, micros());
+    send_packet(&response, sizeof(response));
+    break;
+  }
+  case PacketID::SetFraming:
+  {
+    // Acknowledged unframed, before switching
+    const set_framing_packet *set_framing = reinterpret_cast<const set_framing_packet *>(buffer);
+    FramingMode mode = set_framing->mode == FramingMode::SyncCRC16 ? FramingMode::SyncCRC16 : FramingMode::Unframed;
+    set_framing_response_packet response(mode);
+    Serial.write(reinterpret_cast<const uint8_t *>(&response), sizeof(response));
+    s_framing = mode;
+    break;
+  }
+  case PacketID::Subscribe:
+  {
+    s_subscribed = true;
+    break;
+  }
+  case PacketID::Unsubscribe:
+  {
+    send_report_batch();
+    s_subscribed = false;
+    break;
+  }
+  case PacketID::SetReportBatching:
+  {
+    const set_report_batching_packet *set_batching = reinterpret_cast<const set_report_batching_packet *>(buffer);
+    s_report_batch_size = set_batching->reports < object_report_batch_packet::MaxReports ? set_batching->reports : object_report_batch_packet::MaxReports;
+    if (s_report_batch_size <= 1)
+    {
+      send_report_batch();
+    }
+    break;
+  }
+  case PacketID::SetReportFormat:
+  {
+    const set_report_format_packet *set_format = reinterpret_cast<const set_report_format_packet *>(buffer);
+    if (set_format->format >= 1 && set_format->format <= 4)
+    {
+      s_report_format = set_format->format;
+    }
+    break;
+  }
+  case PacketID::SetReportEncoding:
+  {
+    const set_report_encoding_packet *set_encoding = reinterpret_cast<const set_report_encoding_packet *>(buffer);
+    s_report_encoding = set_encoding->encoding == ReportEncoding::CompactReport ? ReportEncoding::CompactReport : ReportEncoding::FullReport;
+    break;
+  }
+  case PacketID::SetBaudRate:
+  {
+    const set_baud_rate_packet *set_baud_rate = reinterpret_cast<const set_baud_rate_packet *>(buffer);
+    bool accept = is_supported_baud_rate(set_baud_rate->baud_rate);
+    set_baud_rate_response_packet response(accept ? set_baud_rate->baud_rate : s_baud_rate);
+    send_packet(&response, sizeof(response));
+    if (accept && set_baud_rate->baud_rate != s_baud_rate)
+    {
+      s_previous_baud_rate = s_baud_rate;
+      switch_baud_rate(set_baud_rate->baud_rate);
+      s_baud_rate_unconfirmed = true;
+      s_baud_rate_changed_millis = millis();
+    }
+    break;
+  }
+  case PacketID::Hello:
+  {
+    // New session. Also confirms the baud rate.
+    s_baud_rate_unconfirmed = false;
+    s_framing = FramingMode::Unframed;
+    s_report_credits = 0;
+    s_subscribed = false;
+    s_report_encoding = ReportEncoding::FullReport;
+    s_report_format = 1;
+    s_report_batch_size = 0;
+    s_report_batch.clear();
+    hello_response_packet response;
+    response.protocol_version = PROTOCOL_VERSION;
+    response.report_formats = (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4);
+    response.features = FirmwareFeature::FramingFeature | FirmwareFeature::StreamingFeature | FirmwareFeature::CompactReportFeature | FirmwareFeature::BaudRateFeature | FirmwareFeature::RegisterBlockFeature | FirmwareFeature::ReportBatchFeature | FirmwareFeature::ReportCreditFeature | FirmwareFeature::ClockSyncFeature;
+    response.max_baud_rate = k_max_baud_rate;
+    strncpy(response.firmware_build, __DATE__ " " __TIME__, sizeof(response.firmware_build) - 1);
+    Serial.write(reinterpret_cast<const uint8_t *>(&response), sizeof(response));
     break;
   }
   }
 }
 
+// Until the host confirms a new baud rate, the link may be unusable, so
+// anything other than a Hello is taken to be garbled and dropped
+static void wait_for_baud_rate_confirmation()
+{
+  static uint8_t s_window[sizeof(hello_packet)];
+  static size_t s_window_size = 0;
+
+  if (millis() - s_baud_rate_changed_millis > BaudRateConfirmTimeoutMilliseconds)
+  {
+    switch_baud_rate(s_previous_baud_rate);
+    s_baud_rate_unconfirmed = false;
+    s_window_size = 0;
+    return;
+  }
+
+  while (Serial.available() > 0)
+  {
+    if (s_window_size == sizeof(s_window))
+    {
+      memmove(s_window, &s_window[1], sizeof(s_window) - 1);
+      s_window_size--;
+    }
+    s_window[s_window_size++] = uint8_t(Serial.read());
+
+    const hello_packet *hello = reinterpret_cast<const hello_packet *>(s_window);
+    if (s_window_size == sizeof(s_window) && hello->size() == sizeof(hello_packet) && hello->id == PacketID::Hello && hello->protocol_version == PROTOCOL_VERSION)
+    {
+      s_window_size = 0;
+      process_packet(s_window);
+      return;
+    }
+  }
+}
+
 //TODO: serial buffer only holds 64 bytes!
 static void read_serial_port()
 {
-  static uint8_t s_packet_buffer[255 * 2];
-  if (Serial.available() > 0)
+  static uint8_t s_packet_buffer[MAX_PACKET_SIZE];
+  if (s_baud_rate_unconfirmed)
+  {
+    wait_for_baud_rate_confirmation();
+  }
+  else if (s_framing == FramingMode::SyncCRC16)
+  {
+    // Frames are reassembled by the decoder, which also picks out a
+    // SetFraming packet sent unframed
+    uint8_t buffer[64];
+    int bytes_available = Serial.available();
+    while (bytes_available > 0 && s_framing == FramingMode::SyncCRC16)
+    {
+      size_t bytes_read = Serial.readBytes(buffer, bytes_available < int(sizeof(buffer)) ? bytes_available : sizeof(buffer));
+      bytes_available -= int(bytes_read);
+      s_frame_decoder.feed(buffer, bytes_read, [](const uint8_t *packet, size_t size)
+      {
+        process_packet(packet);
+      });
+    }
+  }
+  else if (Serial.available() > 0)
   {
     int packet_bytes = Serial.peek() * 2;
-    if (Serial.available() >= packet_bytes)
+    if (packet_bytes == 0)
+    {
+      // Not a packet header (e.g., line noise)
+      Serial.read();
+    }
+    else if (Serial.available() >= packet_bytes)
     {
       Serial.readBytes(s_packet_buffer, packet_bytes);
       process_packet(s_packet_buffer);
+      if (s_framing == FramingMode::SyncCRC16)
+      {
+        // Framing starts with the next byte
+        s_frame_decoder.reset();
+      }
     }
   }
 }
 
 void setup()
 {
-  Serial.begin(115200);
+  Serial.begin(k_initial_baud_rate);
   PA_init();
-  uint32_t frame_period = PA_get_frame_period_microseconds();
+  s_frame_period_micros = PA_get_frame_period_microseconds();
   s_led_blinker = util::cooperative_task<util::millisecond::resolution>(util::milliseconds(100), blink_led);
-  s_frame_reader = util::cooperative_task<util::microsecond::resolution>(util::microseconds(frame_period), read_frame);
+  s_frame_reader = util::cooperative_task<util::microsecond::resolution>(util::microseconds(s_frame_period_micros), read_frame);
 }
 
 void loop()
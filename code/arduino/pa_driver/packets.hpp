@@ -1,10 +1,14 @@
 #ifndef INCLUDED_PACKETS_HPP
 #define INCLUDED_PACKETS_HPP
 
+#include "pixart_object.hpp"
 #include <cstdint>
 #include <cstring>
 
-#define STATIC_ASSERT_PACKET_SIZE(packet) static_assert(sizeof(packet) % 2 == 0 && sizeof(packet) <= (255*2), #packet " size must be a multiple of 2 and not exceed 255 words")
+#define MAX_PACKET_SIZE (255 * 2)
+#define MAX_EXTENDED_PACKET_SIZE (2048 * 2)
+#define STATIC_ASSERT_PACKET_SIZE(packet) static_assert(sizeof(packet) % 2 == 0 && sizeof(packet) <= MAX_PACKET_SIZE, #packet " size must be a multiple of 2 and not exceed 255 words")
+#define STATIC_ASSERT_EXTENDED_PACKET_SIZE(packet) static_assert(sizeof(packet) % 2 == 0 && sizeof(packet) <= MAX_EXTENDED_PACKET_SIZE, #packet " size must be a multiple of 2 and not exceed 2048 words")
 
 #pragma pack(push, 1)
 
@@ -14,7 +18,59 @@ enum PacketID: uint8_t
   Peek,
   PeekResponse,
   ObjectReportRequest,
-  ObjectReport
+  ObjectReport,
+  SetFraming,
+  SetFramingResponse,
+  Hello,
+  HelloResponse,
+  Subscribe,
+  Unsubscribe,
+  SetReportEncoding,
+  CompactObjectReport,
+  SetReportFormat,
+  SetBaudRate,
+  SetBaudRateResponse,
+  PeekRange,
+  PeekRangeResponse,
+  PokeBlock,
+  PokeBlockResponse,
+  SetReportBatching,
+  ObjectReportBatch,
+  GrantReportCredits,
+  ClockSyncPing,
+  ClockSyncResponse
+};
+
+// Version of the protocol as a whole. Optional parts are announced in the
+// features of a HelloResponse.
+#define PROTOCOL_VERSION 1
+
+enum FirmwareFeature: uint32_t
+{
+  FramingFeature = 1 << 0,        // SetFraming with FramingMode::SyncCRC16
+  StreamingFeature = 1 << 1,      // Subscribe and Unsubscribe
+  CompactReportFeature = 1 << 2,  // SetReportEncoding with ReportEncoding::CompactReport
+  BaudRateFeature = 1 << 3,       // SetBaudRate
+  RegisterBlockFeature = 1 << 4,  // PeekRange and PokeBlock
+  ReportBatchFeature = 1 << 5,    // SetReportBatching
+  ReportCreditFeature = 1 << 6,   // GrantReportCredits
+  ClockSyncFeature = 1 << 7       // ClockSyncPing
+};
+
+// After switching to a new baud rate, the firmware returns to the previous
+// one unless it receives a Hello at the new rate within this time
+static const constexpr uint32_t BaudRateConfirmTimeoutMilliseconds = 500;
+
+enum ReportEncoding: uint8_t
+{
+  FullReport = 0,   // object_report_packet
+  CompactReport     // compact_object_report_packet
+};
+
+enum FramingMode: uint8_t
+{
+  Unframed = 0,   // bare packets
+  SyncCRC16       // sync word, packet, CRC-16 (see framing.hpp)
 };
 
 struct packet_header
@@ -34,6 +90,58 @@ struct packet_header
   }
 };
 
+/*
+ * Header of packets that may exceed MAX_PACKET_SIZE, which is the limit of
+ * the 8-bit word count. The word count is 0, which is otherwise invalid, and
+ * is followed by a 16-bit word count. Only the packets for which
+ * is_extended_packet() is true have this header, so that a stray 0 byte
+ * before another packet is still skipped as before.
+ */
+struct extended_packet_header: public packet_header
+{
+  uint16_t extended_words;
+
+  size_t size() const
+  {
+    return extended_words * 2;
+  }
+
+  extended_packet_header(PacketID packet_id, size_t packet_bytes)
+    : packet_header(packet_id, 0),
+      extended_words((packet_bytes + 1) / 2)
+  {
+  }
+};
+
+inline bool is_extended_packet(uint8_t id)
+{
+  return id == PacketID::ObjectReportBatch;
+}
+
+// Number of bytes of a packet needed to determine its size, given its first
+// 2 bytes
+inline size_t packet_header_size(const uint8_t *packet)
+{
+  return packet[0] == 0 && is_extended_packet(packet[1]) ? sizeof(extended_packet_header) : sizeof(packet_header);
+}
+
+// Size of a packet given the first packet_header_size() bytes of it, or 0 if
+// they are not a valid header
+inline size_t packet_size(const uint8_t *packet)
+{
+  const packet_header *header = reinterpret_cast<const packet_header *>(packet);
+  if (header->words != 0)
+  {
+    return header->size();
+  }
+  if (!is_extended_packet(header->id))
+  {
+    return 0;
+  }
+  size_t size = reinterpret_cast<const extended_packet_header *>(packet)->size();
+  return size >= sizeof(extended_packet_header) && size <= MAX_EXTENDED_PACKET_SIZE ? size : 0;
+}
+
 struct poke_packet: public packet_header
 {
   const uint8_t bank;
@@ -100,11 +208,45 @@ struct object_report_request_packet: public packet_header
 
 STATIC_ASSERT_PACKET_SIZE(object_report_request_packet);
 
+// Grants the firmware this many more reports, on top of any not yet used. One
+// is sent, and one credit used, for each frame read while credits remain, so
+// the host can keep several reports in flight and stops them simply by not
+// granting more. ObjectReportRequest grants a single credit unless some are
+// already granted. Subscribed reports use no credits. Hello revokes them all.
+struct grant_report_credits_packet: public packet_header
+{
+  const uint16_t credits;
+
+  grant_report_credits_packet(uint16_t in_credits)
+    : packet_header(PacketID::GrantReportCredits, sizeof(*this)),
+      credits(in_credits)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(grant_report_credits_packet);
+
+// When the frame of a report was read, appended to every report. Reports
+// from older firmware end before it, which is told from their size. The low
+// byte of frame is the report's sequence number.
+struct report_timing
+{
+  uint32_t timestamp_micros = 0;  // micros() on the firmware when the frame was read
+  uint32_t frame = 0;             // frame periods since the firmware started
+};
+
+// Report of all 16 slots, each PA_object_size(format) bytes. The packet is
+// the same size whatever the format, so smaller formats only save bytes on
+// the wire when sent as compact_object_report_packet.
 struct object_report_packet: public packet_header
 {
   uint8_t data[256];
   const uint8_t format = 0;
-  const uint8_t __reserved__ = 0;
+  uint8_t sequence = 0;   // frame period in which the report was read, modulo 256
+  report_timing frame_timing;
+
+  // Size of reports from firmware that predates report_timing
+  static const constexpr size_t LegacySize = sizeof(packet_header) + 256 + 2;
 
   object_report_packet(const uint8_t *in_data, uint8_t in_format)
     : packet_header(PacketID::ObjectReport, sizeof(*this)),
@@ -132,10 +274,654 @@ struct object_report_packet: public packet_header
     : packet_header(PacketID::ObjectReport, sizeof(*this))
   {
   }
+
+  // Legacy reports are complete without their timing
+  bool complete(size_t size) const
+  {
+    return size >= LegacySize;
+  }
+
+  // Timing of the report, or nullptr if it is a legacy report
+  const report_timing *timing() const
+  {
+    return size() >= sizeof(*this) ? &frame_timing : nullptr;
+  }
+
+  void load(PA_object objs[16]) const
+  {
+    int object_size = PA_object_size(format);
+    for (int i = 0; i < 16; i++)
+    {
+      objs[i].load(&data[i * object_size], format);
+    }
+  }
 };
 
 STATIC_ASSERT_PACKET_SIZE(object_report_packet);
 
+// Selects how object reports are sent. Reports are full until this is
+// received, and again after Hello.
+struct set_report_encoding_packet: public packet_header
+{
+  const ReportEncoding encoding;
+  const uint8_t __padding__ = 0;
+
+  set_report_encoding_packet(ReportEncoding in_encoding)
+    : packet_header(PacketID::SetReportEncoding, sizeof(*this)),
+      encoding(in_encoding)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_report_encoding_packet);
+
+// Selects the sensor report format (1-4, see PA_read_report()) used for all
+// subsequent reports. Formats listed in hello_response_packet::report_formats
+// are supported and others are ignored. Reports are in format 1 until this
+// is received, and again after Hello.
+struct set_report_format_packet: public packet_header
+{
+  const uint8_t format;
+  const uint8_t __padding__ = 0;
+
+  set_report_format_packet(uint8_t in_format)
+    : packet_header(PacketID::SetReportFormat, sizeof(*this)),
+      format(in_format)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_report_format_packet);
+
+/*
+ * Object report carrying only the slots that hold an object. Bit i of the
+ * occupancy mask is set if slot i is occupied, and the objects of the
+ * occupied slots follow in slot order, each in the size of the report format
+ * (PA_object_size()), and then the report_timing, unaligned. The packet is
+ * only as long as the objects it holds, rounded up to a whole word, so a
+ * frame with 4 objects in format 1 takes 78 bytes rather than the 268 of
+ * object_report_packet. Legacy reports end after the objects.
+ */
+struct compact_object_report_packet: public packet_header
+{
+  const uint8_t format = 0;
+  uint8_t sequence = 0;   // as in object_report_packet
+  uint16_t occupied = 0;
+  uint8_t data[256 + sizeof(report_timing)] = {};
+
+  static const constexpr size_t HeaderSize = sizeof(packet_header) + 4;
+
+  // Compacts a report as read from the sensor
+  compact_object_report_packet(const uint8_t *report_data, uint8_t in_format, const report_timing &timing)
+    : packet_header(PacketID::CompactObjectReport, HeaderSize + count_occupied(report_data, in_format) * PA_object_size(in_format) + sizeof(report_timing)),
+      format(in_format)
+  {
+    int object_size = PA_object_size(format);
+    uint8_t *out = data;
+    for (int i = 0; i < 16; i++)
+    {
+      const uint8_t *object = &report_data[i * object_size];
+      if (is_occupied(object))
+      {
+        occupied |= 1 << i;
+        memcpy(out, object, object_size);
+        out += object_size;
+      }
+    }
+    memcpy(out, &timing, sizeof(report_timing));
+  }
+
+  // Builds a report from objects already compacted, as in a batch
+  compact_object_report_packet(uint8_t in_format, uint16_t in_occupied, const uint8_t *objects, const report_timing &timing)
+    : packet_header(PacketID::CompactObjectReport, HeaderSize + count(in_occupied) * PA_object_size(in_format) + sizeof(report_timing)),
+      format(in_format),
+      sequence(uint8_t(timing.frame)),
+      occupied(in_occupied)
+  {
+    size_t size = objects_size();
+    memcpy(data, objects, size);
+    memcpy(&data[size], &timing, sizeof(report_timing));
+  }
+
+  // Whether all of the objects announced fit in the received size
+  bool complete(size_t size) const
+  {
+    return size >= HeaderSize && format >= 1 && format <= 4 && size >= HeaderSize + objects_size();
+  }
+
+  // Timing of the report, or nullptr if it is a legacy report
+  const report_timing *timing() const
+  {
+    return size() >= HeaderSize + objects_size() + sizeof(report_timing) ? reinterpret_cast<const report_timing *>(&data[objects_size()]) : nullptr;
+  }
+
+  size_t objects_size() const
+  {
+    return count(occupied) * PA_object_size(format);
+  }
+
+  // Expands the report to all 16 slots. Unoccupied slots are empty.
+  void load(PA_object objs[16]) const
+  {
+    int object_size = PA_object_size(format);
+    const uint8_t *object = data;
+    for (int i = 0; i < 16; i++)
+    {
+      if (occupied & (1 << i))
+      {
+        objs[i].load(object, format);
+        object += object_size;
+      }
+      else
+      {
+        objs[i].set_empty();
+      }
+    }
+  }
+
+  static bool is_occupied(const uint8_t *object)
+  {
+    uint16_t cx = object[2] | ((object[3] & 0x0f) << 8);
+    uint16_t cy = object[4] | ((object[5] & 0x0f) << 8);
+    return cx < 0xfff && cy < 0xfff;
+  }
+
+  static size_t count_occupied(const uint8_t *report_data, int format)
+  {
+    int object_size = PA_object_size(format);
+    size_t num_occupied = 0;
+    for (int i = 0; i < 16; i++)
+    {
+      num_occupied += is_occupied(&report_data[i * object_size]) ? 1 : 0;
+    }
+    return num_occupied;
+  }
+
+  static size_t count(uint16_t mask)
+  {
+    size_t bits = 0;
+    for (; mask != 0; mask &= mask - 1)
+    {
+      bits++;
+    }
+    return bits;
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(compact_object_report_packet);
+
+// Requests a framing mode for all subsequent packets in both directions.
+// Always sent unframed. Firmware that does not support framing ignores it.
+struct set_framing_packet: public packet_header
+{
+  const FramingMode mode;
+  const uint8_t __padding__ = 0;
+
+  set_framing_packet(FramingMode in_mode)
+    : packet_header(PacketID::SetFraming, sizeof(*this)),
+      mode(in_mode)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_framing_packet);
+
+// Sent unframed, after which the mode it carries is in effect
+struct set_framing_response_packet: public packet_header
+{
+  const FramingMode mode = FramingMode::Unframed;
+  const uint8_t __padding__ = 0;
+
+  set_framing_response_packet(FramingMode in_mode)
+    : packet_header(PacketID::SetFramingResponse, sizeof(*this)),
+      mode(in_mode)
+  {
+  }
+
+  set_framing_response_packet()
+    : packet_header(PacketID::SetFramingResponse, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_framing_response_packet);
+
+// Sent unframed, and repeatedly until answered, to find out when the
+// firmware is ready and what it supports. Also starts a new session: the
+// firmware reverts to unframed packets and drops any pending requests.
+struct hello_packet: public packet_header
+{
+  const uint16_t protocol_version;
+
+  hello_packet()
+    : packet_header(PacketID::Hello, sizeof(*this)),
+      protocol_version(PROTOCOL_VERSION)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(hello_packet);
+
+// Always sent unframed
+struct hello_response_packet: public packet_header
+{
+  uint16_t protocol_version = 0;
+  uint16_t report_formats = 0;        // bit n set if report format n is supported
+  uint32_t features = 0;              // FirmwareFeature flags
+  uint32_t max_baud_rate = 0;
+  char firmware_build[24] = {};       // NUL-terminated
+
+  hello_response_packet()
+    : packet_header(PacketID::HelloResponse, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(hello_response_packet);
+
+// Requests a change of baud rate. The firmware answers at the current rate
+// and then switches, but only keeps the new rate once a Hello has been
+// received at it (see BaudRateConfirmTimeoutMilliseconds).
+struct set_baud_rate_packet: public packet_header
+{
+  const uint32_t baud_rate;
+
+  set_baud_rate_packet(uint32_t in_baud_rate)
+    : packet_header(PacketID::SetBaudRate, sizeof(*this)),
+      baud_rate(in_baud_rate)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_baud_rate_packet);
+
+struct set_baud_rate_response_packet: public packet_header
+{
+  uint32_t baud_rate = 0;   // rate switched to, or the current rate if the request was refused
+
+  set_baud_rate_response_packet(uint32_t in_baud_rate)
+    : packet_header(PacketID::SetBaudRateResponse, sizeof(*this)),
+      baud_rate(in_baud_rate)
+  {
+  }
+
+  set_baud_rate_response_packet()
+    : packet_header(PacketID::SetBaudRateResponse, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_baud_rate_response_packet);
+
+// Requests a report of every frame, sent as soon as it is read, until
+// Unsubscribe (or Hello) is received
+struct subscribe_packet: public packet_header
+{
+  subscribe_packet()
+    : packet_header(PacketID::Subscribe, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(subscribe_packet);
+
+struct unsubscribe_packet: public packet_header
+{
+  unsubscribe_packet()
+    : packet_header(PacketID::Unsubscribe, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(unsubscribe_packet);
+
+// Registers 0x00-0xff of a bank can be read or written in a single SPI burst
+// (the sensor increments the address after each byte), provided the range
+// does not take in the bank select register, 0xef
+inline bool is_valid_register_range(uint8_t start, size_t count)
+{
+  return count > 0 && start + count <= 0x100 && !(start <= 0xef && 0xef < start + count);
+}
+
+// Reads count consecutive registers of a bank. Several requests may be
+// outstanding at once; each response carries the sequence number of its
+// request.
+struct peek_range_packet: public packet_header
+{
+  const uint8_t sequence;
+  const uint8_t bank;
+  const uint8_t start;
+  const uint8_t count;
+
+  peek_range_packet(uint8_t in_sequence, uint8_t in_bank, uint8_t in_start, uint8_t in_count)
+    : packet_header(PacketID::PeekRange, sizeof(*this)),
+      sequence(in_sequence),
+      bank(in_bank),
+      start(in_start),
+      count(in_count)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(peek_range_packet);
+
+// Register values of a PeekRange, of which only count are sent. A count of 0
+// means that the range was refused (see is_valid_register_range()).
+struct peek_range_response_packet: public packet_header
+{
+  const uint8_t sequence = 0;
+  const uint8_t bank = 0;
+  const uint8_t start = 0;
+  const uint8_t count = 0;
+  uint8_t data[256] = {};
+
+  static const constexpr size_t HeaderSize = sizeof(packet_header) + 4;
+
+  peek_range_response_packet(uint8_t in_sequence, uint8_t in_bank, uint8_t in_start, uint8_t in_count)
+    : packet_header(PacketID::PeekRangeResponse, HeaderSize + in_count),
+      sequence(in_sequence),
+      bank(in_bank),
+      start(in_start),
+      count(in_count)
+  {
+  }
+
+  bool complete(size_t size) const
+  {
+    return size >= HeaderSize && size >= HeaderSize + count;
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(peek_range_response_packet);
+
+/*
+ * Writes count consecutive registers of a bank and is acknowledged with a
+ * PokeBlockResponse. Blocks are limited to what fits in the serial receive
+ * buffer of the firmware, which is only 64 bytes, because unframed packets are
+ * not read until they have arrived in full.
+ */
+struct poke_block_packet: public packet_header
+{
+  static const constexpr size_t MaxCount = 56;
+  static const constexpr size_t HeaderSize = sizeof(packet_header) + 4;
+
+  const uint8_t sequence = 0;
+  const uint8_t bank = 0;
+  const uint8_t start = 0;
+  const uint8_t count = 0;
+  uint8_t data[MaxCount] = {};
+
+  poke_block_packet(uint8_t in_sequence, uint8_t in_bank, uint8_t in_start, const uint8_t *in_data, uint8_t in_count)
+    : packet_header(PacketID::PokeBlock, HeaderSize + in_count),
+      sequence(in_sequence),
+      bank(in_bank),
+      start(in_start),
+      count(in_count)
+  {
+    memcpy(data, in_data, in_count);
+  }
+
+  bool complete(size_t size) const
+  {
+    return size >= HeaderSize && count <= MaxCount && size >= HeaderSize + count;
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(poke_block_packet);
+
+struct poke_block_response_packet: public packet_header
+{
+  const uint8_t sequence = 0;
+  const uint8_t count = 0;    // registers written: all of the block, or 0 if it was refused
+
+  poke_block_response_packet(uint8_t in_sequence, uint8_t in_count)
+    : packet_header(PacketID::PokeBlockResponse, sizeof(*this)),
+      sequence(in_sequence),
+      count(in_count)
+  {
+  }
+
+  poke_block_response_packet()
+    : packet_header(PacketID::PokeBlockResponse, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(poke_block_response_packet);
+
+// Sent in place of subscribed reports, as a batch of up to the given number
+// (no more than object_report_batch_packet::MaxReports). A batch is sent as soon
+// as it is full, and a partial one when Unsubscribe is received. 0 or 1 turns
+// batching off, as does Hello.
+struct set_report_batching_packet: public packet_header
+{
+  const uint8_t reports;
+  const uint8_t __padding__ = 0;
+
+  set_report_batching_packet(uint8_t in_reports)
+    : packet_header(PacketID::SetReportBatching, sizeof(*this)),
+      reports(in_reports)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(set_report_batching_packet);
+
+/*
+ * Batch of object reports, which trades latency for throughput: one packet
+ * (and, on the host, one read and one dispatch) carries many frames. The
+ * format, and the timing of the last frame, are sent once for the batch, and
+ * each entry holds only what changes from frame to frame: how many frame
+ * periods and microseconds it was read after the previous entry (0 for the
+ * first), its occupancy mask and its objects, as in
+ * compact_object_report_packet. A batch of 16 frames with 4 objects in
+ * format 1 takes about 70 bytes per frame, rather than the 78 of separate
+ * compact reports.
+ *
+ *  Offset  Size  Description
+ *  ------  ----  -----------
+ *  0       4     Extended header (extended_packet_header)
+ *  4       1     Number of entries
+ *  5       1     Report format
+ *  6       8     Timing of the last entry (report_timing)
+ *  14      ...   Entries, unaligned: 1-byte frame delta, 2-byte microsecond
+ *                delta, 2-byte occupancy mask, objects
+ *
+ * The packet is only as long as its entries, rounded up to a whole word. A
+ * report that is more than 255 frames or 65535 us after the previous one, or
+ * in another format, starts a new batch.
+ */
+struct object_report_batch_packet: public extended_packet_header
+{
+  struct entry_header
+  {
+    uint8_t frames;
+    uint16_t micros;
+    uint16_t occupied;
+  };
+
+  static const constexpr size_t HeaderSize = sizeof(extended_packet_header) + 2 + sizeof(report_timing);
+  static const constexpr size_t MaxReports = 64;
+
+  uint8_t count = 0;
+  uint8_t format = 0;
+  report_timing last_timing;
+  uint8_t data[MAX_EXTENDED_PACKET_SIZE - HeaderSize];
+
+  object_report_batch_packet()
+    : extended_packet_header(PacketID::ObjectReportBatch, HeaderSize)
+  {
+  }
+
+  void clear()
+  {
+    count = 0;
+    extended_words = HeaderSize / 2;
+  }
+
+  // Appends a report unless the batch is full, or the report does not fit or
+  // cannot be coded relative to the previous one
+  bool append(const compact_object_report_packet &report)
+  {
+    const report_timing *timing = report.timing();
+    if (count >= MaxReports || !timing)
+    {
+      return false;
+    }
+    entry_header entry = { 0, 0, report.occupied };
+    if (count > 0)
+    {
+      uint32_t frames = timing->frame - last_timing.frame;
+      uint32_t micros = timing->timestamp_micros - last_timing.timestamp_micros;
+      if (report.format != format || frames == 0 || frames > 0xff || micros > 0xffff)
+      {
+        return false;
+      }
+      entry.frames = uint8_t(frames);
+      entry.micros = uint16_t(micros);
+    }
+    size_t used = entries_size();
+    size_t objects_size = report.objects_size();
+    if (used + sizeof(entry_header) + objects_size > sizeof(data))
+    {
+      return false;
+    }
+    memcpy(&data[used], &entry, sizeof(entry_header));
+    memcpy(&data[used + sizeof(entry_header)], report.data, objects_size);
+    extended_words = uint16_t((HeaderSize + used + sizeof(entry_header) + objects_size + 1) / 2);
+    format = report.format;
+    last_timing = *timing;
+    count++;
+    return true;
+  }
+
+  // Whether every entry is within the received size
+  bool complete(size_t size) const
+  {
+    if (size < HeaderSize || size < this->size())
+    {
+      return false;
+    }
+    if (count == 0)
+    {
+      return true;
+    }
+    if (format < 1 || format > 4)
+    {
+      return false;
+    }
+    size_t pos = 0;
+    size_t end = this->size() - HeaderSize;
+    for (size_t i = 0; i < count; i++)
+    {
+      if (end - pos < sizeof(entry_header))
+      {
+        return false;
+      }
+      size_t entry_size = this->entry_size(&data[pos]);
+      if (entry_size > end - pos)
+      {
+        return false;
+      }
+      pos += entry_size;
+    }
+    return true;
+  }
+
+  // Passes each entry, in order, expanded to a compact report with its
+  // timing and sequence number, to:
+  //
+  //  void callback(const compact_object_report_packet &report)
+  //
+  // The batch must be complete().
+  template <typename Callback>
+  void for_each(Callback callback) const
+  {
+    // Entries are coded relative to the previous one, so the timing of the
+    // first is that of the last less all of the deltas
+    report_timing timing = last_timing;
+    const uint8_t *entry = data;
+    for (size_t i = 0; i < count; i++)
+    {
+      entry_header header;
+      memcpy(&header, entry, sizeof(entry_header));
+      timing.frame -= header.frames;
+      timing.timestamp_micros -= header.micros;
+      entry += entry_size(entry);
+    }
+
+    entry = data;
+    for (size_t i = 0; i < count; i++)
+    {
+      entry_header header;
+      memcpy(&header, entry, sizeof(entry_header));
+      timing.frame += header.frames;
+      timing.timestamp_micros += header.micros;
+      callback(compact_object_report_packet(format, header.occupied, entry + sizeof(entry_header), timing));
+      entry += entry_size(entry);
+    }
+  }
+
+private:
+  size_t entry_size(const uint8_t *entry) const
+  {
+    entry_header header;
+    memcpy(&header, entry, sizeof(entry_header));
+    return sizeof(entry_header) + compact_object_report_packet::count(header.occupied) * PA_object_size(format);
+  }
+
+  // Bytes of data taken by the entries, which need not be a whole number of
+  // words
+  size_t entries_size() const
+  {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      size += entry_size(&data[size]);
+    }
+    return size;
+  }
+};
+
+STATIC_ASSERT_EXTENDED_PACKET_SIZE(object_report_batch_packet);
+
+// Asks for the firmware's clock, for mapping report timestamps to host time.
+// The host's time of sending is echoed in the response, so the host does not
+// have to keep track of outstanding pings.
+struct clock_sync_ping_packet: public packet_header
+{
+  const uint64_t host_time_ns;
+
+  clock_sync_ping_packet(uint64_t in_host_time_ns)
+    : packet_header(PacketID::ClockSyncPing, sizeof(*this)),
+      host_time_ns(in_host_time_ns)
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(clock_sync_ping_packet);
+
+// Sent as soon as a ping is received, with micros() at that moment
+struct clock_sync_response_packet: public packet_header
+{
+  const uint64_t host_time_ns = 0;    // as in the ping
+  const uint32_t firmware_micros = 0;
+
+  clock_sync_response_packet(uint64_t in_host_time_ns, uint32_t in_firmware_micros)
+    : packet_header(PacketID::ClockSyncResponse, sizeof(*this)),
+      host_time_ns(in_host_time_ns),
+      firmware_micros(in_firmware_micros)
+  {
+  }
+
+  clock_sync_response_packet()
+    : packet_header(PacketID::ClockSyncResponse, sizeof(*this))
+  {
+  }
+};
+
+STATIC_ASSERT_PACKET_SIZE(clock_sync_response_packet);
+
 #pragma pack(pop)
 
 #endif  // INCLUDED_PACKETS_HPP
@@ -5,6 +5,7 @@
 
 static constexpr uint8_t PIN_CSB = A0;
 static uint32_t s_frame_period_micros = 0;
+static int s_bank = -1;     // last bank selected, or -1 if unknown
 
 static void chip_select(bool enable)
 {
@@ -35,6 +36,27 @@ static void burst_read(uint8_t reg_base, uint8_t buffer[], uint16_t num_bytes)
   }
 }
 
+static void burst_write(uint8_t reg_base, const uint8_t data[], uint16_t num_bytes)
+{
+  SPI.transfer(0x01);     // bit 7 = write (0), bit 0 = burst (1)
+  SPI.transfer(reg_base);
+  for (uint16_t i = 0; i < num_bytes; i++)
+  {
+    SPI.transfer(data[i]);
+  }
+}
+
+// Bank select register persists across transactions, so it is only written
+// when it changes
+static void select_bank(uint8_t bank)
+{
+  if (s_bank != bank)
+  {
+    write(0xef, bank);
+    s_bank = bank;
+  }
+}
+
 static void load_initial_settings()
 {
   write(0xef, 0);
@@ -63,13 +85,14 @@ static void load_initial_settings()
   write(0x13, 0);
   write(0xef, 0);
   write(0x01, 1);
+  s_bank = 0;
 }
 
 uint32_t PA_get_frame_period_microseconds()
 {
   // Read frame period, which is in units of 100 ns
   chip_select(true);
-  write(0xef, 0x0c); // bank C
+  select_bank(0x0c);
   uint32_t cmd_frame_period = read(0x07);
   cmd_frame_period |= read(0x08) << 8;
   cmd_frame_period |= read(0x09) << 16;
@@ -83,20 +106,40 @@ uint32_t PA_get_frame_period_microseconds()
 void PA_write(uint8_t bank, uint8_t reg, uint8_t data)
 {
   chip_select(true);
-  write(0xef, bank);
+  select_bank(bank);
   write(reg, data);
   chip_select(false);
+  if (reg == 0xef)
+  {
+    s_bank = data;
+  }
 }
 
 uint8_t PA_read(uint8_t bank, uint8_t reg)
 {
   chip_select(true);
-  write(0xef, bank);
+  select_bank(bank);
   uint8_t value = read(reg);
   chip_select(false);
   return value;
 }
 
+void PA_read_range(uint8_t bank, uint8_t reg, uint8_t buffer[], uint16_t count)
+{
+  chip_select(true);
+  select_bank(bank);
+  burst_read(reg, buffer, count);
+  chip_select(false);
+}
+
+void PA_write_range(uint8_t bank, uint8_t reg, const uint8_t data[], uint16_t count)
+{
+  chip_select(true);
+  select_bank(bank);
+  burst_write(reg, data, count);
+  chip_select(false);
+}
+
 void PA_read_report(uint8_t buffer[], int format)
 {
   int num_bytes = 256;
@@ -125,7 +168,7 @@ void PA_read_report(uint8_t buffer[], int format)
   }
 
   chip_select(true);
-  write(0xef, format_code);
+  select_bank(format_code);
   burst_read(0, buffer, num_bytes);
   chip_select(false);
 }
@@ -136,7 +179,7 @@ void PA_read_report(PA_object objs[16], int format)
   PA_read_report(buffer, format);
   for (size_t i = 0; i < 16; i++)
   {
-    objs[i].load(&buffer[i*16], format);
+    objs[i].load(&buffer[i * PA_object_size(format)], format);
   }
 }
 
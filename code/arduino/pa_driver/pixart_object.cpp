@@ -19,7 +19,7 @@ void PA_object::render_ascii(char *output, int pitch, char symbol) const
 
 void PA_object::load(const uint8_t *data, int format)
 {
-  memset(this, 0, sizeof(this));
+  memset(this, 0, sizeof(*this));
 
   // Formats 1-4
   area = data[0] | ((data[1] & 0x3f) << 8);
@@ -48,7 +48,74 @@ void PA_object::load(const uint8_t *data, int format)
   }
 }
 
+void PA_object::store(uint8_t *data, int format) const
+{
+  // Formats 1-4
+  data[0] = area & 0xff;
+  data[1] = (area >> 8) & 0x3f;
+  data[2] = cx & 0xff;
+  data[3] = (cx >> 8) & 0x0f;
+  data[4] = cy & 0xff;
+  data[5] = (cy >> 8) & 0x0f;
+
+  // Format 1, 3
+  if (format == 1 || format == 3)
+  {
+    data[6] = average_brightness;
+    data[7] = max_brightness;
+    data[8] = (range << 4) | (radius & 0xf);
+  }
+
+  if (format == 1 || format == 4)
+  {
+    int offset = format == 4 ? 3 : 0;
+    data[9 - offset] = boundary_left & 0x7f;
+    data[10 - offset] = boundary_right & 0x7f;
+    data[11 - offset] = boundary_up & 0x7f;
+    data[12 - offset] = boundary_down & 0x7f;
+    data[13 - offset] = aspect_ratio;
+    data[14 - offset] = vx;
+    data[15 - offset] = vy;
+  }
+}
+
+// Values the sensor reports for a slot without an object
+void PA_object::set_empty()
+{
+  memset(this, 0, sizeof(*this));
+  cx = 0xfff;
+  cy = 0xfff;
+  boundary_left = 0x7f;
+  boundary_right = 0x7f;
+  boundary_up = 0x7f;
+  boundary_down = 0x7f;
+}
+
 PA_object::PA_object(const uint8_t *data, int format)
 {
   load(data, format);
 }
+
+int PA_object_size(int format)
+{
+  switch (format)
+  {
+  default:
+  case 1: return 16;
+  case 2: return 6;
+  case 3: return 9;
+  case 4: return 13;
+  }
+}
+
+int PA_smallest_format(int fields)
+{
+  switch (fields & PA_all_fields)
+  {
+  default:
+  case PA_all_fields:         return 1;
+  case PA_position_fields:    return 2;
+  case PA_brightness_fields:  return 3;
+  case PA_boundary_fields:    return 4;
+  }
+}
@@ -23,10 +23,28 @@ struct PA_object
 
   void render_ascii(char *output, int pitch, char symbol) const;
   void load(const uint8_t *data, int format);
+  void store(uint8_t *data, int format) const;
+  void set_empty();
   PA_object(const uint8_t *data, int format);
   PA_object()
   {
   }
 };
 
+// Groups of fields, each carried by only some of the report formats. Area
+// and centroid are in every format.
+enum PA_object_fields
+{
+  PA_position_fields = 0,
+  PA_brightness_fields = 1 << 0,  // brightness, range, radius: formats 1 and 3
+  PA_boundary_fields = 1 << 1,    // boundary, aspect ratio, velocity: formats 1 and 4
+  PA_all_fields = PA_brightness_fields | PA_boundary_fields
+};
+
+// Bytes per object in a report of the given format (1-4)
+int PA_object_size(int format);
+
+// Smallest report format carrying the given fields (PA_object_fields)
+int PA_smallest_format(int fields);
+
 #endif  // INCLUDED_PIXART_OBJECT_HPP
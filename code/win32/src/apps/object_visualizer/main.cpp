@@ -8,7 +8,16 @@
 #include "util/command_line.hpp"
 #include "serial/serial_port.hpp"
 #include "serial/serial_replay_device.hpp"
-#include "arduino/packet_reader.hpp"
+#include "serial/virtual_sensor_device.hpp"
+#include "serial/framed_serial_device.hpp"
+#include "serial/threaded_serial_device.hpp"
+#include "recording/recording_format.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "arduino/handshake.hpp"
+#include "arduino/baud_rate.hpp"
+#include "arduino/sensor_frame.hpp"
+#include "arduino/clock_sync.hpp"
+#include "arduino/report_credits.hpp"
 #include "pa_driver/packets.hpp"
 #include "pa_driver/pixart_object.hpp"
 #include "pixart/camera_parameters.hpp"
@@ -22,11 +31,33 @@
 #include <memory>
 #include <set>
 #include <cmath>
+#include <thread>
+#include <algorithm>
 
 static constexpr const char *k_port = "Arduino/SerialPort/PortName";
 static constexpr const char *k_baud = "Arduino/SerialPort/BaudRate";
+static constexpr const char *k_max_baud = "Arduino/SerialPort/MaxBaudRate";
+static constexpr const char *k_framing = "Arduino/SerialPort/Framing";
+static constexpr const char *k_stream = "Arduino/SerialPort/Stream";
+static constexpr const char *k_compact_reports = "Arduino/SerialPort/CompactReports";
+static constexpr const char *k_report_batch = "Arduino/SerialPort/ReportBatch";
+static constexpr const char *k_report_credits = "Arduino/SerialPort/ReportCredits";
+static constexpr const char *k_clock_sync = "Arduino/SerialPort/ClockSync";
+static constexpr const char *k_report_format = "Arduino/SerialPort/ReportFormat";
+static constexpr const char *k_handshake_timeout = "Arduino/SerialPort/HandshakeTimeoutMilliseconds";
 static constexpr const char *k_record_to = "Arduino/SerialPort/Record";
 static constexpr const char *k_replay_from = "Arduino/SerialPort/Replay";
+static constexpr const char *k_replay_speed = "Arduino/SerialPort/ReplaySpeed";
+static constexpr const char *k_replay_loop = "Arduino/SerialPort/ReplayLoop";
+static constexpr const char *k_record_buffer = "Arduino/SerialPort/RecordBufferKB";
+static constexpr const char *k_record_flush = "Arduino/SerialPort/RecordFlushMilliseconds";
+static constexpr const char *k_record_compress = "Arduino/SerialPort/RecordCompressed";
+static constexpr const char *k_virtual_sensor = "Arduino/VirtualSensor/Enabled";
+static constexpr const char *k_virtual_rate = "Arduino/VirtualSensor/FrameRate";
+static constexpr const char *k_virtual_noise = "Arduino/VirtualSensor/CentroidNoise";
+static constexpr const char *k_virtual_dropout = "Arduino/VirtualSensor/DropoutProbability";
+static constexpr const char *k_busy_poll = "Arduino/SerialPort/BusyPoll";
+static constexpr const char *k_io_thread = "Arduino/SerialPort/IOThread";
 static constexpr const char *k_print_settings = "SettingsPrintout/Enabled";
 static constexpr const char *k_print_objs = "ObjectASCIIPrintout/Enabled";
 static constexpr const char *k_sensor_resolution = "SensorScaleResolution";
@@ -47,47 +78,178 @@ static void remove_window(std::set<std::shared_ptr<i_window>> *windows, SDL_Wind
   }
 }
 
-static void render_frames(i_serial_device *port, const pixart::settings &settings, std::set<std::shared_ptr<i_window>> *windows)
+namespace
 {
-  object_report_request_packet request;
+  // How reports are received, as agreed with the firmware
+  struct report_session
+  {
+    bool streaming = false;   // subscribed to rather than requested
+    unsigned credits = 0;     // reports kept in flight when requested, 0 to request one at a time
+    bool clock_sync = false;  // firmware clock is tracked to measure latency
+  };
+
+  struct frame_renderer
+  {
+    i_serial_device *port;
+    std::set<std::shared_ptr<i_window>> *windows;
+    bool streaming;
+    report_credit_manager *credits;   // nullptr if reports are requested one at a time
+    clock_synchronizer *clock;        // nullptr if the firmware clock is not tracked
+    object_report_request_packet request;
+    size_t frame = 0;   // number of the next frame to be received
+
+    // Gaps in the frame counters of streamed reports
+    frame_gap_counter gaps;
+    sensor_frame decoded;
+
+    // Newest frame received, drawn by present(). Frames that arrive faster
+    // than the display refreshes are counted but not drawn, so that they do
+    // not back up behind the vsync of every blit.
+    sensor_frame latest;
+    bool have_latest = false;
+    uint64_t presented_frames = 0;
+
+    // Time from frames being read by the firmware to being rendered
+    uint64_t latency_samples = 0;
+    double total_latency_ms = 0;
+    double max_latency_ms = 0;
+
+    void on_packet(const clock_sync_response_packet &response)
+    {
+      if (clock)
+      {
+        clock->on_packet(response);
+      }
+    }
+
+    void on_packet(const object_report_packet &report)
+    {
+      decode_report(report, &decoded);
+      receive(decoded);
+    }
 
-  packet_reader reader(
-    [&](uint8_t *buffer, size_t size) -> size_t
+    void on_packet(const compact_object_report_packet &report)
     {
-      return port->read(buffer, size);
-    },
-    [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
+      decode_report(report, &decoded);
+      receive(decoded);
+    }
+
+    void on_packet(const object_report_batch_packet &batch)
     {
-      if (id == PacketID::ObjectReport)
+      batch.for_each([this](const compact_object_report_packet &report)
       {
-        const object_report_packet *response = reinterpret_cast<const object_report_packet *>(buffer);
+        on_packet(report);
+      });
+    }
+
+    void receive(const sensor_frame &sensor)
+    {
+      frame++;
+      latest = sensor;
+      have_latest = true;
 
+      if (streaming)
+      {
+        gaps.add(sensor);
+      }
+      else if (credits)
+      {
+        credits->on_report(port, sensor);
+      }
+      else
+      {
         // Request next
         port->write(request);
+      }
+    }
 
-        // Decode objects
-        std::array<PA_object, 16> objs;
-        for (int i = 0; i < 16; i++)
-        {
-          objs[i].load(&response->data[i * 16], response->format);
-        }
+    // Draws the newest frame received since the last call, if any
+    void present()
+    {
+      if (!have_latest)
+      {
+        return;
+      }
+      have_latest = false;
+      presented_frames++;
 
-        // Update views
-        for (auto &window: *windows)
-        {
-          window->update(objs);
-        }
+      if (clock && latest.has_timing && clock->estimator().valid())
+      {
+        double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - clock->estimator().sensor_to_host(latest.timestamp_micros)).count();
+        latency_samples++;
+        total_latency_ms += latency_ms;
+        max_latency_ms = std::max(max_latency_ms, latency_ms);
+      }
 
-        for (auto &window: *windows)
-        {
-          window->blit();
-        }
+      // Update views
+      for (auto &window: *windows)
+      {
+        window->update(latest.objects);
+      }
 
-        return true;
+      for (auto &window: *windows)
+      {
+        window->blit();
       }
-      return false;
     }
-  );
+  };
+}
+
+// If streaming, the firmware is subscribed to and sends every frame unasked.
+// Otherwise, if credits are given, the firmware is granted that many reports
+// and more as they arrive, so that it stops sending when the host stops
+// reading, and granted them all again if reports stop arriving because some
+// were lost. Failing that, each report is requested once the previous one
+// has arrived. Every report received is accounted for, but only the newest
+// is drawn on each pass of the loop, as blits wait for vsync and the sensor
+// usually runs faster than the display. With clock sync, the firmware clock
+// is tracked in between reports and the latency of each drawn frame
+// measured.
+static void render_frames(i_serial_device *port, serial_replay_device *replay, const pixart::settings &settings, std::set<std::shared_ptr<i_window>> *windows, bool busy_poll, const report_session &session)
+{
+  // When blocking, wake up at least this often to service window events
+  constexpr auto event_poll_interval = std::chrono::milliseconds(10);
+
+  clock_synchronizer clock;
+  report_credit_manager credits(uint16_t(session.credits));
+  bool use_credits = !session.streaming && session.credits > 0;
+  frame_renderer renderer{ port, windows, session.streaming, use_credits ? &credits : nullptr, session.clock_sync ? &clock : nullptr };
+  auto reader = make_packet_reader(renderer);
+
+  // Seeking is possible when replaying. Page keys move by one second.
+  bool paused = false;
+  size_t num_frames = 0;
+  size_t page_frames = 100;
+  if (replay)
+  {
+    const recording::frame_index &index = replay->frame_index();
+    num_frames = index.num_frames();
+    renderer.frame = replay->next_frame();
+    if (index.frame_period_ns() > 0)
+    {
+      page_frames = std::max<size_t>(1, size_t(1e9 / index.frame_period_ns()));
+    }
+    LOG_INFO("Replay controls: Space = pause, Left/Right = step, PageUp/PageDown = skip " << page_frames << " frames, Home/End = first/last frame (" << num_frames << " frames)\n");
+  }
+
+  auto seek = [&](int64_t frame)
+  {
+    if (num_frames == 0)
+    {
+      return;
+    }
+    frame = std::max<int64_t>(0, std::min<int64_t>(frame, num_frames - 1));
+    replay->seek_to_frame(size_t(frame));
+    reader.reset();
+    renderer.frame = size_t(frame);
+    if (paused)
+    {
+      // Render just this frame
+      reader.wait_for_packets(port, 1);
+      renderer.present();
+    }
+    LOG_INFO("Frame " << frame << "/" << num_frames);
+  };
 
   // Initialize windows
   for (auto &window: *windows)
@@ -96,15 +258,58 @@ static void render_frames(i_serial_device *port, const pixart::settings &setting
   }
 
   // Start rendering frames
-  port->write(request);
+  if (session.streaming)
+  {
+    port->write(subscribe_packet());
+  }
+  else if (renderer.credits)
+  {
+    renderer.credits->start(port);
+  }
+  else
+  {
+    port->write(renderer.request);
+  }
   bool quit = false;
   SDL_Event e;
   while (!quit)
   {
-    reader.tick();
+    if (paused)
+    {
+      std::this_thread::sleep_for(event_poll_interval);
+    }
+    else
+    {
+      if (renderer.clock)
+      {
+        renderer.clock->tick(port);
+      }
+      auto deadline = busy_poll ? std::chrono::steady_clock::time_point::min() : std::chrono::steady_clock::now() + event_poll_interval;
+      reader.receive(port, deadline);
+
+      // Take in everything else already available before drawing, as a read
+      // may return less (replays, for instance, stop at the end of each
+      // recorded block, which may split a packet), but not for so long that
+      // events go unserviced
+      auto catch_up_end = std::chrono::steady_clock::now() + event_poll_interval;
+      uint64_t bytes_received;
+      do
+      {
+        bytes_received = reader.bytes_received();
+        reader.receive(port, std::chrono::steady_clock::time_point::min());
+      } while (reader.bytes_received() != bytes_received && std::chrono::steady_clock::now() < catch_up_end);
+      if (renderer.credits)
+      {
+        renderer.credits->tick(port);
+      }
+      renderer.present();
+    }
 
     while (SDL_PollEvent(&e) != 0)
     {
+      // Last frame received, which is the one drawn
+      int64_t current = int64_t(renderer.frame) - 1;
+
       switch (e.type)
       {
       case SDL_QUIT:
@@ -118,23 +323,86 @@ static void render_frames(i_serial_device *port, const pixart::settings &setting
         break;
       case SDL_MOUSEWHEEL:
         break;
+      case SDL_KEYDOWN:
+        if (!replay)
+        {
+          break;
+        }
+        switch (e.key.keysym.sym)
+        {
+        default:
+          break;
+        case SDLK_SPACE:
+          paused = !paused;
+          if (!paused)
+          {
+            // Resume pacing from the next frame
+            seek(current + 1);
+          }
+          break;
+        case SDLK_RIGHT:
+          paused = true;
+          seek(current + 1);
+          break;
+        case SDLK_LEFT:
+          paused = true;
+          seek(current - 1);
+          break;
+        case SDLK_PAGEDOWN:
+          seek(current + int64_t(page_frames));
+          break;
+        case SDLK_PAGEUP:
+          seek(current - int64_t(page_frames));
+          break;
+        case SDLK_HOME:
+          seek(0);
+          break;
+        case SDLK_END:
+          seek(num_frames - 1);
+          break;
+        }
+        break;
       }
     }
   }
+
+  if (session.streaming)
+  {
+    port->write(unsubscribe_packet());
+    LOG_INFO("Streamed " << renderer.frame << " frames (" << renderer.presented_frames << " drawn), " << renderer.gaps.missed_frames() << " missed, " << renderer.gaps.repeated_frames() << " repeated");
+  }
+  if (renderer.credits && renderer.credits->regrants() > 0)
+  {
+    LOG_INFO("Report credits were granted again " << renderer.credits->regrants() << " times after reports stopped arriving");
+  }
+  if (renderer.latency_samples > 0)
+  {
+    const clock_sync_estimator &estimator = clock.estimator();
+    LOG_INFO("Sensor-to-render latency " << renderer.total_latency_ms / renderer.latency_samples << " ms mean, " << renderer.max_latency_ms << " ms max (clock error bound " << 1e-6 * estimator.error_bound().count() << " ms, drift " << estimator.drift_ppm() << " ppm)");
+  }
 }
 
-static void configure_sensor(i_serial_device *port, const util::config::Node &config)
+static void configure_sensor(i_serial_device *port, const util::config::Node &config, const firmware_info &firmware = firmware_info())
 {
   pixart::settings settings;
   settings.resolution_x = config[k_sensor_resolution]["width"].ValueAs<uint16_t>();
   settings.resolution_y = config[k_sensor_resolution]["height"].ValueAs<uint16_t>();
-  write_sensor_settings(port, settings);
+  write_sensor_settings(port, settings, firmware);
 }
 
-static std::shared_ptr<i_serial_device> create_serial_connection(const util::config::Node &config)
+// Opens the serial connection (or replay) and obtains the sensor settings.
+// The sensor is configured and its registers captured before recording
+// begins, so that they can be stored in the recording header. The session
+// is set to how reports are to be received, as far as the firmware supports
+// the configured options. Unless a report format is configured, the smallest
+// one carrying the required fields (PA_object_fields) is selected.
+static std::shared_ptr<i_serial_device> create_serial_connection(const util::config::Node &config, int required_fields, pixart::settings *settings, report_session *session)
 {
+  *session = report_session();
+
   const std::string port_name = config[k_port].Value<std::string>();
   const unsigned baud = config[k_baud].ValueAs<unsigned>();
+  const bool print_settings = config[k_print_settings].ValueAs<bool>();
 
   bool record = config[k_record_to].Exists();
   bool replay = config[k_replay_from].Exists();
@@ -147,19 +415,107 @@ static std::shared_ptr<i_serial_device> create_serial_connection(const util::con
   {
     std::string file = config[k_replay_from].ValueAs<std::string>();
     auto replayer = std::make_shared<serial_replay_device>(file);
+    replayer->set_speed(config[k_replay_speed].ValueAs<double>());
+    replayer->set_loop(config[k_replay_loop].ValueAs<bool>());
     LOG_INFO("Replaying from '" << file << "'...\n");
+    if (replayer->metadata().version >= 2)
+    {
+      // Settings are in the header and no register traffic was recorded
+      *settings = decode_sensor_settings(replayer->metadata().registers, print_settings);
+    }
+    else
+    {
+      configure_sensor(replayer.get(), config);
+      *settings = read_sensor_settings(replayer.get(), print_settings);
+    }
     return replayer;
   }
-  else if (record)
+
+  std::unique_ptr<i_serial_device> port;
+  if (config[k_virtual_sensor].ValueAs<bool>())
+  {
+    virtual_sensor_config virtual_config;
+    double frame_rate = config[k_virtual_rate].ValueAs<double>();
+    virtual_config.real_time = frame_rate > 0;
+    virtual_config.frame_rate = frame_rate > 0 ? frame_rate : virtual_config.frame_rate;
+    virtual_config.centroid_noise = config[k_virtual_noise].ValueAs<double>();
+    virtual_config.dropout_probability = config[k_virtual_dropout].ValueAs<double>();
+    port = std::make_unique<virtual_sensor_device>(virtual_config);
+    LOG_INFO("Using virtual sensor\n");
+  }
+  else
   {
+    port = std::make_unique<serial_port>(port_name, baud);
+  }
+
+  // Returns as soon as the board has booted
+  firmware_info firmware = handshake(port.get(), std::chrono::milliseconds(config[k_handshake_timeout].ValueAs<unsigned>()));
+  if (print_settings)
+  {
+    print_firmware_info(firmware);
+  }
+
+  unsigned link_baud = negotiate_baud_rate(port.get(), firmware, baud, config[k_max_baud].ValueAs<unsigned>());
+  if (link_baud != baud)
+  {
+    LOG_INFO("Serial link at " << link_baud << " baud\n");
+  }
+
+  if (config[k_framing].ValueAs<bool>() && firmware.has_feature(FirmwareFeature::FramingFeature))
+  {
+    port = negotiate_framing(std::move(port), std::chrono::milliseconds(500));
+  }
+  session->streaming = config[k_stream].ValueAs<bool>() && firmware.has_feature(FirmwareFeature::StreamingFeature);
+  if (!session->streaming && firmware.has_feature(FirmwareFeature::ReportCreditFeature))
+  {
+    session->credits = config[k_report_credits].ValueAs<unsigned>();
+  }
+  session->clock_sync = config[k_clock_sync].ValueAs<bool>() && firmware.has_feature(FirmwareFeature::ClockSyncFeature);
+
+  // Recordings keep every field
+  int format = config[k_report_format].ValueAs<int>();
+  if (format == 0)
+  {
+    format = PA_smallest_format(record ? PA_all_fields : required_fields);
+  }
+  if (!firmware.supports_report_format(format))
+  {
+    LOG_INFO("Firmware does not support report format " << format << ". Using format 1.");
+  }
+  else if (format != 1)
+  {
+    port->write(set_report_format_packet(uint8_t(format)));
+  }
+  if (config[k_compact_reports].ValueAs<bool>() && firmware.has_feature(FirmwareFeature::CompactReportFeature))
+  {
+    port->write(set_report_encoding_packet(ReportEncoding::CompactReport));
+  }
+  unsigned batch = config[k_report_batch].ValueAs<unsigned>();
+  if (batch > 1 && session->streaming && firmware.has_feature(FirmwareFeature::ReportBatchFeature))
+  {
+    port->write(set_report_batching_packet(uint8_t(batch)));
+  }
+  configure_sensor(port.get(), config, firmware);
+  pixart::register_snapshot registers = read_sensor_registers(port.get(), firmware);
+  *settings = decode_sensor_settings(registers, print_settings);
+
+  if (record)
+  {
+    // Recorder sits below the I/O thread so that blocks are timestamped on
+    // arrival
     std::string file = config[k_record_to].ValueAs<std::string>();
-    std::unique_ptr<serial_port> port = std::make_unique<serial_port>(port_name, baud);
-    std::shared_ptr<serial_replay_device> recorder = std::make_shared<serial_replay_device>(file, std::move(port));
+    size_t buffer_size = config[k_record_buffer].ValueAs<size_t>() * 1024;
+    std::chrono::milliseconds flush_interval(config[k_record_flush].ValueAs<unsigned>());
+    recording::block_encoding encoding = config[k_record_compress].ValueAs<bool>() ? recording::block_encoding::delta : recording::block_encoding::raw;
+    port = std::make_unique<serial_replay_device>(file, std::move(port), recording::make_metadata(registers, *settings), encoding, buffer_size, flush_interval);
     LOG_INFO("Recording " << port_name << " to '" << file << "'...\n");
-    return recorder;
   }
 
-  return std::make_shared<serial_port>(port_name, baud);
+  if (config[k_io_thread].ValueAs<bool>())
+  {
+    port = std::make_unique<threaded_serial_device>(std::move(port));
+  }
+  return port;
 }
 
 int main(int argc, char **argv)
@@ -171,10 +527,30 @@ int main(int argc, char **argv)
     std::vector<option_definition> options
     {
       switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
-      default_valued_option("--port", string("name"), "COM3", k_port, "Serial port to connect on."),
-      default_valued_option("--baud", integer("rate", 300, 115200), "115200", k_baud, "Baud rate."),
+      default_valued_option("--port", string("name"), DEFAULT_PORT_NAME, k_port, "Serial port to connect on."),
+      default_valued_option("--baud", integer("rate", 300, 2000000), "115200", k_baud, "Baud rate the firmware starts at."),
+      default_valued_option("--max-baud", integer("rate", 0, 2000000), "1000000", k_max_baud, "Highest baud rate to switch to after connecting. Rates at which the link proves unreliable are skipped."),
+      default_valued_option("--handshake-timeout", integer("milliseconds", 0, 60000), "2500", k_handshake_timeout, "How long to wait for the firmware to answer after connecting. Firmware that does not answer by then is assumed to predate the handshake."),
+      default_valued_option("--stream", util::command_line::boolean(), "true", k_stream, "Subscribe to reports of every frame rather than requesting them one at a time. Dropped frames are counted from the report frame counters. Older firmware falls back to requests."),
+      default_valued_option("--report-format", integer("format", 0, 4), "0", k_report_format, "Sensor report format (1-4). 0 selects the smallest format with the fields needed by the enabled views."),
+      default_valued_option("--compact-reports", util::command_line::boolean(), "true", k_compact_reports, "Have the firmware send only the occupied object slots of each report. Older firmware sends full reports."),
+      default_valued_option("--batch", integer("reports", 0, int(object_report_batch_packet::MaxReports)), "0", k_report_batch, "Have the firmware send streamed reports in batches of this many, which raises throughput at the cost of latency. 0 or 1 sends each report as it is read."),
+      default_valued_option("--credits", integer("reports", 0, 0xffff), "4", k_report_credits, "When not streaming, keep this many report requests in flight, granting more as reports are rendered, so that the link stays busy without a round trip per frame. 0 requests one report at a time, as does older firmware."),
+      default_valued_option("--clock-sync", util::command_line::boolean(), "true", k_clock_sync, "Track the firmware clock with periodic pings, to report the latency from frames being read to being rendered. Older firmware is not tracked."),
+      default_valued_option("--framing", util::command_line::boolean(), "true", k_framing, "Request framed packets with CRCs, which recover from corrupted data. Older firmware falls back to unframed packets."),
       valued_option("--record-to", string("file"), k_record_to, "Capture a recording of the serial port data."),
       valued_option("--replay-from", string("file"), k_replay_from, "Replay captured serial port data."),
+      default_valued_option("--replay-speed", real("factor", 0, 1000), "1", k_replay_speed, "Replay speed relative to the recording. 0 replays as fast as possible."),
+      switch_option({ "--replay-loop" }, k_replay_loop, "Restart replay from the beginning when the end is reached."),
+      default_valued_option("--record-buffer", integer("kilobytes", 1, 1024 * 1024), "4096", k_record_buffer, "Size of each of the two recording buffers written out in the background."),
+      default_valued_option("--record-flush", integer("milliseconds", 1, 3600 * 1000), "1000", k_record_flush, "Maximum time recorded data is buffered before being written out."),
+      default_valued_option("--compress-recording", util::command_line::boolean(), "true", k_record_compress, "Delta-encode object reports (full reports in format 1, compact reports, and batches) against the previous frame in recordings. Other packets are stored as received."),
+      default_valued_option("--io-thread", util::command_line::boolean(), "true", k_io_thread, "Drain the serial port on a dedicated thread so that rendering cannot stall it."),
+      switch_option({ "--virtual-sensor" }, k_virtual_sensor, "Simulate the sensor rather than connecting to the Arduino."),
+      default_valued_option("--virtual-rate", real("hz", 0, 100000), "200", k_virtual_rate, "Frame rate of the virtual sensor. 0 answers each request immediately."),
+      default_valued_option("--virtual-noise", real("units", 0, 4095), "0", k_virtual_noise, "Standard deviation of the noise added to virtual sensor centroids."),
+      default_valued_option("--virtual-dropout", real("probability", 0, 1), "0", k_virtual_dropout, "Probability of a virtual sensor LED dropping out of a frame."),
+      switch_option({ "--busy-poll" }, k_busy_poll, "Spin on the serial port rather than sleeping until data arrives. Lowest latency but occupies a CPU core."),
       default_valued_option("--settings", util::command_line::boolean(), "true", k_print_settings, "Print PixArt sensor settings."),
       switch_option({ "--print-objects" }, k_print_objs, "Print objects for single frame."),
       default_valued_option("--view-objects", util::command_line::boolean(), "true", object_window::k_enabled, "Schematic view of detected objects in sensor frame."),
@@ -216,10 +592,19 @@ int main(int argc, char **argv)
       windows.insert(window);
     }
 
-    std::shared_ptr<i_serial_device> arduino_port = create_serial_connection(config);
+    int required_fields = PA_position_fields;
+    for (auto &window: windows)
+    {
+      required_fields |= window->required_fields();
+    }
+    if (config[k_print_objs].ValueAs<bool>())
+    {
+      required_fields = PA_all_fields;
+    }
 
-    configure_sensor(arduino_port.get(), config);
-    pixart::settings settings = read_sensor_settings(arduino_port.get(), config[k_print_settings].ValueAs<bool>());
+    pixart::settings settings;
+    report_session session;
+    std::shared_ptr<i_serial_device> arduino_port = create_serial_connection(config, required_fields, &settings, &session);
 
     if (config[k_print_objs].ValueAs<bool>())
     {
@@ -228,7 +613,8 @@ int main(int argc, char **argv)
 
     if (windows.size() > 0)
     {
-      render_frames(arduino_port.get(), settings, &windows);
+      auto replay = std::dynamic_pointer_cast<serial_replay_device>(arduino_port);
+      render_frames(arduino_port.get(), replay.get(), settings, &windows, config[k_busy_poll].ValueAs<bool>(), session);
     }
   }
   catch (std::exception& e)
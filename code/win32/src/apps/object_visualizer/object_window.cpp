@@ -8,6 +8,12 @@ public:
   {
   }
 
+  int required_fields() const
+  {
+    // Objects are drawn as their bounding boxes
+    return PA_boundary_fields;
+  }
+
   void update(const std::array<PA_object, 16> &objs)
   {
     static const struct
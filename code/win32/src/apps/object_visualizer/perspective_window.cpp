@@ -68,6 +68,12 @@ public:
       0,  0,  1);
   }
 
+  int required_fields() const
+  {
+    // Only centroids are needed to solve for the pose
+    return PA_position_fields;
+  }
+
   void update(const std::array<PA_object, 16> &objs)
   {
     canonicalize_leds(objs);
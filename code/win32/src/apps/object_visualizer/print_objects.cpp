@@ -1,6 +1,7 @@
 #include "pa_driver/pixart_object.hpp"
 #include "pa_driver/packets.hpp"
-#include "arduino/packet_reader.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "arduino/sensor_frame.hpp"
 #include "serial/i_serial_device.hpp"
 #include <cstdio>
 
@@ -49,36 +50,52 @@ static void print_objects(const PA_object objs[16])
   }
 }
 
-void print_objects(i_serial_device *port)
+namespace
 {
-  packet_reader reader(
-    [&](uint8_t *buffer, size_t size) -> size_t
+  struct object_printer
+  {
+    void on_packet(const object_report_packet &report)
+    {
+      sensor_frame frame;
+      decode_report(report, &frame);
+      print(frame);
+    }
+
+    void on_packet(const compact_object_report_packet &report)
     {
-      return port->read(buffer, size);
-    },
-    [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
+      sensor_frame frame;
+      decode_report(report, &frame);
+      print(frame);
+    }
+
+    void on_packet(const object_report_batch_packet &batch)
     {
-      if (id == PacketID::ObjectReport)
+      batch.for_each([this](const compact_object_report_packet &report)
       {
-        const object_report_packet *response = reinterpret_cast<const object_report_packet *>(buffer);
-
-        // Decode objects
-        PA_object objs[16];
-        for (int i = 0; i < 16; i++)
-        {
-          objs[i].load(&response->data[i * 16], response->format);
-        }
+        on_packet(report);
+      });
+    }
 
-        // Draw them and print object information
-        render_ascii_image(objs);
-        print_objects(objs);
-        return true;
+    void print(const sensor_frame &frame)
+    {
+      if (frame.has_timing)
+      {
+        printf("Frame %u, read at %u us\n\n", unsigned(frame.frame), unsigned(frame.timestamp_micros));
       }
-      return false;
+
+      // Draw them and print object information
+      render_ascii_image(frame.objects.data());
+      print_objects(frame.objects.data());
     }
-  );
+  };
+}
+
+void print_objects(i_serial_device *port)
+{
+  object_printer printer;
+  auto reader = make_packet_reader(printer);
 
   object_report_request_packet request;
   port->write(request);
-  reader.wait_for_packets(1);
+  reader.wait_for_packets(port, 1);
 }
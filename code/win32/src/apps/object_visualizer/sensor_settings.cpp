@@ -1,6 +1,5 @@
-#include "pa_driver/packets.hpp"
-#include "arduino/packet_reader.hpp"
-#include "pixart/settings.hpp"
+#include "apps/object_visualizer/sensor_settings.hpp"
+#include "arduino/register_access.hpp"
 #include "serial/i_serial_device.hpp"
 #include <cstdio>
 #include <map>
@@ -12,13 +11,9 @@ static double compute_frame_period_seconds(uint32_t frame_period_reg)
   return period;
 }
 
-pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings)
+pixart::register_snapshot read_sensor_registers(i_serial_device *port, const firmware_info &firmware)
 {
-  struct
-  {
-    uint8_t bank;
-    uint8_t reg;
-  } registers[] =
+  static const std::vector<register_address> registers =
   {
     { 0x00, 0x02 }, // product ID
     { 0x00, 0x03 }, //
@@ -40,38 +35,17 @@ pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings
     { 0x0c, 0x08 }, //
     { 0x0c, 0x09 }  //
   };
+  return read_registers(port, registers, firmware);
+}
 
-  // Responses are indexed with a key comprising bank and address
+pixart::settings decode_sensor_settings(const pixart::register_snapshot &registers, bool print_settings)
+{
   std::map<uint16_t, uint8_t> values;
-  packet_reader reader(
-    [&](uint8_t *buffer, size_t size) -> size_t
-    {
-      return port->read(buffer, size);
-    },
-    [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
-    {
-      if (id == PacketID::PeekResponse)
-      {
-        const peek_response_packet *response = reinterpret_cast<const peek_response_packet *>(buffer);
-        uint16_t key = (response->bank << 8) | response->address;
-        values.emplace(key, response->data);
-        return true;
-      }
-      return false;
-    }
-  );
-
-  // Send peek request for each register
-  size_t num_requests = sizeof(registers) / sizeof(registers[0]);
-  for (size_t i = 0; i <num_requests; i++)
+  for (auto &reg: registers)
   {
-    peek_packet peek(registers[i].bank, registers[i].reg);
-    port->write(peek);
+    values[(reg.bank << 8) | reg.address] = reg.value;
   }
 
-  // Wait for all responses
-  reader.wait_for_packets(num_requests);
-
   // Decode registers
   uint16_t product_id = (values[0x0003] << 8) | values[0x0002];
   uint16_t max_area_threshold = (values[0x000c] << 8) | values[0x000b];
@@ -113,14 +87,20 @@ pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings
   return pixart::settings{ resolution_x: interpolated_resolution_x, resolution_y: interpolated_resolution_y };
 }
 
-void write_sensor_settings(i_serial_device *port, const pixart::settings &settings)
+pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings, const firmware_info &firmware)
 {
-  poke_packet resolution_x_hi(0x0c, 0x61, (settings.resolution_x >> 8) & 0x0f);
-  poke_packet resolution_x_lo(0x0c, 0x60, settings.resolution_x & 0xff);
-  poke_packet resolution_y_hi(0x0c, 0x63, (settings.resolution_y >> 8) & 0x0f);
-  poke_packet resolution_y_lo(0x0c, 0x62, settings.resolution_y & 0xff);
-  port->write(resolution_x_hi);
-  port->write(resolution_x_lo);
-  port->write(resolution_y_hi);
-  port->write(resolution_y_lo);
+  return decode_sensor_settings(read_sensor_registers(port, firmware), print_settings);
+}
+
+void write_sensor_settings(i_serial_device *port, const pixart::settings &settings, const firmware_info &firmware)
+{
+  // Interpolated resolution x and y, low byte first
+  uint8_t resolution[] =
+  {
+    uint8_t(settings.resolution_x & 0xff),
+    uint8_t((settings.resolution_x >> 8) & 0x0f),
+    uint8_t(settings.resolution_y & 0xff),
+    uint8_t((settings.resolution_y >> 8) & 0x0f)
+  };
+  write_registers(port, 0x0c, 0x60, resolution, sizeof(resolution), firmware);
 }
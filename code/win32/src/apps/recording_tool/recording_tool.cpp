@@ -0,0 +1,171 @@
+/*
+ * recording_tool:
+ *
+ * Offline processing of recordings. Exports the objects decoded from a
+ * recording to a memory-mappable columnar file (see object_columns.hpp).
+ */
+
+#include "util/logging.hpp"
+#include "util/command_line.hpp"
+#include "util/format.hpp"
+#include "serial/serial_replay_device.hpp"
+#include "recording/object_columns.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "pa_driver/packets.hpp"
+#include <cstdio>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+
+static constexpr const char *k_recording = "RecordingTool/Recording";
+static constexpr const char *k_export_columns = "RecordingTool/ExportColumns";
+
+namespace
+{
+  // Tallies frames and the objects that will be exported from them
+  struct object_counter
+  {
+    uint64_t frames = 0;
+    uint64_t objects = 0;
+
+    void on_packet(const object_report_packet &report)
+    {
+      PA_object objs[16];
+      report.load(objs);
+      count(objs);
+    }
+
+    void on_packet(const compact_object_report_packet &report)
+    {
+      PA_object objs[16];
+      report.load(objs);
+      count(objs);
+    }
+
+    void on_packet(const object_report_batch_packet &batch)
+    {
+      batch.for_each([this](const compact_object_report_packet &report)
+      {
+        on_packet(report);
+      });
+    }
+
+    void count(const PA_object objs[16])
+    {
+      frames++;
+      objects += recording::columns::count_objects(objs);
+    }
+  };
+
+  struct column_exporter
+  {
+    recording::object_columns_writer *writer;
+    const recording::frame_index *index;
+    size_t frame = 0;
+
+    void on_packet(const object_report_packet &report)
+    {
+      PA_object objs[16];
+      report.load(objs);
+      append(objs);
+    }
+
+    void on_packet(const compact_object_report_packet &report)
+    {
+      PA_object objs[16];
+      report.load(objs);
+      append(objs);
+    }
+
+    void on_packet(const object_report_batch_packet &batch)
+    {
+      batch.for_each([this](const compact_object_report_packet &report)
+      {
+        on_packet(report);
+      });
+    }
+
+    void append(const PA_object objs[16])
+    {
+      writer->append_frame((*index)[frame].timestamp_ns - (*index)[0].timestamp_ns, objs);
+      frame++;
+    }
+  };
+}
+
+template <typename Handler>
+static void replay_all(const std::string &filename, Handler &handler)
+{
+  serial_replay_device replay(filename);
+  auto reader = make_packet_reader(handler);
+  while (replay.is_connected())
+  {
+    reader.receive(&replay, std::chrono::steady_clock::time_point::min());
+  }
+}
+
+static void export_columns(const std::string &recording_file, const std::string &columns_file)
+{
+  // First pass sizes the columns so the second can stream them to disk
+  object_counter counter;
+  replay_all(recording_file, counter);
+
+  serial_replay_device replay(recording_file);
+  const recording::frame_index &index = replay.frame_index();
+  if (index.num_frames() != counter.frames)
+  {
+    throw std::runtime_error(util::format() << "Frame index of '" << recording_file << "' has " << index.num_frames() << " frames but " << counter.frames << " were replayed");
+  }
+
+  recording::object_columns_writer writer(columns_file, counter.frames, counter.objects);
+  column_exporter exporter{ &writer, &index };
+  auto reader = make_packet_reader(exporter);
+  while (replay.is_connected())
+  {
+    reader.receive(&replay, std::chrono::steady_clock::time_point::min());
+  }
+  writer.finish();
+
+  LOG_INFO("Exported " << counter.frames << " frames and " << counter.objects << " objects to '" << columns_file << "'");
+}
+
+int main(int argc, char **argv)
+{
+  util::config::Node config("Global");
+
+  {
+    using namespace util::command_line;
+    std::vector<option_definition> options
+    {
+      switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
+      valued_option("--recording", string("file"), k_recording, "Recording to process."),
+      valued_option("--export-columns", string("file"), k_export_columns, "Export decoded objects to a columnar file.")
+    };
+    auto state = parse_command_line(&config, options, argc, argv);
+    if (state.exit)
+    {
+      return state.parse_error ? 1 : 0;
+    }
+    if (!config[k_recording].Exists())
+    {
+      LOG_ERROR("No recording specified. Use --recording.");
+      return 1;
+    }
+  }
+
+  try
+  {
+    std::string recording_file = config[k_recording].ValueAs<std::string>();
+    if (config[k_export_columns].Exists())
+    {
+      export_columns(recording_file, config[k_export_columns].ValueAs<std::string>());
+    }
+  }
+  catch (std::exception &e)
+  {
+    LOG_ERROR("Exception caught: " << e.what());
+    return 1;
+  }
+
+  return 0;
+}
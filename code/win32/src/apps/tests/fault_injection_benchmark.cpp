@@ -0,0 +1,287 @@
+/*
+ * fault_injection_benchmark:
+ *
+ * Replays a recording through fault_injecting_device under a series of link
+ * conditions and measures how span_packet_reader copes: parse throughput
+ * under fragmentation, object reports lost or corrupted by dropped bytes and
+ * bit flips, how many bytes it takes to resynchronize after a fault, and the
+ * frame rate achievable at various baud rates.
+ *
+ * A clean pass first records every object report in the recording. A report
+ * received under faults is intact if it matches one of them; otherwise it
+ * was corrupted and accepted anyway.
+ *
+ * Framed scenarios send the same reports with sync words and CRCs (see
+ * pa_driver/framing.hpp) and parse them through framed_serial_device.
+ */
+
+#include "serial/fault_injecting_device.hpp"
+#include "serial/serial_replay_device.hpp"
+#include "serial/framed_serial_device.hpp"
+#include "pa_driver/framing.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "pa_driver/packets.hpp"
+#include "util/logging.hpp"
+#include "util/command_line.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+static constexpr const char *k_replay_from = "Benchmark/Recording";
+static constexpr const char *k_seed = "Benchmark/Seed";
+static constexpr const char *k_link_seconds = "Benchmark/LinkSeconds";
+
+namespace
+{
+  struct scenario
+  {
+    const char *name;
+    fault_profile profile;
+    bool timed;         // run for a fixed time rather than to the end
+    bool framed;
+  };
+
+  struct report_checker
+  {
+    const std::unordered_set<uint64_t> *clean_reports;
+    const fault_injecting_device *device = nullptr;
+    uint64_t reports = 0;
+    uint64_t intact_reports = 0;
+    bool resync_pending = false;
+    uint64_t fault_offset = 0;
+    uint64_t resyncs = 0;
+    uint64_t resync_bytes = 0;
+
+    void on_packet(const object_report_packet &report)
+    {
+      reports++;
+      if (clean_reports->count(hash(report)) == 0)
+      {
+        return;
+      }
+      intact_reports++;
+      if (resync_pending)
+      {
+        // Report ended at or before the end of the bytes delivered so far
+        resync_bytes += device->bytes_delivered() - fault_offset;
+        resyncs++;
+        resync_pending = false;
+      }
+    }
+
+    static uint64_t hash(const object_report_packet &report)
+    {
+      // FNV-1a
+      const uint8_t *data = reinterpret_cast<const uint8_t *>(&report);
+      uint64_t h = 0xcbf29ce484222325ull;
+      for (size_t i = 0; i < report.size(); i++)
+      {
+        h = (h ^ data[i]) * 0x100000001b3ull;
+      }
+      return h;
+    }
+  };
+
+  struct report_collector
+  {
+    std::unordered_set<uint64_t> reports;
+    uint64_t count = 0;
+    std::vector<uint8_t> frames;    // every report, framed
+
+    void on_packet(const object_report_packet &report)
+    {
+      reports.insert(report_checker::hash(report));
+      count++;
+      write_frame(reinterpret_cast<const uint8_t *>(&report), report.size(), [this](const uint8_t *data, size_t size)
+      {
+        frames.insert(frames.end(), data, data + size);
+      });
+    }
+  };
+
+  // Serves a byte stream from memory
+  class memory_serial_device: public i_serial_device
+  {
+  public:
+    memory_serial_device(const std::vector<uint8_t> &data)
+      : m_data(data)
+    {
+    }
+
+    uint32_t read(uint8_t *buffer, uint32_t buf_size) override
+    {
+      size_t count = std::min(size_t(buf_size), m_data.size() - m_idx);
+      memcpy(buffer, &m_data[m_idx], count);
+      m_idx += count;
+      return uint32_t(count);
+    }
+
+    bool write(const uint8_t *buffer, uint32_t buf_size) override
+    {
+      return true;
+    }
+
+    bool is_connected() const override
+    {
+      return m_idx < m_data.size();
+    }
+
+  private:
+    const std::vector<uint8_t> &m_data;
+    size_t m_idx = 0;
+  };
+}
+
+static void run_scenario(const std::string &recording, const scenario &s, const report_collector &clean, std::chrono::seconds link_time)
+{
+  std::unique_ptr<i_serial_device> source;
+  if (s.framed)
+  {
+    source = std::make_unique<memory_serial_device>(clean.frames);
+  }
+  else
+  {
+    source = std::make_unique<serial_replay_device>(recording);
+  }
+  auto injector = std::make_unique<fault_injecting_device>(std::move(source), s.profile);
+  fault_injecting_device &link = *injector;
+  std::unique_ptr<i_serial_device> device;
+  if (s.framed)
+  {
+    device = std::make_unique<framed_serial_device>(std::move(injector));
+  }
+  else
+  {
+    device = std::move(injector);
+  }
+
+  report_checker checker{ &clean.reports, &link };
+  auto reader = make_packet_reader(checker);
+
+  uint8_t buffer[4096];
+  auto t0 = std::chrono::steady_clock::now();
+  auto end_time = t0 + link_time;
+  while (device->is_connected())
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (s.timed && now >= end_time)
+    {
+      break;
+    }
+
+    uint64_t faults = link.faults_delivered();
+    uint32_t bytes_read = device->read(buffer, sizeof(buffer), s.timed ? end_time : std::chrono::steady_clock::time_point::max());
+    if (link.faults_delivered() != faults && !checker.resync_pending)
+    {
+      checker.resync_pending = true;
+      checker.fault_offset = link.last_fault_offset();
+    }
+    reader.feed(buffer, bytes_read);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  uint64_t corrupt = checker.reports - checker.intact_reports;
+  printf("%-28s %9.0f KB/s %9.1f fps  %6llu/%llu intact, %4llu corrupt",
+    s.name,
+    1e-3 * link.bytes_delivered() / seconds,
+    checker.reports / seconds,
+    (unsigned long long) checker.intact_reports,
+    (unsigned long long) (s.timed ? checker.reports : clean.count),
+    (unsigned long long) corrupt);
+  if (link.faults_delivered() > 0)
+  {
+    printf(", %llu faults, %.1f bytes to resync", (unsigned long long) link.faults_delivered(), checker.resyncs ? double(checker.resync_bytes) / checker.resyncs : 0.0);
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+  util::config::Node config("Global");
+
+  {
+    using namespace util::command_line;
+    std::vector<option_definition> options
+    {
+      switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
+      default_valued_option("--replay-from", string("file"), "recordings/paddle0.bin", k_replay_from, "Recording to replay."),
+      default_valued_option("--seed", integer("value", 0, 0x7fffffff), "1", k_seed, "Seed for fault generation."),
+      default_valued_option("--link-seconds", integer("seconds", 1, 3600), "2", k_link_seconds, "Duration of each bandwidth-limited run.")
+    };
+    auto state = parse_command_line(&config, options, argc, argv);
+    if (state.exit)
+    {
+      return state.parse_error ? 1 : 0;
+    }
+  }
+
+  try
+  {
+    std::string recording = config[k_replay_from].ValueAs<std::string>();
+    uint32_t seed = config[k_seed].ValueAs<uint32_t>();
+    std::chrono::seconds link_time(config[k_link_seconds].ValueAs<unsigned>());
+
+    report_collector clean;
+    {
+      serial_replay_device replay(recording);
+      auto reader = make_packet_reader(clean);
+      while (replay.is_connected())
+      {
+        reader.receive(&replay, std::chrono::steady_clock::time_point::min());
+      }
+    }
+    printf("%llu object reports in clean recording\n", (unsigned long long) clean.count);
+
+    auto profile = [seed](uint32_t max_fragment, double drop, double flip, uint32_t baud, int latency_us, int jitter_us)
+    {
+      fault_profile p;
+      p.seed = seed;
+      p.max_fragment = max_fragment;
+      p.drop_probability = drop;
+      p.bit_flip_probability = flip;
+      p.bytes_per_second = fault_profile::baud_to_bytes_per_second(baud);
+      p.latency = std::chrono::microseconds(latency_us);
+      p.jitter = std::chrono::microseconds(jitter_us);
+      return p;
+    };
+
+    std::vector<scenario> scenarios
+    {
+      { "clean",                    profile(0, 0, 0, 0, 0, 0),          false, false },
+      { "fragments of 1-64",        profile(64, 0, 0, 0, 0, 0),         false, false },
+      { "fragments of 1-8",         profile(8, 0, 0, 0, 0, 0),          false, false },
+      { "single bytes",             profile(1, 0, 0, 0, 0, 0),          false, false },
+      { "drop 1e-4",                profile(64, 1e-4, 0, 0, 0, 0),      false, false },
+      { "drop 1e-3",                profile(64, 1e-3, 0, 0, 0, 0),      false, false },
+      { "bit flip 1e-4",            profile(64, 0, 1e-4, 0, 0, 0),      false, false },
+      { "bit flip 1e-3",            profile(64, 0, 1e-3, 0, 0, 0),      false, false },
+      { "115200 baud",              profile(0, 0, 0, 115200, 0, 0),     true, false },
+      { "115200 baud, 2+-1 ms",     profile(0, 0, 0, 115200, 1000, 2000), true, false },
+      { "1000000 baud",             profile(0, 0, 0, 1000000, 0, 0),    true, false },
+      { "2000000 baud, drop 1e-4",  profile(0, 1e-4, 0, 2000000, 0, 0), true, false },
+      { "framed, clean",            profile(0, 0, 0, 0, 0, 0),          false, true },
+      { "framed, single bytes",     profile(1, 0, 0, 0, 0, 0),          false, true },
+      { "framed, drop 1e-4",        profile(64, 1e-4, 0, 0, 0, 0),      false, true },
+      { "framed, drop 1e-3",        profile(64, 1e-3, 0, 0, 0, 0),      false, true },
+      { "framed, bit flip 1e-4",    profile(64, 0, 1e-4, 0, 0, 0),      false, true },
+      { "framed, bit flip 1e-3",    profile(64, 0, 1e-3, 0, 0, 0),      false, true },
+      { "framed, 115200 baud",      profile(0, 0, 0, 115200, 0, 0),     true, true }
+    };
+
+    for (auto &s: scenarios)
+    {
+      run_scenario(recording, s, clean, link_time);
+    }
+  }
+  catch (std::exception &e)
+  {
+    LOG_ERROR("Exception caught: " << e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -5,7 +5,10 @@
  */
 
 #include "pa_driver/packets.hpp"
-#include "arduino/packet_reader.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "arduino/handshake.hpp"
+#include "arduino/baud_rate.hpp"
+#include "arduino/register_access.hpp"
 #include "serial/serial_port.hpp"
 #include "util/logging.hpp"
 #include "util/command_line.hpp"
@@ -16,6 +19,7 @@
 static util::config::Node s_config("Global");
 static constexpr const char *k_port = "Arduino/SerialPort/PortName";
 static constexpr const char *k_baud = "Arduino/SerialPort/BaudRate";
+static constexpr const char *k_max_baud = "Arduino/SerialPort/MaxBaudRate";
 
 static double compute_frame_period_seconds(uint32_t frame_period_reg)
 {
@@ -24,13 +28,37 @@ static double compute_frame_period_seconds(uint32_t frame_period_reg)
   return period;
 }
 
-static void print_sensor_settings(serial_port *port)
+namespace
 {
-  struct
+  struct frame_printer
   {
-    uint8_t bank;
-    uint8_t reg;
-  } registers[] =
+    serial_port *port;
+    object_report_request_packet request;
+    size_t frame_number = 0;
+    std::chrono::high_resolution_clock::time_point tprev;
+
+    void on_packet(const object_report_packet &response)
+    {
+      std::chrono::high_resolution_clock::time_point tnow = std::chrono::high_resolution_clock::now();
+      port->write(reinterpret_cast<const uint8_t *>(&request), sizeof(request));  // request next frame
+
+      if (frame_number > 0)
+      {
+        double ms = std::chrono::duration<double, std::milli>(tnow - tprev).count();
+        int x = response.data[9] & 0x7f;
+        int y = response.data[11] & 0x7f;
+        printf("%1.2f ms elapsed, (%d,%d)\n", ms, x, y);
+      }
+
+      frame_number += 1;
+      tprev = tnow;
+    }
+  };
+}
+
+static void print_sensor_settings(serial_port *port, const firmware_info &firmware)
+{
+  std::vector<register_address> registers =
   {
     { 0x00, 0x02 }, // product ID
     { 0x00, 0x03 }, //
@@ -53,37 +81,13 @@ static void print_sensor_settings(serial_port *port)
     { 0x0c, 0x09 }  //
   };
 
-  // Responses are indexed with a key comprising bank and address
+  // Values are indexed with a key comprising bank and address
   std::map<uint16_t, uint8_t> values;
-  packet_reader reader(
-    [&](uint8_t *buffer, size_t size) -> size_t
-    {
-      return port->read(buffer, size);
-    },
-    [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
-    {
-      if (id == PacketID::PeekResponse)
-      {
-        const peek_response_packet *response = reinterpret_cast<const peek_response_packet *>(buffer);
-        uint16_t key = (response->bank << 8) | response->address;
-        values.emplace(key, response->data);
-        return true;
-      }
-      return false;
-    }
-  );
-
-  // Send peek request for each register
-  size_t num_requests = sizeof(registers) / sizeof(registers[0]);
-  for (size_t i = 0; i <num_requests; i++)
+  for (auto &reg: read_registers(port, registers, firmware))
   {
-    peek_packet peek(registers[i].bank, registers[i].reg);
-    port->write(reinterpret_cast<const uint8_t *>(&peek), sizeof(peek));
+    values[(reg.bank << 8) | reg.address] = reg.value;
   }
 
-  // Wait for all responses
-  reader.wait_for_packets(num_requests);
-
   // Decode registers
   uint16_t product_id = (values[0x0003] << 8) | values[0x0002];
   uint16_t max_area_threshold = (values[0x000c] << 8) | values[0x000b];
@@ -120,43 +124,13 @@ static void print_sensor_settings(serial_port *port)
 
 static void print_frames(serial_port *port)
 {
-  object_report_request_packet request;
-  size_t frame_number = 0;
-  std::chrono::high_resolution_clock::time_point tprev;
-
-  packet_reader reader(
-    [&](uint8_t *buffer, size_t size) -> size_t
-    {
-      return port->read(buffer, size);
-    },
-    [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
-    {
-      std::chrono::high_resolution_clock::time_point tnow = std::chrono::high_resolution_clock::now();
-      if (id == PacketID::ObjectReport)
-      {
-        port->write(reinterpret_cast<const uint8_t *>(&request), sizeof(request));  // request next frame
-        const object_report_packet *response = reinterpret_cast<const object_report_packet *>(buffer);
-
-        if (frame_number > 0)
-        {
-          double ms = std::chrono::duration<double, std::milli>(tnow - tprev).count();
-          int x = response->data[9] & 0x7f;
-          int y = response->data[11] & 0x7f;
-          printf("%1.2f ms elapsed, (%d,%d)\n", ms, x, y);
-        }
-
-        frame_number += 1;
-        tprev = tnow;
-        return true;
-      }
-      return false;
-    }
-  );
+  frame_printer printer{ port };
+  auto reader = make_packet_reader(printer);
 
-  port->write(reinterpret_cast<const uint8_t *>(&request), sizeof(request));
-  while (true)
+  port->write(reinterpret_cast<const uint8_t *>(&printer.request), sizeof(printer.request));
+  while (port->is_connected())
   {
-    reader.tick();
+    reader.receive(port, std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
   }
 }
 
@@ -167,8 +141,9 @@ int main(int argc, char **argv)
     std::vector<option_definition> options
     {
       switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
-      default_valued_option("--port", string("name"), "COM3", k_port, "Serial port to connect on."),
-      default_valued_option("--baud", integer("rate", 300, 115200), "115200", k_baud, "Baud rate.")
+      default_valued_option("--port", string("name"), DEFAULT_PORT_NAME, k_port, "Serial port to connect on."),
+      default_valued_option("--baud", integer("rate", 300, 2000000), "115200", k_baud, "Baud rate the firmware starts at."),
+      default_valued_option("--max-baud", integer("rate", 0, 2000000), "1000000", k_max_baud, "Highest baud rate to switch to after connecting, if the firmware and link allow it.")
     };
     auto state = parse_command_line(&s_config, options, argc, argv);
     if (state.exit)
@@ -179,8 +154,13 @@ int main(int argc, char **argv)
 
   try
   {
-    serial_port arduino_port(s_config[k_port].Value<std::string>(), s_config[k_baud].ValueAs<unsigned>());
-    print_sensor_settings(&arduino_port);
+    unsigned baud = s_config[k_baud].ValueAs<unsigned>();
+    serial_port arduino_port(s_config[k_port].Value<std::string>(), baud);
+    firmware_info firmware = handshake(&arduino_port, std::chrono::milliseconds(2500));
+    print_firmware_info(firmware);
+    baud = negotiate_baud_rate(&arduino_port, firmware, baud, s_config[k_max_baud].ValueAs<unsigned>());
+    LOG_INFO("Serial link at " << baud << " baud\n");
+    print_sensor_settings(&arduino_port, firmware);
     print_frames(&arduino_port);
   }
   catch (std::exception& e)
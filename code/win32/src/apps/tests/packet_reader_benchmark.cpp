@@ -0,0 +1,201 @@
+/*
+ * packet_reader_benchmark:
+ *
+ * Compares the type-erased packet_reader (std::function callbacks, separate
+ * header and payload reads, copy into its own buffer) against
+ * span_packet_reader with a compile-time packet_dispatcher handler. A
+ * recording is loaded into memory and parsed repeatedly by each, with the
+ * same per-report work (decoding all 16 objects).
+ */
+
+#include "arduino/packet_reader.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "serial/serial_replay_device.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include "util/logging.hpp"
+#include "util/command_line.hpp"
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+static constexpr const char *k_replay_from = "Benchmark/Recording";
+static constexpr const char *k_iterations = "Benchmark/Iterations";
+static constexpr const char *k_chunk_size = "Benchmark/ChunkSize";
+
+// Serves a byte stream from memory in chunks of at most a fixed size
+class memory_serial_device: public i_serial_device
+{
+public:
+  memory_serial_device(const std::vector<uint8_t> &data, size_t chunk_size)
+    : m_data(data),
+      m_chunk_size(chunk_size)
+  {
+  }
+
+  uint32_t read(uint8_t *buffer, uint32_t buf_size) override
+  {
+    size_t count = std::min({ size_t(buf_size), m_chunk_size, m_data.size() - m_idx });
+    memcpy(buffer, &m_data[m_idx], count);
+    m_idx += count;
+    return uint32_t(count);
+  }
+
+  bool write(const uint8_t *buffer, uint32_t buf_size) override
+  {
+    return true;
+  }
+
+  bool is_connected() const override
+  {
+    return m_idx < m_data.size();
+  }
+
+  void rewind()
+  {
+    m_idx = 0;
+  }
+
+private:
+  const std::vector<uint8_t> &m_data;
+  const size_t m_chunk_size;
+  size_t m_idx = 0;
+};
+
+static uint64_t decode_report(const object_report_packet &report)
+{
+  PA_object objs[16];
+  report.load(objs);
+  uint64_t checksum = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    checksum += objs[i].cx + objs[i].cy + objs[i].area;
+  }
+  return checksum;
+}
+
+namespace
+{
+  struct report_decoder
+  {
+    size_t packets = 0;
+    uint64_t checksum = 0;
+
+    void on_packet(const peek_response_packet &response)
+    {
+      packets++;
+    }
+
+    void on_packet(const object_report_packet &report)
+    {
+      checksum += decode_report(report);
+      packets++;
+    }
+  };
+}
+
+static std::vector<uint8_t> load_recording(const std::string &filename)
+{
+  std::vector<uint8_t> data;
+  serial_replay_device replay(filename);
+  uint8_t buffer[4096];
+  while (replay.is_connected())
+  {
+    uint32_t bytes_read = replay.read(buffer, sizeof(buffer));
+    data.insert(data.end(), buffer, buffer + bytes_read);
+  }
+  return data;
+}
+
+template <typename Fn>
+static void run_benchmark(const char *name, size_t iterations, size_t total_bytes, Fn fn)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  size_t packets = 0;
+  uint64_t checksum = 0;
+  for (size_t i = 0; i < iterations; i++)
+  {
+    fn(&packets, &checksum);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  printf("%-34s %8.1f ns/packet  %8.1f MB/s  (%zu packets, checksum %llu)\n", name, 1e9 * seconds / packets, 1e-6 * total_bytes * iterations / seconds, packets, (unsigned long long) checksum);
+}
+
+int main(int argc, char **argv)
+{
+  util::config::Node config("Global");
+
+  {
+    using namespace util::command_line;
+    std::vector<option_definition> options
+    {
+      switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
+      default_valued_option("--replay-from", string("file"), "recordings/paddle0.bin", k_replay_from, "Recording to parse."),
+      default_valued_option("--iterations", integer("count", 1, 100000), "50", k_iterations, "Number of passes over the recording."),
+      default_valued_option("--chunk", integer("bytes", 1, 1 << 20), "4096", k_chunk_size, "Maximum bytes returned by each device read.")
+    };
+    auto state = parse_command_line(&config, options, argc, argv);
+    if (state.exit)
+    {
+      return state.parse_error ? 1 : 0;
+    }
+  }
+
+  try
+  {
+    std::vector<uint8_t> data = load_recording(config[k_replay_from].ValueAs<std::string>());
+    size_t iterations = config[k_iterations].ValueAs<size_t>();
+    memory_serial_device device(data, config[k_chunk_size].ValueAs<size_t>());
+    printf("Loaded %zu bytes\n", data.size());
+
+    run_benchmark("packet_reader (std::function)", iterations, data.size(), [&](size_t *packets, uint64_t *checksum)
+    {
+      packet_reader reader(
+        &device,
+        [&](PacketID id, const uint8_t *buffer, size_t size) -> bool
+        {
+          if (id == PacketID::ObjectReport)
+          {
+            *checksum += decode_report(*reinterpret_cast<const object_report_packet *>(buffer));
+          }
+          *packets += 1;
+          return true;
+        }
+      );
+      device.rewind();
+      while (device.is_connected())
+      {
+        reader.tick();
+      }
+    });
+
+    run_benchmark("span_packet_reader (device reads)", iterations, data.size(), [&](size_t *packets, uint64_t *checksum)
+    {
+      report_decoder decoder;
+      auto reader = make_packet_reader(decoder);
+      device.rewind();
+      while (device.is_connected())
+      {
+        reader.receive(&device, std::chrono::steady_clock::time_point::min());
+      }
+      *checksum += decoder.checksum;
+      *packets += decoder.packets;
+    });
+
+    run_benchmark("span_packet_reader (in place)", iterations, data.size(), [&](size_t *packets, uint64_t *checksum)
+    {
+      report_decoder decoder;
+      auto reader = make_packet_reader(decoder);
+      reader.feed(data.data(), data.size());
+      *checksum += decoder.checksum;
+      *packets += decoder.packets;
+    });
+  }
+  catch (std::exception &e)
+  {
+    LOG_ERROR("Exception caught: " << e.what());
+    return 1;
+  }
+
+  return 0;
+}
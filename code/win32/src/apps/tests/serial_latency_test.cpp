@@ -0,0 +1,132 @@
+/*
+ * serial_latency_test:
+ *
+ * Exercises the Linux serial_port implementation against a pseudo-terminal
+ * pair, with no hardware required. Measures CPU time consumed by an idle
+ * reader blocked in a timed read and the latency from a byte being written to
+ * the master side to the reader waking up with it on the slave side.
+ */
+
+#include "serial/serial_port.hpp"
+#include "util/logging.hpp"
+#include "util/command_line.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr const char *k_iterations = "Test/Iterations";
+static constexpr const char *k_idle_seconds = "Test/IdleSeconds";
+
+static double process_cpu_seconds()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static void measure_idle_cpu(serial_port *port, unsigned seconds)
+{
+  uint8_t buffer[64];
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(seconds);
+  double cpu_start = process_cpu_seconds();
+  while (std::chrono::steady_clock::now() < end)
+  {
+    port->read(buffer, sizeof(buffer), std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+  }
+  double cpu = process_cpu_seconds() - cpu_start;
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("Idle CPU usage        = %1.3f%% (%1.4f s CPU over %1.2f s)\n", 100.0 * cpu / wall, cpu, wall);
+}
+
+static void measure_wakeup_latency(serial_port *port, int master_fd, unsigned iterations)
+{
+  std::vector<double> latencies_us;
+  latencies_us.reserve(iterations);
+  std::atomic<std::chrono::steady_clock::time_point::rep> sent_at(0);
+
+  for (unsigned i = 0; i < iterations; i++)
+  {
+    std::thread writer([&]()
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      uint8_t byte = uint8_t(i);
+      sent_at = std::chrono::steady_clock::now().time_since_epoch().count();
+      if (::write(master_fd, &byte, 1) != 1)
+      {
+        LOG_ERROR("Write to pseudo-terminal master failed");
+      }
+    });
+
+    uint8_t byte;
+    uint32_t bytes_read = port->read(&byte, 1, std::chrono::steady_clock::now() + std::chrono::seconds(1));
+    auto received_at = std::chrono::steady_clock::now();
+    writer.join();
+
+    if (bytes_read == 1)
+    {
+      std::chrono::steady_clock::time_point t0(std::chrono::steady_clock::duration(sent_at.load()));
+      latencies_us.push_back(std::chrono::duration<double, std::micro>(received_at - t0).count());
+    }
+  }
+
+  if (latencies_us.empty())
+  {
+    throw std::runtime_error("No bytes were received");
+  }
+
+  std::sort(latencies_us.begin(), latencies_us.end());
+  auto percentile = [&](double p) { return latencies_us[std::min(latencies_us.size() - 1, size_t(p * latencies_us.size()))]; };
+  printf("Wake-up latency       = min %1.1f us, median %1.1f us, p99 %1.1f us, max %1.1f us (%zu/%u bytes)\n", latencies_us.front(), percentile(0.5), percentile(0.99), latencies_us.back(), latencies_us.size(), iterations);
+}
+
+int main(int argc, char **argv)
+{
+  util::config::Node config("Global");
+
+  {
+    using namespace util::command_line;
+    std::vector<option_definition> options
+    {
+      switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
+      default_valued_option("--iterations", integer("count", 1, 1000000), "1000", k_iterations, "Number of single-byte latency measurements."),
+      default_valued_option("--idle", integer("seconds", 1, 3600), "3", k_idle_seconds, "Duration of idle CPU usage measurement.")
+    };
+    auto state = parse_command_line(&config, options, argc, argv);
+    if (state.exit)
+    {
+      return state.parse_error ? 1 : 0;
+    }
+  }
+
+  try
+  {
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0)
+    {
+      throw std::runtime_error("Unable to create pseudo-terminal pair");
+    }
+    std::string slave_name = ptsname(master_fd);
+    printf("Pseudo-terminal       = %s\n", slave_name.c_str());
+
+    serial_port port(slave_name, 115200);
+    measure_idle_cpu(&port, config[k_idle_seconds].ValueAs<unsigned>());
+    measure_wakeup_latency(&port, master_fd, config[k_iterations].ValueAs<unsigned>());
+    close(master_fd);
+  }
+  catch (std::exception &e)
+  {
+    LOG_ERROR("Exception caught: " << e.what());
+    return 1;
+  }
+
+  return 0;
+}
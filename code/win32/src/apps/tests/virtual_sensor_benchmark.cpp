@@ -0,0 +1,414 @@
+/*
+ * virtual_sensor_benchmark:
+ *
+ * Drives virtual_sensor_device the way the host drives the Arduino (request a
+ * report, wait for it, decode all 16 objects) and measures the report rate it
+ * sustains, both unpaced, which gives the ceiling of the host side of the
+ * link, and in real time at various frame rates. Runs with compact reports
+ * and smaller report formats show how many bytes per frame they save,
+ * streamed runs how many reports are carried per packet when batched, and in
+ * how many bytes each, and credited runs how many report requests are saved
+ * by keeping several in flight, and how the flow recovers from lost reports.
+ * Clock sync runs show how closely report timestamps are mapped to host
+ * time, with the firmware clock running at the host's rate and with it
+ * drifting.
+ *
+ * Reported centroids are checked against the ground truth pose of each frame,
+ * projected with the same intrinsics, to show the error introduced by
+ * quantization and the configured noise, and their frame counters and
+ * timestamps against its frame number and time.
+ */
+
+#include "serial/virtual_sensor_device.hpp"
+#include "serial/framed_serial_device.hpp"
+#include "serial/fault_injecting_device.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "arduino/sensor_frame.hpp"
+#include "arduino/clock_sync.hpp"
+#include "arduino/report_credits.hpp"
+#include "pa_driver/packets.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include "pixart/camera_parameters.hpp"
+#include "util/logging.hpp"
+#include "util/command_line.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+static constexpr const char *k_seconds = "Benchmark/Seconds";
+static constexpr const char *k_seed = "Benchmark/Seed";
+static constexpr const char *k_noise = "Benchmark/CentroidNoise";
+static constexpr const char *k_dropout = "Benchmark/DropoutProbability";
+
+namespace
+{
+  struct report_handler
+  {
+    uint64_t reports = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    sensor_frame frame;
+
+    void on_packet(const object_report_packet &report)
+    {
+      decode_report(report, &frame);
+      reports++;
+      packets++;
+      bytes += report.size();
+    }
+
+    void on_packet(const compact_object_report_packet &report)
+    {
+      decode_report(report, &frame);
+      reports++;
+      packets++;
+      bytes += report.size();
+    }
+
+    void on_packet(const object_report_batch_packet &batch)
+    {
+      batch.for_each([this](const compact_object_report_packet &report)
+      {
+        decode_report(report, &frame);
+        reports++;
+      });
+      packets++;
+      bytes += batch.size();
+    }
+  };
+
+  // Tops up report credits as reports arrive
+  struct credited_report_handler: public report_handler
+  {
+    i_serial_device *port;
+    report_credit_manager *credits;
+    frame_gap_counter gaps;
+
+    credited_report_handler(i_serial_device *in_port, report_credit_manager *in_credits)
+      : port(in_port),
+        credits(in_credits)
+    {
+    }
+
+    void on_packet(const compact_object_report_packet &report)
+    {
+      report_handler::on_packet(report);
+      gaps.add(frame);
+      credits->on_report(port, frame);
+    }
+  };
+
+  // Measures the time from each report's timestamp, mapped to host time, to
+  // its arrival. The virtual sensor sends reports as soon as they are due,
+  // so this is close to the error of the mapping.
+  struct latency_handler
+  {
+    clock_synchronizer clock;
+    uint64_t reports = 0;
+    double total_latency_us = 0;
+    double min_latency_us = HUGE_VAL;
+    double max_latency_us = -HUGE_VAL;
+
+    void on_packet(const compact_object_report_packet &report)
+    {
+      const report_timing *timing = report.timing();
+      if (!timing || clock.estimator().num_samples() < clock_synchronizer::NumInitialPings)
+      {
+        return;
+      }
+      double latency_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - clock.estimator().sensor_to_host(timing->timestamp_micros)).count();
+      reports++;
+      total_latency_us += latency_us;
+      min_latency_us = std::min(min_latency_us, latency_us);
+      max_latency_us = std::max(max_latency_us, latency_us);
+    }
+
+    void on_packet(const clock_sync_response_packet &response)
+    {
+      clock.on_packet(response);
+    }
+  };
+
+  struct centroid_error
+  {
+    uint64_t frames = 0;
+    uint64_t mismatched_frames = 0;   // number of objects differs from ground truth
+    uint64_t mistimed_frames = 0;     // report timing differs from ground truth
+    uint64_t objects = 0;
+    double sum_squared = 0;
+    double max = 0;
+  };
+}
+
+// Compares the reported centroids to the ground truth projection of every LED
+static void check_centroids(const virtual_sensor_config &config, const virtual_frame &truth, const sensor_frame &frame, centroid_error *error)
+{
+  const std::array<PA_object, 16> &objs = frame.objects;
+  double fx = pixart::camera_parameters::focal_length_x_pixels(config.resolution_x);
+  double fy = pixart::camera_parameters::focal_length_y_pixels(config.resolution_y);
+
+  std::vector<std::pair<double, double>> expected;
+  for (auto &led: config.leds)
+  {
+    double p[3];
+    for (int i = 0; i < 3; i++)
+    {
+      p[i] = truth.pose.rotation[i][0] * led[0] + truth.pose.rotation[i][1] * led[1] + truth.pose.rotation[i][2] * led[2] + truth.pose.translation[i];
+    }
+    expected.emplace_back(fx * p[0] / p[2] + 0.5 * config.resolution_x, fy * p[1] / p[2] + 0.5 * config.resolution_y);
+  }
+
+  error->frames++;
+  if (!frame.has_timing || frame.frame != uint32_t(truth.frame) || frame.timestamp_micros != uint32_t(uint64_t(truth.time * 1e6)))
+  {
+    error->mistimed_frames++;
+  }
+
+  size_t num_present = 0;
+  for (auto &obj: objs)
+  {
+    num_present += obj.cx < 0xfff && obj.cy < 0xfff ? 1 : 0;
+  }
+  if (num_present != truth.num_visible || num_present != expected.size())
+  {
+    // Dropouts or LEDs out of view: correspondence is ambiguous
+    error->mismatched_frames++;
+    return;
+  }
+
+  // Noise can change the scan order, so match each object to the nearest
+  // projected LED
+  for (size_t i = 0; i < num_present; i++)
+  {
+    double min_squared = HUGE_VAL;
+    for (auto &point: expected)
+    {
+      double dx = objs[i].cx - point.first;
+      double dy = objs[i].cy - point.second;
+      min_squared = std::min(min_squared, dx * dx + dy * dy);
+    }
+    error->sum_squared += min_squared;
+    error->max = std::max(error->max, std::sqrt(min_squared));
+    error->objects++;
+  }
+}
+
+static void run(const char *name, const virtual_sensor_config &config, std::chrono::seconds duration, ReportEncoding encoding = ReportEncoding::FullReport, uint8_t format = 1)
+{
+  virtual_sensor_device device(config);
+  report_handler handler;
+  auto reader = make_packet_reader(handler);
+  centroid_error error;
+  object_report_request_packet request;
+
+  set_report_encoding_packet set_encoding(encoding);
+  set_report_format_packet set_format(format);
+  device.write(reinterpret_cast<const uint8_t *>(&set_encoding), sizeof(set_encoding));
+  device.write(reinterpret_cast<const uint8_t *>(&set_format), sizeof(set_format));
+
+  auto t0 = std::chrono::steady_clock::now();
+  auto end_time = t0 + duration;
+  while (std::chrono::steady_clock::now() < end_time)
+  {
+    device.write(reinterpret_cast<const uint8_t *>(&request), sizeof(request));
+    uint64_t reports = handler.reports;
+    while (handler.reports == reports && std::chrono::steady_clock::now() < end_time)
+    {
+      reader.receive(&device, end_time);
+    }
+
+    virtual_frame truth;
+    while (handler.reports != reports && device.pop_ground_truth(&truth))
+    {
+      check_centroids(config, truth, handler.frame, &error);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  printf("%-24s %10.1f reports/s %6.1f bytes/report", name, handler.reports / seconds, handler.reports > 0 ? double(handler.bytes) / handler.reports : 0.0);
+  if (error.objects > 0)
+  {
+    printf("  centroid error %.2f rms, %.2f max", std::sqrt(error.sum_squared / error.objects), error.max);
+  }
+  if (error.mismatched_frames > 0)
+  {
+    printf(", %llu/%llu frames with missing LEDs", (unsigned long long) error.mismatched_frames, (unsigned long long) error.frames);
+  }
+  if (error.mistimed_frames > 0)
+  {
+    printf(", %llu/%llu frames with wrong timing", (unsigned long long) error.mistimed_frames, (unsigned long long) error.frames);
+  }
+  printf("\n");
+}
+
+// Subscribes to compact reports, optionally in batches, to show the rate,
+// bytes and packets per report of each
+static void run_stream(const char *name, const virtual_sensor_config &config, std::chrono::seconds duration, uint8_t batch, uint8_t format = 1)
+{
+  virtual_sensor_device device(config);
+  i_serial_device *port = &device;
+  report_handler handler;
+  auto reader = make_packet_reader(handler);
+
+  port->write(set_report_encoding_packet(ReportEncoding::CompactReport));
+  port->write(set_report_format_packet(format));
+  port->write(set_report_batching_packet(batch));
+  port->write(subscribe_packet());
+
+  auto t0 = std::chrono::steady_clock::now();
+  auto end_time = t0 + duration;
+  while (std::chrono::steady_clock::now() < end_time)
+  {
+    reader.receive(port, end_time);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  port->write(unsubscribe_packet());
+
+  printf("%-24s %10.1f reports/s %6.1f bytes/report %6.1f reports/packet\n", name, handler.reports / seconds, handler.reports > 0 ? double(handler.bytes) / handler.reports : 0.0, handler.packets > 0 ? double(handler.reports) / handler.packets : 0.0);
+}
+
+// Grants report credits with report_credit_manager, as object_visualizer
+// does, to show the rate and the grants per report. With bit flips, the link
+// is framed so that corrupted reports are dropped, and without recovery the
+// firmware stops once as many reports are lost as there are credits.
+static void run_credits(const char *name, const virtual_sensor_config &config, std::chrono::seconds duration, uint16_t credits, double bit_flip_probability = 0, bool recover = true)
+{
+  std::unique_ptr<i_serial_device> port = std::make_unique<virtual_sensor_device>(config);
+  if (bit_flip_probability > 0)
+  {
+    fault_profile profile;
+    profile.seed = config.seed;
+    profile.bit_flip_probability = bit_flip_probability;
+    port = negotiate_framing(std::make_unique<fault_injecting_device>(std::move(port), profile), std::chrono::milliseconds(500));
+  }
+  report_credit_manager manager(credits);
+  credited_report_handler handler{ port.get(), &manager };
+  auto reader = make_packet_reader(handler);
+
+  port->write(set_report_encoding_packet(ReportEncoding::CompactReport));
+  manager.start(port.get());
+
+  auto t0 = std::chrono::steady_clock::now();
+  auto end_time = t0 + duration;
+  while (std::chrono::steady_clock::now() < end_time)
+  {
+    reader.receive(port.get(), std::min(end_time, std::chrono::steady_clock::now() + std::chrono::milliseconds(10)));
+    if (recover)
+    {
+      manager.tick(port.get());
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  printf("%-24s %10.1f reports/s %6.1f bytes/report %6.1f reports/grant", name, handler.reports / seconds, handler.reports > 0 ? double(handler.bytes) / handler.reports : 0.0, double(handler.reports) / manager.grants());
+  if (bit_flip_probability > 0)
+  {
+    printf(", %llu frames lost, %llu regrants", (unsigned long long) handler.gaps.missed_frames(), (unsigned long long) manager.regrants());
+  }
+  printf("\n");
+}
+
+// Subscribes in real time while tracking the firmware clock
+static void run_clock_sync(const char *name, const virtual_sensor_config &config, std::chrono::seconds duration)
+{
+  virtual_sensor_device device(config);
+  i_serial_device *port = &device;
+  latency_handler handler;
+  auto reader = make_packet_reader(handler);
+
+  port->write(set_report_encoding_packet(ReportEncoding::CompactReport));
+  port->write(subscribe_packet());
+
+  auto end_time = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end_time)
+  {
+    handler.clock.tick(port);
+    reader.receive(port, end_time);
+  }
+  port->write(unsubscribe_packet());
+
+  const clock_sync_estimator &estimator = handler.clock.estimator();
+  printf("%-24s %10.1f us mean latency, %.1f min, %.1f max  drift %.1f ppm, error bound %.1f us\n", name, handler.reports > 0 ? handler.total_latency_us / handler.reports : 0.0, handler.min_latency_us, handler.max_latency_us, estimator.drift_ppm(), 1e-3 * estimator.error_bound().count());
+}
+
+int main(int argc, char **argv)
+{
+  util::config::Node config("Global");
+
+  {
+    using namespace util::command_line;
+    std::vector<option_definition> options
+    {
+      switch_option({{ "--help" }}, {{ "-?", "-h", "-help" }}, "ShowHelp", "Print this help text."),
+      default_valued_option("--seconds", integer("seconds", 1, 3600), "2", k_seconds, "Duration of each run."),
+      default_valued_option("--seed", integer("value", 0, 0x7fffffff), "1", k_seed, "Seed for the trajectory, noise, and dropouts."),
+      default_valued_option("--noise", real("units", 0, 4095), "2", k_noise, "Standard deviation of the noise added to centroids."),
+      default_valued_option("--dropout", real("probability", 0, 1), "0.001", k_dropout, "Probability of an LED dropping out of a frame.")
+    };
+    auto state = parse_command_line(&config, options, argc, argv);
+    if (state.exit)
+    {
+      return state.parse_error ? 1 : 0;
+    }
+  }
+
+  try
+  {
+    std::chrono::seconds duration(config[k_seconds].ValueAs<unsigned>());
+
+    virtual_sensor_config base;
+    base.seed = config[k_seed].ValueAs<uint32_t>();
+
+    virtual_sensor_config noisy = base;
+    noisy.centroid_noise = config[k_noise].ValueAs<double>();
+    noisy.dropout_probability = config[k_dropout].ValueAs<double>();
+
+    auto unpaced = [](virtual_sensor_config c)
+    {
+      c.real_time = false;
+      return c;
+    };
+    auto paced = [](virtual_sensor_config c, double frame_rate)
+    {
+      c.frame_rate = frame_rate;
+      return c;
+    };
+
+    run("unpaced", unpaced(base), duration);
+    run("unpaced, noisy", unpaced(noisy), duration);
+    run("unpaced, compact", unpaced(base), duration, ReportEncoding::CompactReport);
+    run("unpaced, compact, fmt 2", unpaced(base), duration, ReportEncoding::CompactReport, 2);
+    run("unpaced, compact, fmt 4", unpaced(base), duration, ReportEncoding::CompactReport, 4);
+    run("200 Hz", paced(base, 200), duration);
+    run("1000 Hz", paced(base, 1000), duration);
+    run("4000 Hz, noisy", paced(noisy, 4000), duration);
+    run("4000 Hz, noisy, compact", paced(noisy, 4000), duration, ReportEncoding::CompactReport);
+    run_stream("stream, unpaced", unpaced(base), duration, 0);
+    run_stream("stream, unpaced, batch 16", unpaced(base), duration, 16);
+    run_stream("stream, unpaced, batch 64", unpaced(base), duration, 64);
+    run_stream("stream, unpaced, fmt 4", unpaced(base), duration, 0, 4);
+    run_stream("stream, fmt 4, batch 16", unpaced(base), duration, 16, 4);
+    run_stream("stream, 1000 Hz", paced(base, 1000), duration, 0);
+    run_stream("stream, 1000 Hz, batch 16", paced(base, 1000), duration, 16);
+    run_credits("credits 1, unpaced", unpaced(base), duration, 1);
+    run_credits("credits 16, unpaced", unpaced(base), duration, 16);
+    run_credits("credits 16, 1000 Hz", paced(base, 1000), duration, 16);
+    run_credits("credits 4, 1000 Hz, flips", paced(base, 1000), duration, 4, 1e-4);
+    run_credits("credits 4, no recovery", paced(base, 1000), duration, 4, 1e-4, false);
+
+    virtual_sensor_config drifting = base;
+    drifting.clock_drift_ppm = 100;
+    run_clock_sync("clock sync, 1000 Hz", paced(base, 1000), duration);
+    run_clock_sync("clock sync, 100 ppm drift", paced(drifting, 1000), duration);
+  }
+  catch (std::exception &e)
+  {
+    LOG_ERROR("Exception caught: " << e.what());
+    return 1;
+  }
+
+  return 0;
+}
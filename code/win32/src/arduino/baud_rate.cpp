@@ -0,0 +1,205 @@
+#include "arduino/baud_rate.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "util/format.hpp"
+#include "util/logging.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+  struct set_baud_rate_response_handler
+  {
+    uint32_t baud_rate = 0;
+
+    void on_packet(const set_baud_rate_response_packet &response)
+    {
+      baud_rate = response.baud_rate;
+    }
+  };
+
+  // Accepts only the response to the latest PeekRange, so that a late
+  // response to an earlier one is not taken for it
+  struct peek_range_response_handler
+  {
+    uint8_t sequence = 0;
+    bool valid = false;
+    uint8_t data[BaudRateVerifyPeekCount] = {};
+
+    bool on_packet(const peek_range_response_packet &response)
+    {
+      if (response.sequence != sequence)
+      {
+        return false;
+      }
+      valid = response.bank == BaudRateVerifyPeekBank && response.start == 0 && response.count == BaudRateVerifyPeekCount;
+      if (valid)
+      {
+        memcpy(data, response.data, sizeof(data));
+      }
+      return true;
+    }
+  };
+
+  // Register values read at the rate the link started at, where it is known
+  // to work. Registers that changed between two reads are not compared.
+  struct link_reference
+  {
+    bool available = false;
+    uint8_t values[BaudRateVerifyPeekCount] = {};
+    bool stable[BaudRateVerifyPeekCount] = {};
+  };
+}
+
+static uint8_t s_next_sequence = 0;
+
+static bool peek_verify_range(i_serial_device *port, dispatching_packet_reader<peek_range_response_handler> *reader, peek_range_response_handler *handler)
+{
+  handler->sequence = s_next_sequence++;
+  handler->valid = false;
+  port->write(peek_range_packet(handler->sequence, BaudRateVerifyPeekBank, 0, BaudRateVerifyPeekCount));
+  return reader->wait_for_packets(port, 1, std::chrono::steady_clock::now() + BaudRateVerifyTimeout) && handler->valid;
+}
+
+static link_reference read_link_reference(i_serial_device *port, const firmware_info &firmware)
+{
+  link_reference reference;
+  if (!firmware.has_feature(FirmwareFeature::RegisterBlockFeature))
+  {
+    return reference;
+  }
+
+  peek_range_response_handler handler;
+  auto reader = make_packet_reader(handler);
+  if (!peek_verify_range(port, &reader, &handler))
+  {
+    return reference;
+  }
+  memcpy(reference.values, handler.data, sizeof(reference.values));
+  if (!peek_verify_range(port, &reader, &handler))
+  {
+    return reference;
+  }
+  for (size_t i = 0; i < BaudRateVerifyPeekCount; i++)
+  {
+    reference.stable[i] = handler.data[i] == reference.values[i];
+  }
+  reference.available = true;
+  return reference;
+}
+
+static bool same_firmware(const firmware_info &a, const firmware_info &b)
+{
+  return a.responded == b.responded &&
+         a.protocol_version == b.protocol_version &&
+         a.report_formats == b.report_formats &&
+         a.features == b.features &&
+         a.max_baud_rate == b.max_baud_rate &&
+         a.firmware_build == b.firmware_build;
+}
+
+static bool verify_link(i_serial_device *port, const firmware_info &firmware, const link_reference &reference)
+{
+  for (int i = 0; i < BaudRateVerifyRoundTrips; i++)
+  {
+    if (!same_firmware(handshake(port, BaudRateVerifyTimeout), firmware))
+    {
+      return false;
+    }
+  }
+  if (!reference.available)
+  {
+    return true;
+  }
+
+  // Sustained traffic, mostly from the firmware, as reports will be
+  peek_range_response_handler handler;
+  auto reader = make_packet_reader(handler);
+  for (int i = 0; i < BaudRateVerifyPeeks; i++)
+  {
+    if (!peek_verify_range(port, &reader, &handler))
+    {
+      return false;
+    }
+    for (size_t j = 0; j < BaudRateVerifyPeekCount; j++)
+    {
+      if (reference.stable[j] && handler.data[j] != reference.values[j])
+      {
+        return false;
+      }
+    }
+  }
+  return reader.invalid_bytes() == 0;
+}
+
+// Returns to the current rate after a failed switch
+static void recover(i_serial_device *port, unsigned current_baud_rate, unsigned failed_baud_rate)
+{
+  // Wait out the firmware's confirmation timeout
+  port->set_baud_rate(current_baud_rate);
+  std::this_thread::sleep_for(std::chrono::milliseconds(BaudRateConfirmTimeoutMilliseconds) + BaudRateVerifyTimeout);
+  if (handshake(port, std::chrono::seconds(1)).responded)
+  {
+    return;
+  }
+
+  // A garbled Hello may have been taken as confirmation. Ask the firmware to
+  // come back down, at the rate it is stuck at.
+  port->set_baud_rate(failed_baud_rate);
+  port->write(set_baud_rate_packet(current_baud_rate));
+  std::this_thread::sleep_for(BaudRateVerifyTimeout);
+  port->set_baud_rate(current_baud_rate);
+  if (!handshake(port, std::chrono::seconds(1)).responded)
+  {
+    throw std::runtime_error(util::format() << "Lost contact with firmware after failing to switch to " << failed_baud_rate << " baud. Try a lower --max-baud.");
+  }
+}
+
+static bool try_baud_rate(i_serial_device *port, const firmware_info &firmware, const link_reference &reference, unsigned current_baud_rate, unsigned baud_rate)
+{
+  // Host side first, so that the firmware is not switched to a rate the port
+  // cannot follow
+  if (!port->set_baud_rate(baud_rate) || !port->set_baud_rate(current_baud_rate))
+  {
+    return false;
+  }
+
+  set_baud_rate_response_handler handler;
+  auto reader = make_packet_reader(handler);
+  port->write(set_baud_rate_packet(baud_rate));
+  if (!reader.wait_for_packets(port, 1, std::chrono::steady_clock::now() + std::chrono::milliseconds(500)) || handler.baud_rate != baud_rate)
+  {
+    // Refused, and still at the current rate
+    return false;
+  }
+
+  port->set_baud_rate(baud_rate);
+  if (verify_link(port, firmware, reference))
+  {
+    return true;
+  }
+  LOG_INFO("Serial link unreliable at " << baud_rate << " baud. Falling back.");
+  recover(port, current_baud_rate, baud_rate);
+  return false;
+}
+
+unsigned negotiate_baud_rate(i_serial_device *port, const firmware_info &firmware, unsigned current_baud_rate, unsigned max_baud_rate)
+{
+  if (!firmware.has_feature(FirmwareFeature::BaudRateFeature))
+  {
+    return current_baud_rate;
+  }
+  link_reference reference = read_link_reference(port, firmware);
+  for (unsigned baud_rate: CandidateBaudRates)
+  {
+    if (baud_rate <= current_baud_rate || baud_rate > max_baud_rate || baud_rate > firmware.max_baud_rate)
+    {
+      continue;
+    }
+    if (try_baud_rate(port, firmware, reference, current_baud_rate, baud_rate))
+    {
+      return baud_rate;
+    }
+  }
+  return current_baud_rate;
+}
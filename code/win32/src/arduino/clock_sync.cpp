@@ -0,0 +1,124 @@
+#include "arduino/clock_sync.hpp"
+#include <algorithm>
+#include <cmath>
+
+clock_sync_estimator::clock_sync_estimator(size_t window)
+  : m_window(std::max<size_t>(1, window))
+{
+}
+
+void clock_sync_estimator::add_sample(uint32_t firmware_micros, std::chrono::steady_clock::time_point sent, std::chrono::steady_clock::time_point received)
+{
+  int64_t sent_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(sent.time_since_epoch()).count();
+  int64_t round_trip_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(received - sent).count();
+  if (round_trip_ns < 0)
+  {
+    return;
+  }
+
+  m_samples.push_back(sample{ unwrap(firmware_micros), sent_ns + round_trip_ns / 2, round_trip_ns });
+  if (m_samples.size() > m_window)
+  {
+    m_samples.pop_front();
+  }
+  fit();
+}
+
+std::chrono::steady_clock::time_point clock_sync_estimator::sensor_to_host(uint32_t firmware_micros) const
+{
+  double micros = double(int64_t(unwrap(firmware_micros) - m_firmware_origin_micros));
+  int64_t host_ns = m_host_origin_ns + std::llround(m_slope_ns_per_micro * micros);
+  return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(host_ns)));
+}
+
+// micros() wraps every 2^32 us (about 71 minutes). Timestamps are taken to be
+// the closest to the latest sample that they could be.
+uint64_t clock_sync_estimator::unwrap(uint32_t firmware_micros) const
+{
+  if (m_samples.empty())
+  {
+    return firmware_micros;
+  }
+  uint64_t latest = m_samples.back().firmware_micros;
+  return uint64_t(int64_t(latest) + int32_t(firmware_micros - uint32_t(latest)));
+}
+
+void clock_sync_estimator::fit()
+{
+  int64_t min_round_trip_ns = m_samples.front().round_trip_ns;
+  for (auto &s: m_samples)
+  {
+    min_round_trip_ns = std::min(min_round_trip_ns, s.round_trip_ns);
+  }
+  auto is_fitted = [&](const sample &s)
+  {
+    return s.round_trip_ns <= 2 * min_round_trip_ns;
+  };
+
+  // Relative to the latest sample, to keep the sums well within double
+  // precision
+  const sample &latest = m_samples.back();
+  double n = 0, sum_x = 0, sum_y = 0;
+  for (auto &s: m_samples)
+  {
+    if (is_fitted(s))
+    {
+      n++;
+      sum_x += double(int64_t(s.firmware_micros - latest.firmware_micros));
+      sum_y += double(s.host_ns - latest.host_ns);
+    }
+  }
+  double mean_x = sum_x / n;
+  double mean_y = sum_y / n;
+  double sxx = 0, sxy = 0;
+  for (auto &s: m_samples)
+  {
+    if (is_fitted(s))
+    {
+      double dx = double(int64_t(s.firmware_micros - latest.firmware_micros)) - mean_x;
+      double dy = double(s.host_ns - latest.host_ns) - mean_y;
+      sxx += dx * dx;
+      sxy += dx * dy;
+    }
+  }
+
+  // A single sample (or several at one firmware time) says nothing about
+  // drift
+  m_slope_ns_per_micro = sxx > 0 ? sxy / sxx : 1e3;
+  m_firmware_origin_micros = latest.firmware_micros;
+  m_host_origin_ns = latest.host_ns + std::llround(mean_y - m_slope_ns_per_micro * mean_x);
+
+  m_error_bound_ns = 0;
+  for (auto &s: m_samples)
+  {
+    if (is_fitted(s))
+    {
+      double x = double(int64_t(s.firmware_micros - m_firmware_origin_micros));
+      double residual_ns = double(s.host_ns - m_host_origin_ns) - m_slope_ns_per_micro * x;
+      m_error_bound_ns = std::max(m_error_bound_ns, std::abs(residual_ns) + 0.5 * s.round_trip_ns);
+    }
+  }
+}
+
+clock_synchronizer::clock_synchronizer(size_t window)
+  : m_estimator(window)
+{
+}
+
+void clock_synchronizer::tick(i_serial_device *port)
+{
+  auto now = std::chrono::steady_clock::now();
+  if (now < m_next_ping)
+  {
+    return;
+  }
+  port->write(clock_sync_ping_packet(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count())));
+  m_pings_sent++;
+  m_next_ping = now + (m_pings_sent < NumInitialPings ? InitialPingInterval : PingInterval);
+}
+
+void clock_synchronizer::on_packet(const clock_sync_response_packet &response)
+{
+  std::chrono::steady_clock::time_point sent(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(int64_t(response.host_time_ns))));
+  m_estimator.add_sample(response.firmware_micros, sent, std::chrono::steady_clock::now());
+}
@@ -0,0 +1,71 @@
+#include "arduino/handshake.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+  struct hello_response_handler
+  {
+    firmware_info *info;
+
+    void on_packet(const hello_response_packet &response)
+    {
+      info->responded = true;
+      info->protocol_version = response.protocol_version;
+      info->report_formats = response.report_formats;
+      info->features = response.features;
+      info->max_baud_rate = response.max_baud_rate;
+      info->firmware_build = std::string(response.firmware_build, strnlen(response.firmware_build, sizeof(response.firmware_build)));
+    }
+  };
+}
+
+firmware_info handshake(i_serial_device *port, std::chrono::milliseconds timeout)
+{
+  firmware_info info;
+  hello_response_handler handler{ &info };
+  auto reader = make_packet_reader(handler);
+
+  auto end_time = std::chrono::steady_clock::now() + timeout;
+  while (std::chrono::steady_clock::now() < end_time && port->is_connected())
+  {
+    port->write(hello_packet());
+    auto deadline = std::min(end_time, std::chrono::steady_clock::now() + HelloRetryInterval);
+    if (reader.wait_for_packets(port, 1, deadline))
+    {
+      return info;
+    }
+
+    // Anything received so far is from before the firmware was ready (or
+    // from a previous session) and may not start at a packet boundary
+    reader.reset();
+  }
+  return firmware_info();
+}
+
+void print_firmware_info(const firmware_info &info)
+{
+  printf("Firmware\n");
+  printf("--------\n");
+  if (!info.responded)
+  {
+    printf("No response to Hello (firmware predates handshake)\n\n");
+    return;
+  }
+  printf("Build                         = %s\n", info.firmware_build.c_str());
+  printf("Protocol version              = %d\n", info.protocol_version);
+  printf("Report formats                =");
+  for (int format = 1; format < 16; format++)
+  {
+    if (info.supports_report_format(format))
+    {
+      printf(" %d", format);
+    }
+  }
+  printf("\n");
+  printf("Features                      = 0x%08x\n", info.features);
+  printf("Maximum baud rate             = %u\n", info.max_baud_rate);
+  printf("\n");
+}
@@ -0,0 +1,186 @@
+#include "arduino/register_access.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "util/format.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace
+{
+  struct register_range
+  {
+    uint8_t bank;
+    uint8_t start;
+    size_t count;
+  };
+
+  struct peek_response_collector
+  {
+    std::map<uint16_t, uint8_t> values;
+
+    void on_packet(const peek_response_packet &response)
+    {
+      uint16_t key = (response.bank << 8) | response.address;
+      values.emplace(key, response.data);
+    }
+  };
+
+  // Matches responses to outstanding requests by sequence number, so that
+  // stale responses to an earlier call are not mistaken for new ones
+  struct block_response_collector
+  {
+    std::set<uint8_t> outstanding;
+    std::map<uint16_t, uint8_t> values;
+    size_t refused = 0;
+
+    bool on_packet(const peek_range_response_packet &response)
+    {
+      if (outstanding.erase(response.sequence) == 0)
+      {
+        return false;
+      }
+      refused += response.count == 0 ? 1 : 0;
+      for (size_t i = 0; i < response.count; i++)
+      {
+        uint16_t key = (response.bank << 8) | (response.start + i);
+        values[key] = response.data[i];
+      }
+      return true;
+    }
+
+    bool on_packet(const poke_block_response_packet &response)
+    {
+      if (outstanding.erase(response.sequence) == 0)
+      {
+        return false;
+      }
+      refused += response.count == 0 ? 1 : 0;
+      return true;
+    }
+  };
+}
+
+// Sequence numbers are 8 bits, so no more requests than this are left
+// outstanding at once
+static const constexpr size_t MaxOutstandingRequests = 128;
+
+static uint8_t s_next_sequence = 0;
+
+// Covers the registers with as few ranges as possible, joining registers of
+// the same bank that are separated by no more than MaxRegisterRangeGap others
+static std::vector<register_range> find_ranges(const std::vector<register_address> &registers)
+{
+  std::map<uint8_t, std::set<uint8_t>> addresses_by_bank;
+  for (auto &reg: registers)
+  {
+    addresses_by_bank[reg.bank].insert(reg.address);
+  }
+
+  std::vector<register_range> ranges;
+  for (auto &bank: addresses_by_bank)
+  {
+    for (uint8_t address: bank.second)
+    {
+      if (!ranges.empty())
+      {
+        register_range &last = ranges.back();
+        size_t joined_count = address - last.start + 1;
+        if (last.bank == bank.first && address - (last.start + last.count) <= MaxRegisterRangeGap && is_valid_register_range(last.start, joined_count))
+        {
+          last.count = joined_count;
+          continue;
+        }
+      }
+      if (!is_valid_register_range(address, 1))
+      {
+        throw std::runtime_error(util::format() << "Register 0x" << std::hex << unsigned(address) << " of bank 0x" << unsigned(bank.first) << " cannot be read with PeekRange");
+      }
+      ranges.push_back(register_range{ bank.first, address, 1 });
+    }
+  }
+  return ranges;
+}
+
+static std::map<uint16_t, uint8_t> read_ranges(i_serial_device *port, const std::vector<register_range> &ranges)
+{
+  block_response_collector collector;
+  auto reader = make_packet_reader(collector);
+  for (size_t first = 0; first < ranges.size(); first += MaxOutstandingRequests)
+  {
+    size_t last = std::min(ranges.size(), first + MaxOutstandingRequests);
+    for (size_t i = first; i < last; i++)
+    {
+      uint8_t sequence = s_next_sequence++;
+      collector.outstanding.insert(sequence);
+      port->write(peek_range_packet(sequence, ranges[i].bank, ranges[i].start, uint8_t(ranges[i].count)));
+    }
+    reader.wait_for_packets(port, last - first);
+  }
+  if (collector.refused > 0)
+  {
+    throw std::runtime_error(util::format() << "Firmware refused " << collector.refused << " register range read(s)");
+  }
+  return collector.values;
+}
+
+static std::map<uint16_t, uint8_t> read_individually(i_serial_device *port, const std::vector<register_address> &registers)
+{
+  // Responses are indexed with a key comprising bank and address
+  peek_response_collector collector;
+  auto reader = make_packet_reader(collector);
+  for (auto &reg: registers)
+  {
+    port->write(peek_packet(reg.bank, reg.address));
+  }
+  reader.wait_for_packets(port, registers.size());
+  return collector.values;
+}
+
+pixart::register_snapshot read_registers(i_serial_device *port, const std::vector<register_address> &registers, const firmware_info &firmware)
+{
+  std::map<uint16_t, uint8_t> values = firmware.has_feature(FirmwareFeature::RegisterBlockFeature) ? read_ranges(port, find_ranges(registers)) : read_individually(port, registers);
+
+  pixart::register_snapshot snapshot;
+  for (auto &reg: registers)
+  {
+    uint16_t key = (reg.bank << 8) | reg.address;
+    snapshot.push_back(pixart::register_value{ reg.bank, reg.address, values[key] });
+  }
+  return snapshot;
+}
+
+void write_registers(i_serial_device *port, uint8_t bank, uint8_t start, const uint8_t *data, size_t count, const firmware_info &firmware)
+{
+  if (!is_valid_register_range(start, count))
+  {
+    throw std::runtime_error(util::format() << "Invalid register block: bank 0x" << std::hex << unsigned(bank) << ", start 0x" << unsigned(start) << std::dec << ", count " << count);
+  }
+
+  if (!firmware.has_feature(FirmwareFeature::RegisterBlockFeature))
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      port->write(poke_packet(bank, uint8_t(start + i), data[i]));
+    }
+    return;
+  }
+
+  block_response_collector collector;
+  auto reader = make_packet_reader(collector);
+  size_t num_blocks = 0;
+  for (size_t offset = 0; offset < count; offset += poke_block_packet::MaxCount)
+  {
+    size_t block_count = std::min(count - offset, poke_block_packet::MaxCount);
+    uint8_t sequence = s_next_sequence++;
+    collector.outstanding.insert(sequence);
+    poke_block_packet poke(sequence, bank, uint8_t(start + offset), &data[offset], uint8_t(block_count));
+    port->write(reinterpret_cast<const uint8_t *>(&poke), uint32_t(poke.size()));
+    num_blocks++;
+  }
+  reader.wait_for_packets(port, num_blocks);
+  if (collector.refused > 0)
+  {
+    throw std::runtime_error(util::format() << "Firmware refused " << collector.refused << " register block write(s)");
+  }
+}
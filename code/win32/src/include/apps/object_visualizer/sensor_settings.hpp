@@ -2,11 +2,16 @@
 #ifndef INCLUDED_SENSOR_SETTINGS_HPP
 #define INCLUDED_SENSOR_SETTINGS_HPP
 
+#include "arduino/handshake.hpp"
 #include "pixart/settings.hpp"
 
 class i_serial_device;
 
-pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings);
-void write_sensor_settings(i_serial_device *port, const pixart::settings &settings);
+// Registers are accessed in blocks if the firmware supports it, and otherwise
+// one at a time, as with a replay of a v1 recording
+pixart::register_snapshot read_sensor_registers(i_serial_device *port, const firmware_info &firmware = firmware_info());
+pixart::settings decode_sensor_settings(const pixart::register_snapshot &registers, bool print_settings);
+pixart::settings read_sensor_settings(i_serial_device *port, bool print_settings, const firmware_info &firmware = firmware_info());
+void write_sensor_settings(i_serial_device *port, const pixart::settings &settings, const firmware_info &firmware = firmware_info());
 
 #endif  // INCLUDED_SENSOR_SETTINGS_HPP
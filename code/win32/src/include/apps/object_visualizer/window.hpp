@@ -16,6 +16,7 @@ public:
 
   virtual void init(const pixart::settings &settings) = 0;
   virtual void update(const std::array<PA_object, 16> &objs) = 0;
+  virtual int required_fields() const = 0;  // PA_object_fields used by update()
   virtual void blit() = 0;
   virtual SDL_Window *window() const = 0;
   virtual int width() const = 0;
@@ -40,6 +41,11 @@ public:
   {
   }
 
+  virtual int required_fields() const override
+  {
+    return PA_position_fields;
+  }
+
   void blit() override;
 
   SDL_Window *window() const override;
@@ -70,6 +76,11 @@ public:
   {
   }
 
+  virtual int required_fields() const override
+  {
+    return PA_position_fields;
+  }
+
   void blit() override;
 
   SDL_Window *window() const override;
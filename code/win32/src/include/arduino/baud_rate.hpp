@@ -0,0 +1,44 @@
+#pragma once
+#ifndef INCLUDED_BAUD_RATE_HPP
+#define INCLUDED_BAUD_RATE_HPP
+
+#include "arduino/handshake.hpp"
+#include "serial/i_serial_device.hpp"
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Raises the baud rate of the link after the handshake. The firmware always
+ * starts at the rate the port was opened at, which limits the frame rate of
+ * full reports, but the rates above it that actually work depend on the
+ * USB-UART bridge and cabling.
+ *
+ * Rates are tried from the highest allowed by the firmware, the host port,
+ * and the configured limit. After each switch, the link is checked with a few
+ * Hello round trips, each of which must return the firmware's original
+ * answer. With firmware that supports PeekRange, a burst of PeekRange round
+ * trips follows, several kilobytes from the firmware in all, as a link that
+ * is only marginal at a rate may well pass a few short packets. Each response
+ * must match a read made at the starting rate (apart from registers that
+ * changed between two such reads) and no byte may be out of place. If any
+ * check fails, the host returns to the previous rate and the firmware does
+ * the same on its own once BaudRateConfirmTimeoutMilliseconds passes without
+ * a Hello, and the next lower rate is tried.
+ *
+ * The rate is only chosen here, at connect time. Should the link degrade
+ * later, it is not stepped down; framing (see framed_serial_device) at least
+ * lets corrupted packets be dropped.
+ */
+
+static const constexpr unsigned CandidateBaudRates[] = { 2000000, 1500000, 1000000, 921600, 460800, 230400 };
+static const constexpr int BaudRateVerifyRoundTrips = 3;
+static const constexpr std::chrono::milliseconds BaudRateVerifyTimeout{ 150 };
+static const constexpr int BaudRateVerifyPeeks = 32;
+static const constexpr uint8_t BaudRateVerifyPeekBank = 0x0c;
+static const constexpr uint8_t BaudRateVerifyPeekCount = 0xef;   // up to the bank select register
+
+// Returns the baud rate in use afterwards. Throws if the firmware cannot be
+// reached at all after a failed switch.
+unsigned negotiate_baud_rate(i_serial_device *port, const firmware_info &firmware, unsigned current_baud_rate, unsigned max_baud_rate);
+
+#endif  // INCLUDED_BAUD_RATE_HPP
@@ -0,0 +1,119 @@
+#pragma once
+#ifndef INCLUDED_CLOCK_SYNC_HPP
+#define INCLUDED_CLOCK_SYNC_HPP
+
+#include "pa_driver/packets.hpp"
+#include "serial/i_serial_device.hpp"
+#include <chrono>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Maps firmware micros() timestamps (see report_timing) to the host's
+ * steady_clock. The host sends ClockSyncPing packets stamped with the time
+ * they were sent and the firmware answers each with its micros(). That
+ * moment is taken to be the midpoint of the round trip, which is off by no
+ * more than half the round trip time.
+ *
+ * clock_sync_estimator fits a line through the samples of the last few pings
+ * by least squares, giving both the offset of the firmware clock and its
+ * drift relative to the host's. Pings that took more than twice as long as
+ * the fastest in the window (held up behind reports, or by the host) are
+ * left out of the fit, as their midpoints are the least certain.
+ *
+ * clock_synchronizer sends the pings from within a receive loop, quickly at
+ * first so that an estimate is soon available, then at a steady interval,
+ * and passes the responses to an estimator.
+ */
+
+class clock_sync_estimator
+{
+public:
+  static const constexpr size_t DefaultWindow = 64;
+
+  clock_sync_estimator(size_t window = DefaultWindow);
+
+  // Adds a sample: the firmware's micros() in response to a ping sent and
+  // answered at the given host times
+  void add_sample(uint32_t firmware_micros, std::chrono::steady_clock::time_point sent, std::chrono::steady_clock::time_point received);
+
+  // True once there is a sample to estimate from. With only one, the clocks
+  // are assumed not to drift.
+  bool valid() const
+  {
+    return !m_samples.empty();
+  }
+
+  size_t num_samples() const
+  {
+    return m_samples.size();
+  }
+
+  // Host time of a firmware timestamp no more than about half an hour
+  // (half the wrap period of micros()) either side of the latest sample
+  std::chrono::steady_clock::time_point sensor_to_host(uint32_t firmware_micros) const;
+
+  // Bound on the error of sensor_to_host() within the span of the window:
+  // the largest deviation of a fitted sample from the fit plus half its
+  // round trip time. Extrapolating far beyond the window can add drift
+  // error on top.
+  std::chrono::nanoseconds error_bound() const
+  {
+    return std::chrono::nanoseconds(int64_t(m_error_bound_ns));
+  }
+
+  // How much faster the firmware clock runs than the host's, in parts per
+  // million
+  double drift_ppm() const
+  {
+    return (1e3 / m_slope_ns_per_micro - 1) * 1e6;
+  }
+
+private:
+  struct sample
+  {
+    uint64_t firmware_micros;   // unwrapped
+    int64_t host_ns;            // midpoint of the round trip
+    int64_t round_trip_ns;
+  };
+
+  const size_t m_window;
+  std::deque<sample> m_samples;
+
+  // Fit: host_ns = m_host_origin_ns + m_slope_ns_per_micro * (micros - m_firmware_origin_micros)
+  uint64_t m_firmware_origin_micros = 0;
+  int64_t m_host_origin_ns = 0;
+  double m_slope_ns_per_micro = 1e3;
+  double m_error_bound_ns = 0;
+
+  uint64_t unwrap(uint32_t firmware_micros) const;
+  void fit();
+};
+
+class clock_synchronizer
+{
+public:
+  static const constexpr size_t NumInitialPings = 8;
+  static const constexpr std::chrono::milliseconds InitialPingInterval{ 20 };
+  static const constexpr std::chrono::milliseconds PingInterval{ 250 };
+
+  clock_synchronizer(size_t window = clock_sync_estimator::DefaultWindow);
+
+  // Sends a ping if one is due. Call as often as packets are received.
+  void tick(i_serial_device *port);
+
+  void on_packet(const clock_sync_response_packet &response);
+
+  const clock_sync_estimator &estimator() const
+  {
+    return m_estimator;
+  }
+
+private:
+  clock_sync_estimator m_estimator;
+  size_t m_pings_sent = 0;
+  std::chrono::steady_clock::time_point m_next_ping;
+};
+
+#endif  // INCLUDED_CLOCK_SYNC_HPP
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef INCLUDED_HANDSHAKE_HPP
+#define INCLUDED_HANDSHAKE_HPP
+
+#include "pa_driver/packets.hpp"
+#include "serial/i_serial_device.hpp"
+#include <chrono>
+#include <string>
+
+/*
+ * Readiness check and capability exchange with the firmware. Opening the
+ * serial port resets the board, which then takes a while to boot. Rather than
+ * waiting a worst-case time, the host sends Hello packets at a short interval
+ * until one is answered.
+ *
+ * Firmware that predates the handshake never answers. Once the timeout has
+ * passed it is assumed to have booted and to support only what it always
+ * has: unframed packets, report format 1, and 115200 baud.
+ */
+
+struct firmware_info
+{
+  bool responded = false;               // false if the firmware predates Hello
+  uint16_t protocol_version = 0;
+  uint16_t report_formats = 1 << 1;     // bit n set if report format n is supported
+  uint32_t features = 0;                // FirmwareFeature flags
+  uint32_t max_baud_rate = 115200;
+  std::string firmware_build;
+
+  bool has_feature(FirmwareFeature feature) const
+  {
+    return (features & feature) != 0;
+  }
+
+  bool supports_report_format(int format) const
+  {
+    return format >= 0 && format < 16 && (report_formats & (1 << format)) != 0;
+  }
+};
+
+static const constexpr std::chrono::milliseconds HelloRetryInterval{ 50 };
+
+// Sends Hello until the firmware answers or the timeout passes. The port is
+// left at the end of the response, unframed.
+firmware_info handshake(i_serial_device *port, std::chrono::milliseconds timeout);
+
+void print_firmware_info(const firmware_info &info);
+
+#endif  // INCLUDED_HANDSHAKE_HPP
@@ -0,0 +1,151 @@
+#pragma once
+#ifndef INCLUDED_PACKET_DISPATCHER_HPP
+#define INCLUDED_PACKET_DISPATCHER_HPP
+
+#include "pa_driver/packets.hpp"
+#include "arduino/span_packet_reader.hpp"
+#include <type_traits>
+#include <utility>
+
+/*
+ * Dispatches packets to a handler object with an on_packet() overload for
+ * each packet type it is interested in, e.g.:
+ *
+ *  struct handler
+ *  {
+ *    bool on_packet(const peek_response_packet &response);
+ *    void on_packet(const object_report_packet &report);
+ *  };
+ *
+ * Overloads are resolved at compile time and inline into the parse loop of
+ * span_packet_reader. Packets are checked against the size of their struct
+ * before being handed over, or, for variable-length packets (those with a
+ * complete(size) member), against the size their own fields call for.
+ * Overloads returning bool indicate whether the packet was an expected one;
+ * void overloads are always expected. Packets without an overload are
+ * ignored and unexpected.
+ */
+
+namespace detail
+{
+  template <typename Handler, typename Packet, typename = void>
+  struct has_packet_handler: std::false_type
+  {
+  };
+
+  template <typename Handler, typename Packet>
+  struct has_packet_handler<Handler, Packet, std::void_t<decltype(std::declval<Handler &>().on_packet(std::declval<const Packet &>()))>>: std::true_type
+  {
+  };
+
+  template <typename Packet, typename = void>
+  struct is_variable_length: std::false_type
+  {
+  };
+
+  template <typename Packet>
+  struct is_variable_length<Packet, std::void_t<decltype(std::declval<const Packet &>().complete(size_t(0)))>>: std::true_type
+  {
+  };
+} // detail
+
+template <typename Handler>
+class packet_dispatcher
+{
+public:
+  packet_dispatcher(Handler &handler)
+    : m_handler(handler)
+  {
+  }
+
+  bool operator()(PacketID id, const uint8_t *data, size_t size)
+  {
+    switch (id)
+    {
+    default:                            return false;
+    case PacketID::Poke:                return dispatch<poke_packet>(data, size);
+    case PacketID::Peek:                return dispatch<peek_packet>(data, size);
+    case PacketID::PeekResponse:        return dispatch<peek_response_packet>(data, size);
+    case PacketID::ObjectReportRequest: return dispatch<object_report_request_packet>(data, size);
+    case PacketID::ObjectReport:        return dispatch<object_report_packet>(data, size);
+    case PacketID::SetFraming:          return dispatch<set_framing_packet>(data, size);
+    case PacketID::SetFramingResponse:  return dispatch<set_framing_response_packet>(data, size);
+    case PacketID::Hello:               return dispatch<hello_packet>(data, size);
+    case PacketID::HelloResponse:       return dispatch<hello_response_packet>(data, size);
+    case PacketID::Subscribe:           return dispatch<subscribe_packet>(data, size);
+    case PacketID::Unsubscribe:         return dispatch<unsubscribe_packet>(data, size);
+    case PacketID::SetReportEncoding:   return dispatch<set_report_encoding_packet>(data, size);
+    case PacketID::CompactObjectReport: return dispatch<compact_object_report_packet>(data, size);
+    case PacketID::SetReportFormat:     return dispatch<set_report_format_packet>(data, size);
+    case PacketID::SetBaudRate:         return dispatch<set_baud_rate_packet>(data, size);
+    case PacketID::SetBaudRateResponse: return dispatch<set_baud_rate_response_packet>(data, size);
+    case PacketID::PeekRange:           return dispatch<peek_range_packet>(data, size);
+    case PacketID::PeekRangeResponse:   return dispatch<peek_range_response_packet>(data, size);
+    case PacketID::PokeBlock:           return dispatch<poke_block_packet>(data, size);
+    case PacketID::PokeBlockResponse:   return dispatch<poke_block_response_packet>(data, size);
+    case PacketID::SetReportBatching:   return dispatch<set_report_batching_packet>(data, size);
+    case PacketID::ObjectReportBatch:   return dispatch<object_report_batch_packet>(data, size);
+    case PacketID::GrantReportCredits:  return dispatch<grant_report_credits_packet>(data, size);
+    case PacketID::ClockSyncPing:       return dispatch<clock_sync_ping_packet>(data, size);
+    case PacketID::ClockSyncResponse:   return dispatch<clock_sync_response_packet>(data, size);
+    }
+  }
+
+  // Packets that were shorter than their struct
+  uint64_t malformed_packets() const
+  {
+    return m_malformed_packets;
+  }
+
+private:
+  Handler &m_handler;
+  uint64_t m_malformed_packets = 0;
+
+  template <typename Packet>
+  bool dispatch(const uint8_t *data, size_t size)
+  {
+    if constexpr (detail::has_packet_handler<Handler, Packet>::value)
+    {
+      const Packet &packet = *reinterpret_cast<const Packet *>(data);
+      bool complete;
+      if constexpr (detail::is_variable_length<Packet>::value)
+      {
+        complete = packet.complete(size);
+      }
+      else
+      {
+        complete = size >= sizeof(Packet);
+      }
+      if (!complete)
+      {
+        m_malformed_packets++;
+        return false;
+      }
+
+      if constexpr (std::is_void_v<decltype(m_handler.on_packet(packet))>)
+      {
+        m_handler.on_packet(packet);
+        return true;
+      }
+      else
+      {
+        return m_handler.on_packet(packet);
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
+};
+
+template <typename Handler>
+using dispatching_packet_reader = span_packet_reader<packet_dispatcher<Handler>>;
+
+template <typename Handler>
+dispatching_packet_reader<Handler> make_packet_reader(Handler &handler)
+{
+  return dispatching_packet_reader<Handler>(packet_dispatcher<Handler>(handler));
+}
+
+#endif  // INCLUDED_PACKET_DISPATCHER_HPP
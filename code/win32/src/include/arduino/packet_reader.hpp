@@ -3,28 +3,46 @@
 #define INCLUDED_PACKET_READER_HPP
 
 #include "pa_driver/packets.hpp"
+#include "serial/i_serial_device.hpp"
+#include <cstring>
 #include <functional>
 #include <vector>
+#include <chrono>
 
 class packet_reader
 {
 public:
-  packet_reader(const std::function<size_t(uint8_t *, size_t)> &&read_fn, const std::function<bool(PacketID, const uint8_t *, size_t)> &&on_packet)
-    : m_read_fn(read_fn),
-      m_on_packet(on_packet)
+  enum class read_mode
+  {
+    blocking,   // sleep in the kernel until data arrives
+    busy_poll   // spin on non-blocking reads: lowest latency but occupies a core
+  };
+
+  packet_reader(i_serial_device *port, const std::function<bool(PacketID, const uint8_t *, size_t)> &&on_packet, read_mode mode = read_mode::blocking)
+    : m_port(port),
+      m_on_packet(on_packet),
+      m_mode(mode)
   {
   }
 
+  // Single non-blocking attempt
   void tick()
   {
-    try_get_packet();
+    try_get_packet(std::chrono::steady_clock::time_point::min());
+  }
+
+  // Waits until a complete packet has been received or the deadline passes.
+  // Returns true if the callback signaled that it was an expected packet.
+  bool tick(std::chrono::steady_clock::time_point deadline)
+  {
+    return try_get_packet(deadline);
   }
 
   void wait_for_packets(size_t count)
   {
-    while (count > 0)
+    while (count > 0 && m_port->is_connected())
     {
-      if (try_get_packet())
+      if (try_get_packet(std::chrono::steady_clock::now() + std::chrono::milliseconds(100)))
       {
         count--;
       }
@@ -32,37 +50,67 @@ public:
   }
 
 private:
-  std::function<size_t(uint8_t *, size_t)> m_read_fn;
+  i_serial_device *m_port;
   std::function<bool(PacketID, const uint8_t *, size_t)> m_on_packet;
+  read_mode m_mode;
   std::vector<uint8_t> m_buffer;
   const packet_header *m_header = nullptr;
   size_t m_idx = 0;
 
+  size_t read(uint8_t *buffer, size_t size, std::chrono::steady_clock::time_point deadline)
+  {
+    if (m_mode == read_mode::blocking)
+    {
+      return m_port->read(buffer, size, deadline);
+    }
+
+    size_t bytes_read;
+    do
+    {
+      bytes_read = m_port->read(buffer, size);
+    } while (bytes_read == 0 && std::chrono::steady_clock::now() < deadline);
+    return bytes_read;
+  }
+
+  // Reads until the given number of bytes have been appended to the buffer or
+  // the deadline passes. Returns true if all bytes were obtained.
+  bool fill_to(size_t size, std::chrono::steady_clock::time_point deadline)
+  {
+    resize_buffer_and_update_header_pointer(size);
+    do
+    {
+      m_idx += read(&m_buffer[m_idx], size - m_idx, deadline);
+    } while (m_idx < size && std::chrono::steady_clock::now() < deadline);
+    return m_idx >= size;
+  }
+
   // Returns true when complete packet has been received and callback signals
   // that it was the expected one
-  bool try_get_packet()
+  bool try_get_packet(std::chrono::steady_clock::time_point deadline)
   {
     // Read header
-    if (m_idx < sizeof(packet_header))
+    if (m_idx < sizeof(packet_header) && !fill_to(sizeof(packet_header), deadline))
     {
-      resize_buffer_and_update_header_pointer(sizeof(packet_header));
-      size_t bytes_required = sizeof(packet_header) - m_idx;
-      size_t bytes_received = m_read_fn(&m_buffer[m_idx], bytes_required);
-      m_idx += bytes_received;
-      if (bytes_received < bytes_required)
-      {
-        // Full header not yet obtained...
-        return false;
-      }
+      // Full header not yet obtained...
+      return false;
+    }
+
+    // Extended headers carry the size after the first 2 bytes
+    size_t header_size = packet_header_size(m_buffer.data());
+    if (m_idx < header_size && !fill_to(header_size, deadline))
+    {
+      return false;
     }
 
     // Read remainder of packet
-    size_t packet_size = m_header->size();
-    resize_buffer_and_update_header_pointer(packet_size);
-    size_t bytes_remaining = packet_size - m_idx;
-    size_t bytes_received = m_read_fn(&m_buffer[m_idx], bytes_remaining);
-    m_idx += bytes_received;
-    if (bytes_received < bytes_remaining)
+    size_t packet_size = ::packet_size(m_buffer.data());
+    if (packet_size == 0)
+    {
+      // Not a valid header. Skip a byte and try again.
+      memmove(m_buffer.data(), &m_buffer[1], --m_idx);
+      return false;
+    }
+    if (!fill_to(packet_size, deadline))
     {
       // Packet not yet obtained
       return false;
@@ -85,4 +133,4 @@ private:
   }
 };
 
-#endif  // INCLUDED_PACKET_READER_HPP
\ No newline at end of file
+#endif  // INCLUDED_PACKET_READER_HPP
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef INCLUDED_REGISTER_ACCESS_HPP
+#define INCLUDED_REGISTER_ACCESS_HPP
+
+#include "arduino/handshake.hpp"
+#include "pixart/settings.hpp"
+#include "serial/i_serial_device.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Bulk access to sensor registers. With firmware that supports PeekRange and
+ * PokeBlock (FirmwareFeature::RegisterBlockFeature), registers that lie close
+ * together in a bank are read with a single PeekRange and consecutive
+ * registers are written with a single PokeBlock, each served by the firmware
+ * with one SPI burst. All requests are sent before any response is awaited,
+ * so a whole configuration or diagnostics dump costs one round trip.
+ *
+ * Otherwise, registers are accessed one Peek or Poke at a time, which is also
+ * what v1 recordings contain.
+ */
+
+struct register_address
+{
+  uint8_t bank;
+  uint8_t address;
+};
+
+// Registers in between two that are wanted are read as well, rather than
+// starting a new range, if there are no more than this many of them
+static const constexpr size_t MaxRegisterRangeGap = 8;
+
+// Returns the values of the registers in the order given
+pixart::register_snapshot read_registers(i_serial_device *port, const std::vector<register_address> &registers, const firmware_info &firmware);
+
+// Writes count consecutive registers of a bank, starting at start, and waits
+// for the firmware to acknowledge them if it supports PokeBlock
+void write_registers(i_serial_device *port, uint8_t bank, uint8_t start, const uint8_t *data, size_t count, const firmware_info &firmware);
+
+#endif  // INCLUDED_REGISTER_ACCESS_HPP
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef INCLUDED_REPORT_CREDITS_HPP
+#define INCLUDED_REPORT_CREDITS_HPP
+
+#include "pa_driver/packets.hpp"
+#include "serial/i_serial_device.hpp"
+#include "arduino/sensor_frame.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Keeps the firmware supplied with report credits (see
+ * grant_report_credits_packet). The full count is granted up front, and the
+ * credits are topped up in chunks of half the count as reports arrive,
+ * rather than with a packet per frame.
+ *
+ * A report lost on the link never comes back as a credit. Framed reports that
+ * fail their CRC are dropped, and unframed ones may be misparsed. Once as
+ * many reports are lost as there are credits, the firmware would stop for
+ * good. So if no report has arrived for StallFramePeriods frame periods, the
+ * full count is granted again. By then a firmware that still had credits
+ * would have sent a report. The frame period is measured from the timing of
+ * the reports. Until it is known, DefaultStallTimeout is used.
+ */
+class report_credit_manager
+{
+public:
+  static const constexpr unsigned StallFramePeriods = 8;
+  static const constexpr std::chrono::milliseconds MinStallTimeout{ 20 };
+  static const constexpr std::chrono::milliseconds DefaultStallTimeout{ 250 };
+
+  report_credit_manager(uint16_t credits)
+    : m_credits(std::max<uint16_t>(1, credits))
+  {
+  }
+
+  // Grants the full count
+  void start(i_serial_device *port)
+  {
+    grant_all(port);
+  }
+
+  void on_report(i_serial_device *port, const sensor_frame &frame)
+  {
+    m_last_report = std::chrono::steady_clock::now();
+    measure_frame_period(frame);
+    if (++m_used >= std::max(1, m_credits / 2))
+    {
+      port->write(grant_report_credits_packet(m_used));
+      m_used = 0;
+      m_grants++;
+    }
+  }
+
+  // Grants the full count again if reports have stalled. Call after each
+  // receive, so that reports already waiting are not taken for a stall.
+  void tick(i_serial_device *port)
+  {
+    if (std::chrono::steady_clock::now() - m_last_report >= stall_timeout())
+    {
+      grant_all(port);
+      m_regrants++;
+    }
+  }
+
+  uint16_t credits() const
+  {
+    return m_credits;
+  }
+
+  // Grant packets sent, including those of start() and recoveries
+  uint64_t grants() const
+  {
+    return m_grants;
+  }
+
+  // Times the full count was granted again after a stall
+  uint64_t regrants() const
+  {
+    return m_regrants;
+  }
+
+  std::chrono::steady_clock::duration stall_timeout() const
+  {
+    if (m_frame_period_micros == 0)
+    {
+      return DefaultStallTimeout;
+    }
+    return std::max<std::chrono::steady_clock::duration>(MinStallTimeout, std::chrono::microseconds(uint64_t(StallFramePeriods) * m_frame_period_micros));
+  }
+
+private:
+  const uint16_t m_credits;
+  uint16_t m_used = 0;
+  uint64_t m_grants = 0;
+  uint64_t m_regrants = 0;
+  std::chrono::steady_clock::time_point m_last_report;
+
+  // Timing of the previous report, to measure the frame period from
+  bool m_have_timing = false;
+  uint32_t m_last_frame = 0;
+  uint32_t m_last_timestamp_micros = 0;
+  uint32_t m_frame_period_micros = 0;
+
+  // Credits not yet topped up are covered by the full count, so start
+  // counting again
+  void grant_all(i_serial_device *port)
+  {
+    port->write(grant_report_credits_packet(m_credits));
+    m_used = 0;
+    m_grants++;
+    m_last_report = std::chrono::steady_clock::now();
+  }
+
+  void measure_frame_period(const sensor_frame &frame)
+  {
+    if (!frame.has_timing)
+    {
+      return;
+    }
+    uint32_t frames = frame.frame - m_last_frame;
+    if (m_have_timing && frames > 0 && frames < 0x80000000)
+    {
+      m_frame_period_micros = (frame.timestamp_micros - m_last_timestamp_micros) / frames;
+    }
+    m_have_timing = true;
+    m_last_frame = frame.frame;
+    m_last_timestamp_micros = frame.timestamp_micros;
+  }
+};
+
+#endif  // INCLUDED_REPORT_CREDITS_HPP
@@ -0,0 +1,96 @@
+#pragma once
+#ifndef INCLUDED_SENSOR_FRAME_HPP
+#define INCLUDED_SENSOR_FRAME_HPP
+
+#include "pa_driver/packets.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include <array>
+#include <cstdint>
+
+/*
+ * An object report as decoded by the host, whichever packet carried it.
+ * Reports from firmware that predates report_timing carry only the 8-bit
+ * sequence number, in which case has_timing is false.
+ */
+struct sensor_frame
+{
+  std::array<PA_object, 16> objects;
+  uint8_t sequence = 0;
+  bool has_timing = false;
+  uint32_t timestamp_micros = 0;  // micros() on the firmware when the frame was read
+  uint32_t frame = 0;             // frame periods since the firmware started
+};
+
+namespace detail
+{
+  template <typename Report>
+  inline void decode_report(const Report &report, sensor_frame *frame)
+  {
+    report.load(frame->objects.data());
+    frame->sequence = report.sequence;
+    const report_timing *timing = report.timing();
+    frame->has_timing = timing != nullptr;
+    frame->timestamp_micros = timing ? timing->timestamp_micros : 0;
+    frame->frame = timing ? timing->frame : report.sequence;
+  }
+} // detail
+
+inline void decode_report(const object_report_packet &report, sensor_frame *frame)
+{
+  detail::decode_report(report, frame);
+}
+
+inline void decode_report(const compact_object_report_packet &report, sensor_frame *frame)
+{
+  detail::decode_report(report, frame);
+}
+
+/*
+ * Counts the frames skipped between successive reports of a stream, and
+ * reports of a frame already seen (duplicated, or out of order), from their
+ * frame counters. Legacy reports only have a sequence number, which cannot
+ * tell more than 255 skipped frames, or a repeat, from a gap.
+ */
+class frame_gap_counter
+{
+public:
+  void add(const sensor_frame &frame)
+  {
+    if (m_have_frame)
+    {
+      if (!frame.has_timing)
+      {
+        m_missed_frames += uint8_t(frame.sequence - uint8_t(m_next_frame));
+      }
+      else if (int32_t(frame.frame - m_next_frame) < 0)
+      {
+        m_repeated_frames++;
+        return;
+      }
+      else
+      {
+        m_missed_frames += frame.frame - m_next_frame;
+      }
+    }
+    m_have_frame = true;
+    m_next_frame = frame.frame + 1;
+  }
+
+  uint64_t missed_frames() const
+  {
+    return m_missed_frames;
+  }
+
+  uint64_t repeated_frames() const
+  {
+    return m_repeated_frames;
+  }
+
+private:
+  bool m_have_frame = false;
+  uint32_t m_next_frame = 0;
+  uint64_t m_missed_frames = 0;
+  uint64_t m_repeated_frames = 0;
+};
+
+#endif  // INCLUDED_SENSOR_FRAME_HPP
@@ -0,0 +1,232 @@
+#pragma once
+#ifndef INCLUDED_SPAN_PACKET_READER_HPP
+#define INCLUDED_SPAN_PACKET_READER_HPP
+
+#include "pa_driver/packets.hpp"
+#include "serial/i_serial_device.hpp"
+#include "util/span.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <cstring>
+
+/*
+ * Parses packets in place from contiguous spans of received bytes: a receive
+ * buffer, a region of a receive ring, or a mapped recording. Callbacks are
+ * handed pointers into the span itself. Only a packet that straddles two
+ * spans (e.g., one that wraps around the end of a ring) is copied, into a
+ * staging buffer large enough for an extended packet (see
+ * extended_packet_header).
+ *
+ * The callback is a template parameter so that it can be inlined into the
+ * parse loop. It has the signature:
+ *
+ *  bool callback(PacketID id, const uint8_t *packet, size_t size)
+ *
+ * and returns true if the packet was an expected one.
+ */
+
+template <typename Callback>
+class span_packet_reader
+{
+public:
+  static const constexpr size_t ReceiveBufferSize = 4096;
+
+  span_packet_reader(Callback callback)
+    : m_callback(callback)
+  {
+  }
+
+  // Parses all complete packets. Every byte is consumed: a trailing partial
+  // packet is staged and completed by the next call. Returns the number of
+  // packets for which the callback returned true.
+  size_t feed(const uint8_t *data, size_t size)
+  {
+    size_t num_expected = 0;
+
+    if (m_staged > 0)
+    {
+      size_t consumed = complete_staged_packet(data, size, &num_expected);
+      data += consumed;
+      size -= consumed;
+    }
+
+    while (size >= sizeof(packet_header) && size >= packet_header_size(data))
+    {
+      const packet_header *header = reinterpret_cast<const packet_header *>(data);
+      size_t bytes = packet_size(data);
+      if (bytes == 0)
+      {
+        // Not a valid header. Skip a byte and try again.
+        m_invalid_bytes++;
+        data++;
+        size--;
+        continue;
+      }
+      if (size < bytes)
+      {
+        break;
+      }
+      num_expected += m_callback(header->id, data, bytes) ? 1 : 0;
+      data += bytes;
+      size -= bytes;
+    }
+
+    if (size > 0)
+    {
+      memcpy(m_staging, data, size);
+      m_staged = size;
+    }
+
+    return num_expected;
+  }
+
+  size_t feed(util::span<const uint8_t> data)
+  {
+    return feed(data.data(), data.size());
+  }
+
+  // Reads whatever the device has received, waiting until the deadline for
+  // data to arrive, and parses it. Data is parsed directly from the device's
+  // own buffer when it exposes one. Returns the number of expected packets.
+  size_t receive(i_serial_device *port, std::chrono::steady_clock::time_point deadline)
+  {
+    util::span<const uint8_t> data;
+    if (port->read_span(&data, deadline))
+    {
+      size_t num_expected = feed(data);
+      port->consume(data.size());
+      m_bytes_received += data.size();
+      return num_expected;
+    }
+
+    if (!m_receive_buffer)
+    {
+      m_receive_buffer = std::make_unique<uint8_t[]>(ReceiveBufferSize);
+    }
+    uint32_t bytes_read = port->read(m_receive_buffer.get(), ReceiveBufferSize, deadline);
+    m_bytes_received += bytes_read;
+    return feed(m_receive_buffer.get(), bytes_read);
+  }
+
+  // Receives packets one at a time until the callback has accepted the given
+  // number or the deadline passes. Never reads past the end of the last
+  // packet, so that the device can be handed over to another reader (or
+  // wrapped in another device) afterwards. Returns true if all packets were
+  // received.
+  bool wait_for_packets(i_serial_device *port, size_t count, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+  {
+    const packet_header *header = reinterpret_cast<const packet_header *>(m_staging);
+    while (count > 0 && port->is_connected() && std::chrono::steady_clock::now() < deadline)
+    {
+      size_t bytes_required = staged_header_size();
+      if (m_staged >= bytes_required)
+      {
+        bytes_required = packet_size(m_staging);
+        if (bytes_required == 0)
+        {
+          m_invalid_bytes++;
+          memmove(m_staging, &m_staging[1], --m_staged);
+          continue;
+        }
+      }
+
+      auto read_deadline = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+      m_staged += port->read(&m_staging[m_staged], uint32_t(bytes_required - m_staged), read_deadline);
+      if (m_staged >= staged_header_size() && m_staged == packet_size(m_staging))
+      {
+        size_t bytes = m_staged;
+        m_staged = 0;
+        if (m_callback(header->id, m_staging, bytes))
+        {
+          count--;
+        }
+      }
+    }
+    return count == 0;
+  }
+
+  // Discards any partially received packet (e.g., after seeking a replay)
+  void reset()
+  {
+    m_staged = 0;
+  }
+
+  // Bytes taken in by receive(). A read may end partway through a packet, so
+  // this, rather than the packet count, tells whether more data was waiting.
+  uint64_t bytes_received() const
+  {
+    return m_bytes_received;
+  }
+
+  uint64_t invalid_bytes() const
+  {
+    return m_invalid_bytes;
+  }
+
+  const Callback &callback() const
+  {
+    return m_callback;
+  }
+
+private:
+  Callback m_callback;
+  uint8_t m_staging[MAX_EXTENDED_PACKET_SIZE];
+  size_t m_staged = 0;
+  uint64_t m_invalid_bytes = 0;
+  uint64_t m_bytes_received = 0;
+  std::unique_ptr<uint8_t[]> m_receive_buffer;
+
+  // Bytes of the staged packet needed to determine its size
+  size_t staged_header_size() const
+  {
+    return m_staged < sizeof(packet_header) ? sizeof(packet_header) : packet_header_size(m_staging);
+  }
+
+  // Tops up the staged packet from the start of a new span and dispatches it
+  // once complete. Returns the number of bytes consumed from the span.
+  size_t complete_staged_packet(const uint8_t *data, size_t size, size_t *num_expected)
+  {
+    size_t consumed = 0;
+    while (true)
+    {
+      size_t header_size = staged_header_size();
+      if (m_staged < header_size)
+      {
+        size_t count = std::min(header_size - m_staged, size - consumed);
+        memcpy(&m_staging[m_staged], &data[consumed], count);
+        m_staged += count;
+        consumed += count;
+        if (m_staged < header_size)
+        {
+          return consumed;
+        }
+
+        // The first 2 bytes may turn out to begin an extended header
+        continue;
+      }
+
+      const packet_header *header = reinterpret_cast<const packet_header *>(m_staging);
+      size_t bytes = packet_size(m_staging);
+      if (bytes == 0)
+      {
+        m_invalid_bytes++;
+        memmove(m_staging, &m_staging[1], --m_staged);
+        continue;
+      }
+
+      size_t count = std::min(bytes - m_staged, size - consumed);
+      memcpy(&m_staging[m_staged], &data[consumed], count);
+      m_staged += count;
+      consumed += count;
+      if (m_staged == bytes)
+      {
+        m_staged = 0;
+        *num_expected += m_callback(header->id, m_staging, bytes) ? 1 : 0;
+      }
+      return consumed;
+    }
+  }
+};
+
+#endif  // INCLUDED_SPAN_PACKET_READER_HPP
@@ -2,6 +2,9 @@
 #ifndef INCLUDED_PIXART_SETTINGS_HPP
 #define INCLUDED_PIXART_SETTINGS_HPP
 
+#include <cstdint>
+#include <vector>
+
 namespace pixart
 {
 
@@ -11,6 +14,16 @@ namespace pixart
     uint16_t resolution_y;
   };
 
+  struct register_value
+  {
+    uint8_t bank;
+    uint8_t address;
+    uint8_t value;
+  };
+
+  // Values of the sensor registers that settings are decoded from
+  typedef std::vector<register_value> register_snapshot;
+
 } // pixart
 
 #endif  // INCLUDED_PIXART_SETTINGS_HPP
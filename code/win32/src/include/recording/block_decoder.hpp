@@ -0,0 +1,40 @@
+#pragma once
+#ifndef INCLUDED_RECORDING_BLOCK_DECODER_HPP
+#define INCLUDED_RECORDING_BLOCK_DECODER_HPP
+
+#include "recording/recording_format.hpp"
+#include "recording/object_report_codec.hpp"
+#include "util/span.hpp"
+#include <vector>
+
+namespace recording
+{
+  /*
+   * Recovers the bytes of a block exactly as they were received, along with
+   * the times at which they were received. Raw payloads are returned in place
+   * and delta-encoded payloads are decoded into an internal buffer, which is
+   * valid until the next call.
+   */
+  class block_decoder
+  {
+  public:
+    util::span<const uint8_t> decode(const uint8_t *data, const block_info &block);
+
+    // Ranges of the most recently decoded block and when they were received,
+    // in order of position
+    const std::vector<timed_range> &times() const
+    {
+      return m_times;
+    }
+
+    // Time at which the byte preceding the given position was received
+    uint64_t timestamp_at(size_t end) const;
+
+  private:
+    object_report_decoder m_decoder;
+    std::vector<uint8_t> m_decoded;
+    std::vector<timed_range> m_times;
+  };
+} // recording
+
+#endif  // INCLUDED_RECORDING_BLOCK_DECODER_HPP
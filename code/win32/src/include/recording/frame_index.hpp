@@ -0,0 +1,104 @@
+#pragma once
+#ifndef INCLUDED_RECORDING_FRAME_INDEX_HPP
+#define INCLUDED_RECORDING_FRAME_INDEX_HPP
+
+#include "recording/recording_format.hpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Index of the frames (full or compact object report packets, and each
+ * report of a batch) in a recording, giving the block in which each one
+ * begins, its position within the block's payload as received (i.e., after
+ * decoding), and the time it was received. It allows replay to seek directly
+ * to any frame, or, within a batch, to the batch.
+ *
+ * Frames are counted exactly as span_packet_reader and packet_dispatcher
+ * would deliver them: invalid header bytes are skipped and reports shorter
+ * than their contents require are not frames.
+ *
+ * Times come from block (or, in delta-encoded blocks, packet) timestamps in
+ * v2 recordings. For v1 recordings they are synthesized from the sensor frame
+ * period if the recording contains the register peeks needed to determine it,
+ * and are otherwise all zero.
+ *
+ * The index is stored in a sidecar file next to the recording (.idx appended
+ * to its name) so that it only has to be built once. The sidecar records the
+ * size of the recording and a hash of its start and end, and is rebuilt if
+ * either no longer matches.
+ */
+
+namespace recording
+{
+#pragma pack(push, 1)
+
+  struct frame_index_entry
+  {
+    uint64_t block_offset;        // header of the block containing the packet start
+    uint64_t position;            // of the packet within the decoded block payload
+    uint64_t timestamp_ns;        // time the report was received
+
+    bool operator<(const frame_index_entry &other) const
+    {
+      return block_offset < other.block_offset || (block_offset == other.block_offset && position < other.position);
+    }
+  };
+
+#pragma pack(pop)
+
+  class frame_index
+  {
+  public:
+    // Scans a recording held in memory
+    static frame_index build(const uint8_t *data, size_t size, size_t first_block, const metadata &info);
+
+    // Loads the sidecar index of a recording if it is up to date, otherwise
+    // builds it and attempts to save it for next time
+    static frame_index load_or_build(const std::string &recording_file, const uint8_t *data, size_t size, size_t first_block, const metadata &info);
+
+    static std::string sidecar_filename(const std::string &recording_file);
+
+    // Returns false if the file is missing or does not match the recording,
+    // which is checked by size and by a hash of its first and last blocks
+    bool load(const std::string &filename, const uint8_t *data, size_t size);
+
+    void save(const std::string &filename) const;
+
+    size_t num_frames() const
+    {
+      return m_frames.size();
+    }
+
+    const frame_index_entry &operator[](size_t frame) const
+    {
+      return m_frames[frame];
+    }
+
+    // Sensor frame period, or 0 if unknown
+    uint64_t frame_period_ns() const
+    {
+      return m_frame_period_ns;
+    }
+
+    // True if frames carry timestamps, either recorded or synthesized
+    bool has_timing() const;
+
+    // Time from the first frame to the last
+    std::chrono::nanoseconds duration() const;
+
+    // First frame received at or after the given time since the first frame.
+    // Clamped to the last frame.
+    size_t frame_at_time(std::chrono::nanoseconds time) const;
+
+  private:
+    std::vector<frame_index_entry> m_frames;
+    uint64_t m_frame_period_ns = 0;
+    uint64_t m_recording_size = 0;
+    uint64_t m_content_hash = 0;
+  };
+} // recording
+
+#endif  // INCLUDED_RECORDING_FRAME_INDEX_HPP
@@ -0,0 +1,275 @@
+#pragma once
+#ifndef INCLUDED_RECORDING_OBJECT_COLUMNS_HPP
+#define INCLUDED_RECORDING_OBJECT_COLUMNS_HPP
+
+#include "pa_driver/packets.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include "util/mapped_file.hpp"
+#include "util/span.hpp"
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Columnar export of the objects decoded from a recording, for offline
+ * analysis. Each field is stored as one contiguous, aligned array so that
+ * the file can be memory-mapped and scanned directly.
+ *
+ * There is one row per object present in a frame (i.e., with a valid
+ * centroid), in frame order and then slot order. Frame columns give the time
+ * of each frame, in nanoseconds since the first, and the row of its first
+ * object, so the objects of frame f are the rows from frame_first_object[f]
+ * up to frame_first_object[f + 1].
+ *
+ * File layout (little endian):
+ *
+ *  Offset  Size  Description
+ *  ------  ----  -----------
+ *  0       4     Magic: "PXCL"
+ *  4       2     Version
+ *  6       2     Number of columns
+ *  8       8     Number of frames
+ *  16      8     Number of objects
+ *  24      ...   Column directory: { id, element size, offset, count } each
+ *  ...           Columns, each aligned to ColumnAlignment
+ */
+
+namespace recording
+{
+  enum class object_column: uint32_t
+  {
+    frame_timestamp_ns = 0,
+    frame_first_object,
+    frame,
+    timestamp_ns,
+    slot,
+    area,
+    cx,
+    cy,
+    average_brightness,
+    max_brightness,
+    range,
+    radius,
+    boundary_left,
+    boundary_right,
+    boundary_up,
+    boundary_down,
+    aspect_ratio,
+    vx,
+    vy,
+    NumColumns
+  };
+
+  namespace columns
+  {
+    static const constexpr uint8_t Magic[4] = { 'P', 'X', 'C', 'L' };
+    static const constexpr uint16_t Version = 1;
+    static const constexpr size_t ColumnAlignment = 64;
+
+#pragma pack(push, 1)
+
+    struct file_header
+    {
+      uint8_t magic[4];
+      uint16_t version;
+      uint16_t num_columns;
+      uint64_t num_frames;
+      uint64_t num_objects;
+    };
+
+    struct column_entry
+    {
+      object_column id;
+      uint32_t element_size;
+      uint64_t offset;
+      uint64_t count;
+    };
+
+#pragma pack(pop)
+
+    // Whether a decoded object is exported as a row
+    inline bool is_present(const PA_object &obj)
+    {
+      return obj.cx < 0xfff && obj.cy < 0xfff;
+    }
+
+    // Number of rows a decoded report contributes
+    size_t count_objects(const PA_object objs[16]);
+
+    // Size of the elements of a column
+    size_t element_size(object_column id);
+  } // columns
+
+  /*
+   * Writes a columnar file whose frame and object counts are known up front
+   * (e.g., from a first pass over the recording), so that columns can be
+   * streamed straight to their final place in the file without holding the
+   * export in memory.
+   */
+  class object_columns_writer
+  {
+  public:
+    object_columns_writer(const std::string &filename, uint64_t num_frames, uint64_t num_objects);
+
+    void append_frame(uint64_t timestamp_ns, const PA_object objs[16]);
+
+    // Writes out all buffered data. Throws if the counts given at
+    // construction were not met or the file could not be written.
+    void finish();
+
+  private:
+    static const constexpr size_t ColumnBufferSize = 64 * 1024;
+
+    struct column
+    {
+      columns::column_entry entry;
+      std::vector<uint8_t> pending;
+      uint64_t written = 0;
+    };
+
+    std::string m_filename;
+    std::ofstream m_fp;
+    std::vector<column> m_columns;
+    uint64_t m_num_frames;
+    uint64_t m_num_objects;
+    uint64_t m_frames = 0;
+    uint64_t m_objects = 0;
+
+    template <typename T>
+    void push(object_column id, T value);
+
+    void flush(column *col);
+  };
+
+  // Memory-mapped, read-only view of a columnar file
+  class object_columns
+  {
+  public:
+    object_columns(const std::string &filename);
+
+    size_t num_frames() const
+    {
+      return m_num_frames;
+    }
+
+    size_t num_objects() const
+    {
+      return m_num_objects;
+    }
+
+    // Per frame (frame_first_object has one extra, final entry)
+    util::span<const uint64_t> frame_timestamp_ns() const
+    {
+      return column<uint64_t>(object_column::frame_timestamp_ns);
+    }
+
+    util::span<const uint64_t> frame_first_object() const
+    {
+      return column<uint64_t>(object_column::frame_first_object);
+    }
+
+    // Per object
+    util::span<const uint32_t> frame() const
+    {
+      return column<uint32_t>(object_column::frame);
+    }
+
+    util::span<const uint64_t> timestamp_ns() const
+    {
+      return column<uint64_t>(object_column::timestamp_ns);
+    }
+
+    util::span<const uint8_t> slot() const
+    {
+      return column<uint8_t>(object_column::slot);
+    }
+
+    util::span<const uint16_t> area() const
+    {
+      return column<uint16_t>(object_column::area);
+    }
+
+    util::span<const uint16_t> cx() const
+    {
+      return column<uint16_t>(object_column::cx);
+    }
+
+    util::span<const uint16_t> cy() const
+    {
+      return column<uint16_t>(object_column::cy);
+    }
+
+    util::span<const uint8_t> average_brightness() const
+    {
+      return column<uint8_t>(object_column::average_brightness);
+    }
+
+    util::span<const uint8_t> max_brightness() const
+    {
+      return column<uint8_t>(object_column::max_brightness);
+    }
+
+    util::span<const uint8_t> range() const
+    {
+      return column<uint8_t>(object_column::range);
+    }
+
+    util::span<const uint8_t> radius() const
+    {
+      return column<uint8_t>(object_column::radius);
+    }
+
+    util::span<const uint8_t> boundary_left() const
+    {
+      return column<uint8_t>(object_column::boundary_left);
+    }
+
+    util::span<const uint8_t> boundary_right() const
+    {
+      return column<uint8_t>(object_column::boundary_right);
+    }
+
+    util::span<const uint8_t> boundary_up() const
+    {
+      return column<uint8_t>(object_column::boundary_up);
+    }
+
+    util::span<const uint8_t> boundary_down() const
+    {
+      return column<uint8_t>(object_column::boundary_down);
+    }
+
+    util::span<const uint8_t> aspect_ratio() const
+    {
+      return column<uint8_t>(object_column::aspect_ratio);
+    }
+
+    util::span<const uint8_t> vx() const
+    {
+      return column<uint8_t>(object_column::vx);
+    }
+
+    util::span<const uint8_t> vy() const
+    {
+      return column<uint8_t>(object_column::vy);
+    }
+
+  private:
+    std::unique_ptr<util::mapped_file> m_file;
+    size_t m_num_frames = 0;
+    size_t m_num_objects = 0;
+    util::span<const uint8_t> m_columns[size_t(object_column::NumColumns)];
+
+    template <typename T>
+    util::span<const T> column(object_column id) const
+    {
+      const util::span<const uint8_t> &data = m_columns[size_t(id)];
+      return util::span<const T>(reinterpret_cast<const T *>(data.data()), data.size() / sizeof(T));
+    }
+  };
+} // recording
+
+#endif  // INCLUDED_RECORDING_OBJECT_COLUMNS_HPP
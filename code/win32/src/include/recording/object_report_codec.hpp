@@ -0,0 +1,138 @@
+#pragma once
+#ifndef INCLUDED_RECORDING_OBJECT_REPORT_CODEC_HPP
+#define INCLUDED_RECORDING_OBJECT_REPORT_CODEC_HPP
+
+#include "pa_driver/packets.hpp"
+#include "recording/recording_format.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Compressed block encoding (block_encoding::delta) for recordings.
+ *
+ * The encoder re-frames received bytes into whole packets and writes each as
+ * a token stamped with the time its last byte was received. Blocks hold
+ * whole packets and can be decoded independently, which allows replay to
+ * seek into them.
+ *
+ * Object reports are coded field by field against the previous report in
+ * the block: a mask of the slots that changed, and for each one a mask of the
+ * PA_object fields that changed followed by their zigzag varint deltas.
+ * Unchanged slots and fields, which are the bulk of every report, are skipped
+ * entirely. Full reports are coded so in format 1, and compact reports, on
+ * their own or in a batch, in any format, with their occupancy mask. The
+ * firmware timestamp of reports with a report_timing is coded like the
+ * receive timestamp, and the frame counter as a delta, so a steady stream
+ * costs a byte for each. A report or batch is coded this way only if decoding
+ * and re-packing its objects reproduces its bytes exactly. Otherwise, and for
+ * all other packets, the packet is stored verbatim. Bytes that are not part
+ * of a packet are stored as literals.
+ *
+ * Token formats (timestamps are zigzag varint deltas of the interval between
+ * successive tokens, starting from the block timestamp):
+ *
+ *  Literal         0, varint size, bytes
+ *  Packet          1, timestamp, packet bytes (size given by packet header)
+ *  ObjectReport    2, timestamp, sequence byte, varint slot mask,
+ *                  { varint field mask, zigzag varint deltas } per slot
+ *  TimedObjectReport
+ *                  3, timestamp, sequence byte, zigzag varint delta of the
+ *                  firmware timestamp interval, zigzag varint frame delta,
+ *                  then as ObjectReport
+ *  CompactObjectReport
+ *                  4, timestamp, format byte, sequence byte, varint
+ *                  occupancy mask, then as ObjectReport from the slot mask,
+ *                  which covers only occupied slots, then the padding byte
+ *                  if the packet has one
+ *  TimedCompactObjectReport
+ *                  5, timestamp, format byte, sequence byte, timing as in
+ *                  TimedObjectReport, then as CompactObjectReport from the
+ *                  occupancy mask
+ *  ObjectReportBatch
+ *                  6, timestamp, format byte, entry count byte, then for each
+ *                  entry, timing as in TimedObjectReport, varint occupancy
+ *                  mask, and slots as in CompactObjectReport, then the
+ *                  padding byte if the packet has one
+ */
+
+namespace recording
+{
+  // Marks the end of a run of decoded bytes and the time they were received
+  struct timed_range
+  {
+    size_t end;
+    uint64_t timestamp_ns;
+  };
+
+  namespace detail
+  {
+    static const constexpr size_t NumSlots = 16;
+    static const constexpr size_t NumFields = 14;
+
+    // Decoded fields of every object slot of the previous report
+    struct report_state
+    {
+      int32_t fields[NumSlots][NumFields] = {};
+      uint64_t timestamp_ns = 0;
+      int64_t interval_ns = 0;
+      report_timing timing;
+      int64_t interval_micros = 0;
+    };
+  } // detail
+
+  class object_report_encoder
+  {
+  public:
+    // Appends serial data received at the given time
+    void append(const uint8_t *data, size_t size, uint64_t timestamp_ns);
+
+    // Complete packets waiting to be taken as a block
+    size_t num_packets() const
+    {
+      return m_num_packets;
+    }
+
+    // Timestamp of the first packet waiting to be taken
+    uint64_t block_timestamp_ns() const
+    {
+      return m_block_timestamp_ns;
+    }
+
+    // Takes everything encoded so far as a block payload and starts a new
+    // block. A packet that is still incomplete is carried over to the next
+    // block unless this is the final block. Returns false if there is
+    // nothing to take.
+    bool take_block(std::vector<uint8_t> *payload, uint64_t *timestamp_ns, bool final);
+
+  private:
+    detail::report_state m_state;
+    std::vector<uint8_t> m_block;
+    std::vector<uint8_t> m_literal;
+    uint8_t m_packet[MAX_EXTENDED_PACKET_SIZE];
+    size_t m_staged = 0;
+    size_t m_num_packets = 0;
+    uint64_t m_block_timestamp_ns = 0;
+
+    void encode_packet(const uint8_t *packet, size_t size, uint64_t timestamp_ns);
+    bool encode_report(const uint8_t *packet, size_t size, uint64_t timestamp_ns);
+    bool encode_object_report(const object_report_packet &report, bool timed);
+    bool encode_compact_report(const compact_object_report_packet &report, size_t size, bool timed);
+    bool encode_report_batch(const object_report_batch_packet &batch, size_t size);
+    void encode_objects(const int32_t fields[detail::NumSlots][detail::NumFields], uint16_t slots);
+    void encode_timestamp(uint64_t timestamp_ns);
+    void encode_timing(const report_timing &timing);
+    void flush_literal();
+  };
+
+  class object_report_decoder
+  {
+  public:
+    // Decodes an entire block payload, appending the original bytes to out
+    // and, for every packet, the time it was received to times. Throws if
+    // the payload is corrupt.
+    void decode(const uint8_t *data, size_t size, uint64_t block_timestamp_ns, std::vector<uint8_t> *out, std::vector<timed_range> *times);
+  };
+} // recording
+
+#endif  // INCLUDED_RECORDING_OBJECT_REPORT_CODEC_HPP
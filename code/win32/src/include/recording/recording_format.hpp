@@ -0,0 +1,106 @@
+#pragma once
+#ifndef INCLUDED_RECORDING_FORMAT_HPP
+#define INCLUDED_RECORDING_FORMAT_HPP
+
+#include "pixart/settings.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Recording file formats. All fields are little-endian.
+ *
+ * Version 1 has no header and is simply a sequence of blocks, each consisting
+ * of a 32-bit size followed by that many bytes of serial data.
+ *
+ * Version 2 begins with a file_header, followed by a snapshot of the sensor
+ * registers and then a sequence of blocks. Each block begins with a
+ * block_header giving its size, how its payload is encoded, and the host's
+ * monotonic clock at the time the data was received. Replay can obtain the
+ * sensor settings from the header rather than from recorded register peeks.
+ *
+ * The magic number read as a v1 block size would be a block of over 1 GB, so
+ * the two versions can be told apart by their first four bytes.
+ */
+
+namespace recording
+{
+  static const constexpr uint8_t Magic[4] = { 'P', 'X', 'R', 'C' };
+  static const constexpr uint16_t Version = 2;
+
+  enum class block_encoding: uint8_t
+  {
+    raw = 0,  // serial data exactly as received
+    delta = 1 // packets compressed by object_report_encoder
+  };
+
+#pragma pack(push, 1)
+
+  struct file_header
+  {
+    uint8_t magic[4];
+    uint16_t version;
+    uint16_t header_size;         // offset of first block, including register snapshot
+    uint16_t resolution_x;        // sensor scale resolution
+    uint16_t resolution_y;
+    double focal_length_x;        // camera intrinsics in pixels at scale resolution
+    double focal_length_y;
+    double principal_point_x;
+    double principal_point_y;
+    uint16_t num_registers;       // count of pixart::register_value that follow
+    uint16_t __reserved__;
+  };
+
+  struct block_header
+  {
+    uint32_t size;                // payload bytes following this header
+    block_encoding encoding;
+    uint8_t __reserved__[3];
+    uint64_t timestamp_ns;        // host monotonic clock when received
+  };
+
+#pragma pack(pop)
+
+  static_assert(sizeof(pixart::register_value) == 3, "pixart::register_value must be packed");
+
+  // Everything known about the sensor at the time of recording
+  struct metadata
+  {
+    uint16_t version = 1;
+    pixart::settings settings{};
+    double focal_length_x = 0;
+    double focal_length_y = 0;
+    double principal_point_x = 0;
+    double principal_point_y = 0;
+    pixart::register_snapshot registers;
+  };
+
+  // Fills in settings and intrinsics from a register snapshot
+  metadata make_metadata(const pixart::register_snapshot &registers, const pixart::settings &settings);
+
+  // Serializes a v2 file header and register snapshot
+  std::vector<uint8_t> encode_header(const metadata &info);
+
+  // Parses the header of a recording. Returns the offset of the first block,
+  // which is 0 for a v1 recording (in which case only the version is set).
+  // Throws if the header is truncated or of an unsupported version.
+  size_t decode_header(const uint8_t *data, size_t size, metadata *info);
+
+  // Size of the header preceding each block's payload
+  size_t block_header_size(uint16_t version);
+
+  struct block_info
+  {
+    size_t offset;                // of the block header
+    size_t payload_offset;
+    uint32_t size;
+    block_encoding encoding;
+    uint64_t timestamp_ns;        // 0 for v1
+  };
+
+  // Decodes the block header at the given offset. Throws if the header or
+  // payload would extend past the end of the recording.
+  block_info decode_block_header(const uint8_t *data, size_t size, size_t offset, uint16_t version);
+} // recording
+
+#endif  // INCLUDED_RECORDING_FORMAT_HPP
@@ -0,0 +1,121 @@
+#pragma once
+#ifndef INCLUDED_FAULT_INJECTING_DEVICE_HPP
+#define INCLUDED_FAULT_INJECTING_DEVICE_HPP
+
+#include "serial/i_serial_device.hpp"
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+#include <chrono>
+
+/*
+ * Wraps a serial device and degrades the link it provides, for testing and
+ * benchmarking packet parsing without real hardware. Received data can be
+ * fragmented into short reads, have bytes dropped or bits flipped, arrive
+ * late with jitter, and be limited to the bandwidth of a given baud rate.
+ *
+ * Faults are drawn from a random generator with a fixed seed, so a run over
+ * the same input is reproducible (except for timing, which depends on how
+ * the device is polled). Writes are passed through unaltered.
+ *
+ * Data are pulled from the wrapped device in chunks and held until they
+ * "arrive". Each chunk is delayed by the latency plus a uniformly distributed
+ * jitter, and its bytes then arrive one byte time apart when bandwidth is
+ * limited. Chunks never overtake each other.
+ */
+
+struct fault_profile
+{
+  uint32_t seed = 1;
+  uint32_t max_fragment = 0;                      // reads return 1..N bytes (0: unlimited)
+  double drop_probability = 0;                    // per byte
+  double bit_flip_probability = 0;                // per byte, flips one bit
+  std::chrono::microseconds latency{ 0 };
+  std::chrono::microseconds jitter{ 0 };          // added to latency, uniform in [0, jitter]
+  uint32_t bytes_per_second = 0;                  // 0: unlimited
+
+  // Bandwidth of a UART at the given baud rate with 8N1 framing
+  static uint32_t baud_to_bytes_per_second(uint32_t baud)
+  {
+    return baud / 10;
+  }
+};
+
+class fault_injecting_device: public i_serial_device
+{
+private:
+  static const constexpr size_t ChunkSize = 4096;
+  static const constexpr size_t MaxStagedBytes = 64 * 1024;
+
+  struct chunk
+  {
+    std::vector<uint8_t> data;
+    size_t pos;
+    std::chrono::steady_clock::time_point arrival;  // of the first byte
+  };
+
+  std::unique_ptr<i_serial_device> m_serial_device;
+  const fault_profile m_profile;
+  const std::chrono::steady_clock::duration m_byte_time;
+  std::mt19937_64 m_rng;
+  std::deque<chunk> m_chunks;
+  size_t m_staged_bytes = 0;
+  std::chrono::steady_clock::time_point m_last_arrival;
+  uint64_t m_next_drop = 0;           // bytes until the next drop or flip
+  uint64_t m_next_flip = 0;
+  std::deque<uint64_t> m_fault_offsets;   // staged but not yet delivered
+
+  // Statistics
+  uint64_t m_bytes_staged = 0;        // kept after drops, i.e., position in the delivered stream
+  uint64_t m_bytes_delivered = 0;
+  uint64_t m_bytes_dropped = 0;
+  uint64_t m_bits_flipped = 0;
+  uint64_t m_faults_delivered = 0;
+  uint64_t m_last_fault_offset = 0;
+
+  uint64_t draw_gap(double probability);
+  void stage(const uint8_t *data, size_t size);
+  void pull();
+  size_t arrived_bytes(const chunk &c, std::chrono::steady_clock::time_point now) const;
+  uint32_t deliver(uint8_t *buffer, uint32_t buf_size);
+
+public:
+  fault_injecting_device(std::unique_ptr<i_serial_device> serial_device, const fault_profile &profile);
+
+  uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
+  bool write(const uint8_t *buffer, uint32_t buf_size) override;
+  bool is_connected() const override;
+
+  uint64_t bytes_delivered() const
+  {
+    return m_bytes_delivered;
+  }
+
+  uint64_t bytes_dropped() const
+  {
+    return m_bytes_dropped;
+  }
+
+  uint64_t bits_flipped() const
+  {
+    return m_bits_flipped;
+  }
+
+  // Faults that have reached the reader, i.e., that are in or just before
+  // bytes already delivered
+  uint64_t faults_delivered() const
+  {
+    return m_faults_delivered;
+  }
+
+  // Position in the delivered stream of the most recently delivered fault:
+  // the byte that was corrupted, or the byte that followed a dropped one
+  uint64_t last_fault_offset() const
+  {
+    return m_last_fault_offset;
+  }
+};
+
+#endif  // INCLUDED_FAULT_INJECTING_DEVICE_HPP
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef INCLUDED_FRAMED_SERIAL_DEVICE_HPP
+#define INCLUDED_FRAMED_SERIAL_DEVICE_HPP
+
+#include "serial/i_serial_device.hpp"
+#include "pa_driver/framing.hpp"
+#include <memory>
+#include <vector>
+#include <chrono>
+
+/*
+ * Wraps a serial device carrying framed packets (see pa_driver/framing.hpp)
+ * and presents the bare packet stream, so that packet readers, recorders, and
+ * replays work the same with either protocol. Received frames that fail
+ * their CRC are dropped and the stream resumes at the next intact frame.
+ * Written packets are framed before being passed on.
+ */
+
+class framed_serial_device: public i_serial_device
+{
+private:
+  static const constexpr size_t ReadChunkSize = 4096;
+
+  std::unique_ptr<i_serial_device> m_serial_device;
+  frame_decoder m_decoder;
+  std::vector<uint8_t> m_packets;           // decoded but not yet read
+  size_t m_packets_pos = 0;
+  std::vector<uint8_t> m_write_staging;     // partial packet written
+  std::vector<uint8_t> m_frames;
+  uint8_t m_read_buffer[ReadChunkSize];
+
+  void decode(uint32_t size);
+  uint32_t deliver(uint8_t *buffer, uint32_t buf_size);
+
+public:
+  framed_serial_device(std::unique_ptr<i_serial_device> serial_device);
+
+  uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
+  bool write(const uint8_t *buffer, uint32_t buf_size) override;
+  bool is_connected() const override;
+
+  uint32_t crc_errors() const
+  {
+    return m_decoder.crc_errors();
+  }
+
+  uint32_t discarded_bytes() const
+  {
+    return m_decoder.discarded_bytes();
+  }
+};
+
+// Asks the firmware to switch to framed packets. Returns the device wrapped
+// in a framed_serial_device if it agrees, or unchanged if there is no answer
+// before the timeout, as with firmware that predates framing.
+std::unique_ptr<i_serial_device> negotiate_framing(std::unique_ptr<i_serial_device> serial_device, std::chrono::milliseconds timeout);
+
+#endif  // INCLUDED_FRAMED_SERIAL_DEVICE_HPP
@@ -2,7 +2,11 @@
 #ifndef INCLUDED_I_SERIAL_DEVICE_HPP
 #define INCLUDED_I_SERIAL_DEVICE_HPP
 
+#include "util/span.hpp"
 #include <cstdint>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
 class i_serial_device
 {
@@ -11,10 +15,50 @@ public:
   {
   }
 
+  // Non-blocking: returns 0 immediately if nothing has been received
   virtual uint32_t read(uint8_t *buffer, uint32_t buf_size) = 0;
   virtual bool write(const uint8_t *buffer, uint32_t buf_size) = 0;
   virtual bool is_connected() const = 0;
-  
+
+  // Blocks until at least one byte has been received or the deadline passes.
+  // Devices without a native wait primitive fall back to polling at a coarse
+  // interval, which is still far cheaper than spinning.
+  virtual uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+  {
+    while (true)
+    {
+      uint32_t bytes_read = read(buffer, buf_size);
+      auto now = std::chrono::steady_clock::now();
+      if (bytes_read > 0 || now >= deadline || !is_connected())
+      {
+        return bytes_read;
+      }
+      std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(1)));
+    }
+  }
+
+  // Zero-copy access for devices that hold received data in memory (a receive
+  // ring, a mapped recording). Waits until the deadline for data and returns
+  // the largest contiguous region received so far without consuming it.
+  // Release it with consume(). Returns false if the device does not support
+  // this, in which case read() must be used.
+  virtual bool read_span(util::span<const uint8_t> *data, std::chrono::steady_clock::time_point deadline)
+  {
+    return false;
+  }
+
+  virtual void consume(size_t size)
+  {
+  }
+
+  // Changes the baud rate of a physical port, once everything written has
+  // been sent. Anything received but not yet read is discarded. Returns false
+  // if the device has no baud rate or cannot use the requested one.
+  virtual bool set_baud_rate(unsigned baud_rate)
+  {
+    return false;
+  }
+
   template <typename T>
   bool write(const T &object)
   {
@@ -2,30 +2,54 @@
 #ifndef INCLUDED_SERIAL_PORT_HPP
 #define INCLUDED_SERIAL_PORT_HPP
 
-#define ARDUINO_WAIT_TIME 2000
 #define MAX_DATA_LENGTH 255
 
+#ifdef _WIN32
+#define DEFAULT_PORT_NAME "COM3"
+#else
+#define DEFAULT_PORT_NAME "/dev/ttyACM0"
+#endif
+
 #include "serial/i_serial_device.hpp"
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#include <chrono>
 #include <string>
 
+/*
+ * Serial port. The Win32 implementation is in serial_port.cpp and the Linux
+ * (termios + epoll) implementation is in serial_port_linux.cpp.
+ *
+ * Opening the port resets the Arduino. The constructor returns immediately;
+ * use handshake() (arduino/handshake.hpp) to wait until the firmware is
+ * ready.
+ */
+
 class serial_port: public i_serial_device
 {
 private:
-  static const constexpr DWORD ArduinoWaitTime = 2000;
   static const constexpr size_t MaxDataLength = 255;
 
+#ifdef _WIN32
   HANDLE m_handler;
-  bool m_connected;
   COMSTAT m_status;
   DWORD m_errors;
+  DWORD m_read_timeout = 0;
+#else
+  int m_fd = -1;
+  int m_epoll_fd = -1;
+#endif
+  bool m_connected;
 
 public:
   serial_port(const std::string &port_name, unsigned baud_rate = 9600);
   ~serial_port();
   uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
   bool write(const uint8_t *buffer, uint32_t buf_size) override;
   bool is_connected() const override;
+  bool set_baud_rate(unsigned baud_rate) override;
 };
 
 #endif  // INCLUDED_SERIAL_PORT_HPP
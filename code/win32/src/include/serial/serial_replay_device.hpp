@@ -3,32 +3,93 @@
 #define INCLUDED_SERIAL_REPLAY_DEVICE_HPP
 
 #include "serial/i_serial_device.hpp"
+#include "util/mapped_file.hpp"
+#include "util/async_file_writer.hpp"
+#include "recording/recording_format.hpp"
+#include "recording/frame_index.hpp"
+#include "recording/block_decoder.hpp"
+#include "recording/object_report_codec.hpp"
+#include <vector>
 #include <memory>
-#include <fstream>
+#include <chrono>
 
 /*
  * Records all traffic from a serial device to a file and supports replay.
  * Writes to the serial device are ignored.
+ *
+ * Recordings are written in the v2 format (see recording_format.hpp), with
+ * the sensor settings in the header and a receive timestamp on each block.
+ * Both v1 and v2 recordings can be replayed, and replay can seek to any
+ * frame using a frame index (see frame_index.hpp). By default, replayed data
+ * are returned as fast as they are read. Replay can instead be paced to the
+ * rate at which frames were recorded (or a multiple of it), and can loop.
+ *
+ * Recording appends blocks to a buffer that is written out on a background
+ * thread, so the disk never stalls the read path. Blocks are either stored
+ * as received or compressed with object_report_encoder, in which case a
+ * block is written every PacketsPerEncodedBlock packets or
+ * EncodedBlockDuration, whichever comes first.
+ *
+ * Replay memory-maps the recording rather than loading it, so playback starts
+ * immediately and pages that have been played back are released. Blocks are
+ * validated and decoded as they are reached.
  */
 
 class serial_replay_device: public i_serial_device
 {
 private:
+  static const constexpr size_t ReleaseGranularity = 16 * 1024 * 1024;
+  static const constexpr size_t PacketsPerEncodedBlock = 256;
+  static const constexpr std::chrono::milliseconds EncodedBlockDuration{ 1000 };
+
   std::unique_ptr<i_serial_device> m_serial_device;
   const std::string m_filename;
-  std::ofstream m_of;
-  std::unique_ptr<uint8_t[]> m_buffer;
+  recording::metadata m_metadata;
+
+  // Record
+  std::unique_ptr<util::async_file_writer> m_recorder;
+  recording::block_encoding m_encoding = recording::block_encoding::raw;
+  recording::object_report_encoder m_encoder;
+  std::vector<uint8_t> m_encoded;
+  uint64_t m_bytes_received = 0;
+
+  // Replay
+  std::unique_ptr<util::mapped_file> m_file;
+  const uint8_t *m_buffer = nullptr;
   size_t m_buffer_size = 0;
-  size_t m_read_idx = 0;
-  size_t m_next_block_idx = 0;
+  size_t m_first_block_idx = 0;
+  size_t m_block_idx = 0;                 // header of current block
+  size_t m_next_block_idx = 0;            // header of the block after it
+  size_t m_released_idx = 0;
+  recording::block_decoder m_decoder;
+  util::span<const uint8_t> m_block;      // payload of current block as received
+  size_t m_block_pos = 0;
+  uint64_t m_block_timestamp_ns = 0;
+  std::unique_ptr<recording::frame_index> m_index;
+
+  // Pacing
+  double m_speed = 0;
+  bool m_loop = false;
+  bool m_pacing_anchored = false;
+  size_t m_paced_frame = 0;
+  uint64_t m_pacing_origin_ns = 0;
+  std::chrono::steady_clock::time_point m_pacing_start;
 
   bool is_recording() const;
-  void sync_to_block_boundary();
-  uint32_t read_from_block(uint8_t *buffer, uint32_t buf_size);
+  bool at_end() const;
+  void enter_block(size_t block_idx);
+  size_t readable_bytes(std::chrono::steady_clock::time_point deadline);
+  size_t paced_end(std::chrono::steady_clock::time_point deadline);
+  uint32_t read_from_block(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline);
+  void advance(size_t num_bytes);
+  void rewind();
+  void record_block(const uint8_t *buffer, uint32_t num_bytes);
+  void write_block(recording::block_encoding encoding, uint64_t timestamp_ns, const uint8_t *payload, size_t size);
+  void write_encoded_block(bool final);
 
 public:
   // Record
-  serial_replay_device(const std::string &capture_file, std::unique_ptr<i_serial_device> serial_device);
+  serial_replay_device(const std::string &capture_file, std::unique_ptr<i_serial_device> serial_device, const recording::metadata &metadata, recording::block_encoding encoding = recording::block_encoding::raw, size_t buffer_size = util::async_file_writer::DefaultBufferSize, std::chrono::milliseconds flush_interval = util::async_file_writer::DefaultFlushInterval);
 
   // Replay
   serial_replay_device(const std::string &replay_file);
@@ -36,8 +97,45 @@ public:
   ~serial_replay_device();
 
   uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
+  bool read_span(util::span<const uint8_t> *data, std::chrono::steady_clock::time_point deadline) override;
+  void consume(size_t size) override;
   bool write(const uint8_t *buffer, uint32_t buf_size) override;
   bool is_connected() const override;
+
+  // Settings the recording was made with. Replays of v1 recordings have only
+  // the version set.
+  const recording::metadata &metadata() const;
+
+  // Host receive time of the block currently being replayed (0 for v1)
+  uint64_t block_timestamp_ns() const;
+
+  // Index of frames in the recording being replayed. It is loaded from the
+  // sidecar file, or built, on first use.
+  const recording::frame_index &frame_index();
+
+  // Positions replay at the start of a frame's object report packet. Readers
+  // must discard any partial packet they hold (span_packet_reader::reset()).
+  void seek_to_frame(size_t frame);
+
+  // Paces replay relative to the recorded frame times: 1 is real time, 2 is
+  // twice as fast, and so on. 0 (the default) replays as fast as possible.
+  // Frame times are taken from the frame index.
+  void set_speed(double speed);
+
+  // Restarts from the beginning at the end of the recording rather than
+  // disconnecting
+  void set_loop(bool loop);
+
+  // Number of the first frame whose packet has not yet been read from
+  size_t next_frame();
+
+  // Seeks to the first frame received at or after the given time since the
+  // start of the recording. Returns the frame number.
+  size_t seek_to_time(std::chrono::nanoseconds time);
+
+  // Recording statistics, or nullptr when replaying
+  const util::async_file_writer *recorder() const;
 };
 
 #endif  // INCLUDED_SERIAL_REPLAY_DEVICE_HPP
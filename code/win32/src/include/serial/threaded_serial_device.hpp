@@ -0,0 +1,52 @@
+#pragma once
+#ifndef INCLUDED_THREADED_SERIAL_DEVICE_HPP
+#define INCLUDED_THREADED_SERIAL_DEVICE_HPP
+
+#include "serial/i_serial_device.hpp"
+#include "util/spsc_ring.hpp"
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Owns a serial device and drains it continuously on a dedicated I/O thread
+ * into a lock-free ring, so that the device is serviced even while the
+ * consuming thread is blocked (e.g., in a vsync'd buffer swap). Reads are
+ * served from the ring. Writes are passed straight through to the device.
+ */
+
+class threaded_serial_device: public i_serial_device
+{
+private:
+  std::unique_ptr<i_serial_device> m_serial_device;
+  util::spsc_ring m_ring;
+  std::atomic<bool> m_stop{false};
+  std::atomic<bool> m_connected{true};
+  std::atomic<bool> m_consumer_waiting{false};
+  std::atomic<uint64_t> m_ring_full_stalls{0};
+  std::mutex m_mutex;
+  std::condition_variable m_data_available;
+  std::thread m_thread;
+
+  void io_thread();
+  void wait_for_data(std::chrono::steady_clock::time_point deadline);
+
+public:
+  threaded_serial_device(std::unique_ptr<i_serial_device> serial_device, size_t ring_size = 256 * 1024);
+  ~threaded_serial_device();
+
+  uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
+  bool read_span(util::span<const uint8_t> *data, std::chrono::steady_clock::time_point deadline) override;
+  void consume(size_t size) override;
+  bool write(const uint8_t *buffer, uint32_t buf_size) override;
+  bool is_connected() const override;
+
+  // Number of times the I/O thread found the ring full and had to wait for
+  // the consumer
+  uint64_t ring_full_stalls() const;
+};
+
+#endif  // INCLUDED_THREADED_SERIAL_DEVICE_HPP
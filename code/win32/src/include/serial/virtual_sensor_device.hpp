@@ -0,0 +1,216 @@
+#pragma once
+#ifndef INCLUDED_VIRTUAL_SENSOR_DEVICE_HPP
+#define INCLUDED_VIRTUAL_SENSOR_DEVICE_HPP
+
+#include "serial/i_serial_device.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "pa_driver/packets.hpp"
+#include "pa_driver/framing.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include <array>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <vector>
+#include <chrono>
+
+/*
+ * Simulates the Arduino and sensor, for load testing and measuring pose
+ * accuracy without hardware. Answers Peek, Poke, PeekRange, and PokeBlock
+ * packets from a register file and ObjectReportRequest packets the way the
+ * firmware does: the sensor produces a frame every frame period and a report
+ * of the first frame after a request is sent.
+ *
+ * Frames are generated by projecting a constellation of LEDs, moving along a
+ * scripted or random trajectory, with the same intrinsics the host uses (see
+ * pixart::camera_parameters and the resolution registers). Centroids can be
+ * perturbed with Gaussian noise and LEDs can randomly drop out. The pose of
+ * every reported frame is kept as ground truth.
+ *
+ * Poses follow the OpenCV camera convention (x right, y down, z forward) and
+ * map LED positions from constellation space to camera space. The
+ * constellation faces the camera at rest, with +y up.
+ *
+ * Hello, framing (pa_driver/framing.hpp), subscriptions, report credits,
+ * report formats, compact reports, report batches, and baud rate changes are
+ * handled as by the firmware. Baud rates only matter for whether the link
+ * works: while the two sides disagree, or the rate exceeds what the simulated
+ * link can carry, written bytes are lost and output is garbled.
+ *
+ * In real time mode, frames are produced at the rate given by the frame
+ * period registers and, while subscribed, every frame is reported, or while
+ * credits remain, one frame per credit. Otherwise, each request is answered
+ * immediately with the next frame, and a subscriber (or a host with credits)
+ * is sent the next frame whenever it has read everything, so reports are
+ * limited only by how fast the host can take them. Trajectory time always
+ * advances by one frame period per frame, and reports are timestamped with
+ * it (see report_timing). ClockSyncPing is answered with the time since the
+ * device was created, which in real time mode is on the same clock as the
+ * reports. Either can be made to drift from the host's clock.
+ */
+
+struct virtual_pose
+{
+  double rotation[3][3];
+  double translation[3];    // meters
+};
+
+struct virtual_keyframe
+{
+  double time;              // seconds
+  double position[3];       // meters, camera space
+  double euler_degrees[3];  // yaw (about y), pitch (about x), roll (about z)
+};
+
+struct virtual_sensor_config
+{
+  uint32_t seed = 1;
+  double frame_rate = 200;                  // Hz
+  bool real_time = true;
+  uint16_t resolution_x = 4095;
+  uint16_t resolution_y = 4095;
+
+  // LED positions in constellation space (meters). Defaults to the corners
+  // of the paddle target used by perspective_window.
+  std::vector<std::array<double, 3>> leds
+  {
+    {{ -0.04, 0.015, 0 }},
+    {{ 0.04, 0.015, 0 }},
+    {{ -0.04, -0.015, 0 }},
+    {{ 0.04, -0.015, 0 }}
+  };
+  double led_radius = 2.5e-3;               // meters
+
+  // Scripted trajectory, interpolated linearly and looped. If empty, the
+  // constellation wanders randomly about a point in front of the camera.
+  std::vector<virtual_keyframe> keyframes;
+  double distance = 0.4;                    // meters
+  double position_amplitude = 0.08;         // meters
+  double angle_amplitude = 30;              // degrees
+
+  double centroid_noise = 0;                // standard deviation, in resolution units
+  double dropout_probability = 0;           // per LED per frame
+
+  // How much faster the simulated micros() runs than the host's clock
+  double clock_drift_ppm = 0;
+
+  // Data written before the board has "booted" is lost, as on the real board
+  // after the port is opened
+  std::chrono::milliseconds boot_time{ 0 };
+
+  uint32_t initial_baud_rate = 115200;
+  uint32_t max_baud_rate = 1000000;         // advertised in Hello
+  uint32_t max_link_baud_rate = 0;          // rates above this garble the link; 0 for no limit
+};
+
+// Ground truth of a reported frame
+struct virtual_frame
+{
+  uint64_t frame;
+  double time;              // seconds since the first frame
+  virtual_pose pose;
+  size_t num_visible;       // LEDs reported
+};
+
+class virtual_sensor_device: public i_serial_device
+{
+private:
+  static const constexpr size_t MaxGroundTruth = 4096;
+  static const constexpr uint64_t MaxStreamBacklog = 1024;   // frames reported at once when a subscriber falls behind
+
+  struct host_packet_handler
+  {
+    virtual_sensor_device *device;
+
+    void on_packet(const poke_packet &poke);
+    void on_packet(const peek_packet &peek);
+    void on_packet(const peek_range_packet &peek);
+    void on_packet(const poke_block_packet &poke);
+    void on_packet(const object_report_request_packet &request);
+    void on_packet(const grant_report_credits_packet &grant);
+    void on_packet(const set_framing_packet &set_framing);
+    void on_packet(const hello_packet &hello);
+    void on_packet(const subscribe_packet &subscribe);
+    void on_packet(const unsubscribe_packet &unsubscribe);
+    void on_packet(const set_report_encoding_packet &set_encoding);
+    void on_packet(const set_report_format_packet &set_format);
+    void on_packet(const set_report_batching_packet &set_batching);
+    void on_packet(const set_baud_rate_packet &set_baud_rate);
+    void on_packet(const clock_sync_ping_packet &ping);
+  };
+
+  struct motion
+  {
+    double frequency;
+    double phase;
+  };
+
+  const virtual_sensor_config m_config;
+  std::mutex m_mutex;
+  std::condition_variable m_request_received;
+  std::mt19937_64 m_rng;
+  std::map<uint16_t, uint8_t> m_registers;
+  host_packet_handler m_handler;
+  dispatching_packet_reader<host_packet_handler> m_reader;
+  FramingMode m_framing = FramingMode::Unframed;
+  frame_decoder m_frame_decoder{ true };
+  std::vector<uint8_t> m_output;
+  size_t m_output_pos = 0;
+  uint16_t m_report_credits = 0;                      // reports to send as frames are produced
+  bool m_subscribed = false;
+  ReportEncoding m_report_encoding = ReportEncoding::FullReport;
+  uint8_t m_report_format = 1;
+  uint8_t m_report_batch_size = 0;
+  object_report_batch_packet m_report_batch;
+  uint32_t m_baud_rate;
+  uint32_t m_host_baud_rate;
+  uint32_t m_previous_baud_rate = 0;
+  bool m_baud_rate_unconfirmed = false;
+  std::chrono::steady_clock::time_point m_baud_rate_changed;
+  uint64_t m_frame = 0;                               // next frame to be produced
+  std::array<motion, 12> m_motion;                    // random trajectory, 2 per degree of freedom
+  std::deque<virtual_frame> m_ground_truth;
+
+  // Frame timing restarts from here whenever the frame period changes
+  uint64_t m_anchor_frame = 0;
+  double m_anchor_time = 0;
+  std::chrono::steady_clock::time_point m_anchor_clock;
+  std::chrono::steady_clock::time_point m_boot_complete;
+  std::chrono::steady_clock::time_point m_created;    // time 0 of the simulated micros()
+
+  uint16_t register_pair(uint8_t bank, uint8_t address) const;
+  double frame_period() const;
+  double frame_time(uint64_t frame) const;
+  uint32_t sensor_micros(double time) const;
+  std::chrono::steady_clock::time_point frame_clock(uint64_t frame) const;
+  void set_register(uint8_t bank, uint8_t address, uint8_t value);
+  void produce_frames(std::chrono::steady_clock::time_point now);
+  void send_report(uint64_t frame);
+  void send_report_batch();
+  size_t render(const virtual_pose &pose, int format, uint8_t *report_data);
+  bool link_ok() const;
+  void check_baud_rate(std::chrono::steady_clock::time_point now);
+  void send(const void *packet, size_t size);
+  void append_output(const uint8_t *data, size_t size);
+  uint32_t read_output(uint8_t *buffer, uint32_t buf_size);
+
+public:
+  virtual_sensor_device(const virtual_sensor_config &config = virtual_sensor_config());
+
+  uint32_t read(uint8_t *buffer, uint32_t buf_size) override;
+  uint32_t read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline) override;
+  bool write(const uint8_t *buffer, uint32_t buf_size) override;
+  bool is_connected() const override;
+  bool set_baud_rate(unsigned baud_rate) override;
+
+  // Ground truth of reported frames, in the order the reports were sent.
+  // Only the most recent MaxGroundTruth are kept.
+  bool pop_ground_truth(virtual_frame *frame);
+
+  // Pose along the trajectory at a given time
+  virtual_pose pose(double time) const;
+};
+
+#endif  // INCLUDED_VIRTUAL_SENSOR_DEVICE_HPP
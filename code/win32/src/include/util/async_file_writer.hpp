@@ -0,0 +1,94 @@
+#pragma once
+#ifndef INCLUDED_UTIL_ASYNC_FILE_WRITER_HPP
+#define INCLUDED_UTIL_ASYNC_FILE_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+namespace util
+{
+  /*
+   * Appends to a file from a background thread so that the producer never
+   * waits on the disk. Data is copied into one of two preallocated buffers.
+   * When the active buffer fills up, or when the flush interval has elapsed
+   * since it was last handed over, it is swapped with the other buffer and
+   * passed to the writer thread. The producer only blocks if the writer has
+   * not yet finished with the previous buffer; these stalls are counted.
+   *
+   * The flush interval is checked when appending, so data is not flushed
+   * while the producer is idle. Everything is written when the object is
+   * destroyed.
+   */
+  class async_file_writer
+  {
+  public:
+    static const constexpr size_t DefaultBufferSize = 4 * 1024 * 1024;
+    static const constexpr std::chrono::milliseconds DefaultFlushInterval{ 1000 };
+
+    async_file_writer(const std::string &filename, size_t buffer_size = DefaultBufferSize, std::chrono::milliseconds flush_interval = DefaultFlushInterval);
+    ~async_file_writer();
+
+    async_file_writer(const async_file_writer &) = delete;
+    async_file_writer &operator=(const async_file_writer &) = delete;
+
+    void append(const void *data, size_t size);
+
+    // Hands the active buffer to the writer thread now
+    void flush();
+
+    // Total bytes passed to append()
+    uint64_t bytes_queued() const
+    {
+      return m_bytes_queued;
+    }
+
+    // Total bytes written to the file
+    uint64_t bytes_written() const
+    {
+      return m_bytes_written;
+    }
+
+    // Largest number of bytes that were queued but not yet written
+    uint64_t high_water_mark() const
+    {
+      return m_high_water_mark;
+    }
+
+    // Number of times append() had to wait for the writer thread
+    uint64_t producer_stalls() const
+    {
+      return m_producer_stalls;
+    }
+
+  private:
+    const std::string m_filename;
+    const size_t m_buffer_size;
+    const std::chrono::milliseconds m_flush_interval;
+    std::ofstream m_of;
+    std::vector<uint8_t> m_active;                    // owned by the producer
+    std::vector<uint8_t> m_pending;                   // owned by the writer while m_have_pending
+    std::chrono::steady_clock::time_point m_last_flush;
+    std::atomic<uint64_t> m_bytes_queued{0};
+    std::atomic<uint64_t> m_bytes_written{0};
+    std::atomic<uint64_t> m_high_water_mark{0};
+    std::atomic<uint64_t> m_producer_stalls{0};
+    std::atomic<bool> m_write_failed{false};
+    bool m_have_pending = false;
+    bool m_stop = false;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+
+    void writer_thread();
+  };
+} // util
+
+#endif  // INCLUDED_UTIL_ASYNC_FILE_WRITER_HPP
@@ -106,6 +106,8 @@ namespace util
     std::shared_ptr<parameter_definition> integer(const std::string &name = "value");
     std::shared_ptr<parameter_definition> integer(int64_t lower, int64_t upper);
     std::shared_ptr<parameter_definition> integer(const std::string &name, int64_t lower, int64_t upper);
+    std::shared_ptr<parameter_definition> real(const std::string &name = "value");
+    std::shared_ptr<parameter_definition> real(const std::string &name, double lower, double upper);
 
     option_definition switch_option(
       const std::string &long_name,
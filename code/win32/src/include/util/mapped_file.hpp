@@ -0,0 +1,52 @@
+#pragma once
+#ifndef INCLUDED_UTIL_MAPPED_FILE_HPP
+#define INCLUDED_UTIL_MAPPED_FILE_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace util
+{
+  // Read-only memory mapping of an entire file
+  class mapped_file
+  {
+  public:
+    mapped_file(const std::string &filename);
+    ~mapped_file();
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    const uint8_t *data() const
+    {
+      return m_data;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    // Hints that the file will be read from start to end so that the OS reads
+    // ahead aggressively and drops pages behind
+    void advise_sequential();
+
+    // Drops the pages backing a range that has already been consumed from the
+    // process's resident set. They are faulted back in from the file if
+    // touched again.
+    void release(size_t offset, size_t size);
+
+  private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+  };
+} // util
+
+#endif  // INCLUDED_UTIL_MAPPED_FILE_HPP
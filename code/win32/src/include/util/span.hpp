@@ -0,0 +1,74 @@
+#pragma once
+#ifndef INCLUDED_UTIL_SPAN_HPP
+#define INCLUDED_UTIL_SPAN_HPP
+
+#include <cstddef>
+#include <algorithm>
+
+namespace util
+{
+  // Non-owning view of a contiguous array (stand-in for C++20 std::span)
+  template <typename T>
+  class span
+  {
+  public:
+    span()
+    {
+    }
+
+    span(T *data, size_t size)
+      : m_data(data),
+        m_size(size)
+    {
+    }
+
+    template <typename U>
+    span(const span<U> &other)
+      : m_data(other.data()),
+        m_size(other.size())
+    {
+    }
+
+    T *data() const
+    {
+      return m_data;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    bool empty() const
+    {
+      return m_size == 0;
+    }
+
+    T *begin() const
+    {
+      return m_data;
+    }
+
+    T *end() const
+    {
+      return m_data + m_size;
+    }
+
+    T &operator[](size_t idx) const
+    {
+      return m_data[idx];
+    }
+
+    span subspan(size_t offset, size_t count = size_t(-1)) const
+    {
+      offset = std::min(offset, m_size);
+      return span(m_data + offset, std::min(count, m_size - offset));
+    }
+
+  private:
+    T *m_data = nullptr;
+    size_t m_size = 0;
+  };
+} // util
+
+#endif  // INCLUDED_UTIL_SPAN_HPP
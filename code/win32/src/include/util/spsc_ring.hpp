@@ -0,0 +1,153 @@
+#pragma once
+#ifndef INCLUDED_UTIL_SPSC_RING_HPP
+#define INCLUDED_UTIL_SPSC_RING_HPP
+
+#include "util/span.hpp"
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace util
+{
+  /*
+   * Lock-free single-producer/single-consumer byte ring.
+   *
+   * Head and tail are free-running counters, each on its own cache line
+   * together with the owning side's cached copy of the other counter, so that
+   * neither side touches a line written by the other except to refresh its
+   * cached copy when the ring appears full (producer) or empty (consumer).
+   * Capacity must be a power of 2.
+   */
+  class spsc_ring
+  {
+  public:
+    static const constexpr size_t CacheLineSize = 64;
+
+    spsc_ring(size_t capacity)
+      : m_capacity(capacity),
+        m_mask(capacity - 1),
+        m_buffer(std::make_unique<uint8_t[]>(capacity))
+    {
+      if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+      {
+        throw std::invalid_argument("Ring buffer capacity must be a power of 2");
+      }
+    }
+
+    size_t capacity() const
+    {
+      return m_capacity;
+    }
+
+    // Approximate when called concurrently
+    size_t size() const
+    {
+      return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+      return size() == 0;
+    }
+
+    //
+    // Producer interface
+    //
+
+    // Largest contiguous free region. Fill it and then commit().
+    span<uint8_t> write_span()
+    {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      if (head - m_producer_cached_tail == m_capacity)
+      {
+        m_producer_cached_tail = m_tail.load(std::memory_order_acquire);
+      }
+      size_t free_bytes = m_capacity - (head - m_producer_cached_tail);
+      size_t offset = head & m_mask;
+      return span<uint8_t>(&m_buffer[offset], std::min(free_bytes, m_capacity - offset));
+    }
+
+    void commit(size_t size)
+    {
+      m_head.store(m_head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+
+    size_t write(const uint8_t *data, size_t size)
+    {
+      size_t total = 0;
+      while (total < size)
+      {
+        span<uint8_t> free_region = write_span();
+        if (free_region.empty())
+        {
+          break;
+        }
+        size_t count = std::min(free_region.size(), size - total);
+        memcpy(free_region.data(), data + total, count);
+        commit(count);
+        total += count;
+      }
+      return total;
+    }
+
+    //
+    // Consumer interface
+    //
+
+    // Largest contiguous readable region. Process it and then consume().
+    span<const uint8_t> read_span()
+    {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (m_consumer_cached_head == tail)
+      {
+        m_consumer_cached_head = m_head.load(std::memory_order_acquire);
+      }
+      size_t used_bytes = m_consumer_cached_head - tail;
+      size_t offset = tail & m_mask;
+      return span<const uint8_t>(&m_buffer[offset], std::min(used_bytes, m_capacity - offset));
+    }
+
+    void consume(size_t size)
+    {
+      m_tail.store(m_tail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+
+    size_t read(uint8_t *data, size_t size)
+    {
+      size_t total = 0;
+      while (total < size)
+      {
+        span<const uint8_t> used_region = read_span();
+        if (used_region.empty())
+        {
+          break;
+        }
+        size_t count = std::min(used_region.size(), size - total);
+        memcpy(data + total, used_region.data(), count);
+        consume(count);
+        total += count;
+      }
+      return total;
+    }
+
+  private:
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<uint8_t[]> m_buffer;
+
+    // Written by producer
+    alignas(CacheLineSize) std::atomic<size_t> m_head{0};
+    size_t m_producer_cached_tail = 0;
+
+    // Written by consumer
+    alignas(CacheLineSize) std::atomic<size_t> m_tail{0};
+    size_t m_consumer_cached_head = 0;
+
+    // Keep whatever follows the ring off the consumer's line
+    alignas(CacheLineSize) uint8_t m_padding[1] = {};
+  };
+} // util
+
+#endif  // INCLUDED_UTIL_SPSC_RING_HPP
@@ -0,0 +1,36 @@
+#include "recording/block_decoder.hpp"
+#include "util/format.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace recording
+{
+  util::span<const uint8_t> block_decoder::decode(const uint8_t *data, const block_info &block)
+  {
+    m_times.clear();
+    switch (block.encoding)
+    {
+    default:
+      throw std::runtime_error(util::format() << "Encountered block with unsupported encoding " << int(block.encoding));
+
+    case block_encoding::raw:
+      m_times.push_back(timed_range{ block.size, block.timestamp_ns });
+      return util::span<const uint8_t>(&data[block.payload_offset], block.size);
+
+    case block_encoding::delta:
+      m_decoded.clear();
+      m_decoder.decode(&data[block.payload_offset], block.size, block.timestamp_ns, &m_decoded, &m_times);
+      return util::span<const uint8_t>(m_decoded.data(), m_decoded.size());
+    }
+  }
+
+  uint64_t block_decoder::timestamp_at(size_t end) const
+  {
+    auto it = std::lower_bound(m_times.begin(), m_times.end(), end, [](const timed_range &range, size_t position) { return range.end < position; });
+    if (it == m_times.end())
+    {
+      return m_times.empty() ? 0 : m_times.back().timestamp_ns;
+    }
+    return it->timestamp_ns;
+  }
+} // recording
@@ -0,0 +1,331 @@
+#include "recording/frame_index.hpp"
+#include "recording/block_decoder.hpp"
+#include "pa_driver/packets.hpp"
+#include "util/format.hpp"
+#include "util/logging.hpp"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+namespace recording
+{
+  namespace
+  {
+    static const constexpr uint8_t IndexMagic[4] = { 'P', 'X', 'I', 'X' };
+    static const constexpr uint16_t IndexVersion = 3;
+
+    // Bytes hashed at each end of the recording to tie an index to it
+    static const constexpr size_t ContentSampleSize = 64 * 1024;
+
+#pragma pack(push, 1)
+
+    struct index_file_header
+    {
+      uint8_t magic[4];
+      uint16_t version;
+      uint16_t __reserved__;
+      uint64_t recording_size;
+      uint64_t content_hash;
+      uint64_t frame_period_ns;
+      uint64_t num_frames;
+    };
+
+#pragma pack(pop)
+
+    struct stream_position
+    {
+      uint64_t block_offset;
+      uint64_t position;
+    };
+
+    /*
+     * Reassembles packets from the payloads of successive blocks, tracking
+     * where each packet began. Framing matches span_packet_reader.
+     */
+    class packet_scanner
+    {
+    public:
+      // Callback receives the packet, where it began, and the position just
+      // past its end in the current payload
+      template <typename Callback>
+      void feed(util::span<const uint8_t> payload, uint64_t block_offset, Callback on_packet)
+      {
+        size_t i = 0;
+        while (i < payload.size())
+        {
+          if (m_have < header_size())
+          {
+            m_positions[m_have] = stream_position{ block_offset, i };
+            m_packet[m_have++] = payload[i++];
+            skip_invalid_header_bytes();
+          }
+          else
+          {
+            size_t count = std::min(packet_size(m_packet) - m_have, payload.size() - i);
+            memcpy(&m_packet[m_have], &payload[i], count);
+            m_have += count;
+            i += count;
+          }
+
+          const packet_header *header = reinterpret_cast<const packet_header *>(m_packet);
+          if (m_have >= header_size() && m_have == packet_size(m_packet))
+          {
+            on_packet(header->id, m_packet, m_have, m_positions[0], i);
+            m_have = 0;
+          }
+        }
+      }
+
+    private:
+      uint8_t m_packet[MAX_EXTENDED_PACKET_SIZE];
+      size_t m_have = 0;
+      stream_position m_positions[sizeof(extended_packet_header)]{};   // of each header byte
+
+      size_t header_size() const
+      {
+        return m_have < sizeof(packet_header) ? sizeof(packet_header) : packet_header_size(m_packet);
+      }
+
+      // Not a valid header. Skip a byte and try again, until the bytes held
+      // could still begin a packet.
+      void skip_invalid_header_bytes()
+      {
+        while (m_have >= header_size() && packet_size(m_packet) == 0)
+        {
+          m_have--;
+          memmove(m_packet, &m_packet[1], m_have);
+          std::copy(&m_positions[1], &m_positions[1 + m_have], m_positions);
+        }
+      }
+    };
+
+    /*
+     * FNV-1a hash of the start of the recording (the header and first blocks)
+     * and of its end (the last blocks). A recording that is re-recorded or
+     * edited in place keeps its name and possibly its size, but would not keep
+     * these.
+     */
+    static uint64_t content_hash(const uint8_t *data, size_t size)
+    {
+      uint64_t hash = 0xcbf29ce484222325ull;
+      auto add = [&](size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; i++)
+        {
+          hash = (hash ^ data[i]) * 0x100000001b3ull;
+        }
+      };
+      size_t head_end = std::min(size, ContentSampleSize);
+      add(0, head_end);
+      add(std::max(head_end, size - std::min(size, ContentSampleSize)), size);
+      return hash;
+    }
+
+    static uint64_t decode_frame_period_ns(const std::map<uint16_t, uint8_t> &values)
+    {
+      auto value = [&](uint16_t key) -> uint32_t
+      {
+        auto it = values.find(key);
+        return it == values.end() ? 0 : it->second;
+      };
+
+      // Frame period register is in units of 100 ns
+      uint32_t frame_period_reg = (value(0x0c09) << 16) | (value(0x0c08) << 8) | value(0x0c07);
+      return uint64_t(frame_period_reg) * 100;
+    }
+  }
+
+  // Every frame of a batch begins at the batch, so replay can only seek to
+  // its start. The batch was received when its last frame arrived, and the
+  // earlier frames are dated back from that by the firmware timestamps, but
+  // never before the previous frame.
+  static uint32_t timestamp_micros(const compact_object_report_packet &report)
+  {
+    const report_timing *timing = report.timing();
+    return timing ? timing->timestamp_micros : 0;
+  }
+
+  static void add_batch(std::vector<frame_index_entry> *frames, const object_report_batch_packet &batch, const stream_position &start, uint64_t received_ns)
+  {
+    uint32_t last_micros = 0;
+    batch.for_each([&](const compact_object_report_packet &report)
+    {
+      last_micros = timestamp_micros(report);
+    });
+    batch.for_each([&](const compact_object_report_packet &report)
+    {
+      uint64_t age_ns = uint64_t(uint32_t(last_micros - timestamp_micros(report))) * 1000;
+      uint64_t timestamp_ns = received_ns > age_ns ? received_ns - age_ns : 0;
+      if (!frames->empty())
+      {
+        timestamp_ns = std::max(timestamp_ns, frames->back().timestamp_ns);
+      }
+      frames->push_back(frame_index_entry{ start.block_offset, start.position, timestamp_ns });
+    });
+  }
+
+  frame_index frame_index::build(const uint8_t *data, size_t size, size_t first_block, const metadata &info)
+  {
+    frame_index index;
+    index.m_recording_size = size;
+    index.m_content_hash = content_hash(data, size);
+
+    std::map<uint16_t, uint8_t> registers;
+    for (auto &reg: info.registers)
+    {
+      registers[(reg.bank << 8) | reg.address] = reg.value;
+    }
+
+    packet_scanner scanner;
+    block_decoder decoder;
+    for (size_t offset = first_block; offset < size; )
+    {
+      block_info block = decode_block_header(data, size, offset, info.version);
+      scanner.feed(decoder.decode(data, block), block.offset, [&](PacketID id, const uint8_t *packet, size_t packet_size, const stream_position &start, size_t end)
+      {
+        bool is_report = id == PacketID::ObjectReport && reinterpret_cast<const object_report_packet *>(packet)->complete(packet_size);
+        bool is_compact_report = id == PacketID::CompactObjectReport && reinterpret_cast<const compact_object_report_packet *>(packet)->complete(packet_size);
+        bool is_batch = id == PacketID::ObjectReportBatch && reinterpret_cast<const object_report_batch_packet *>(packet)->complete(packet_size);
+        if (is_report || is_compact_report)
+        {
+          // Report was received when its last byte arrived
+          index.m_frames.push_back(frame_index_entry{ start.block_offset, start.position, decoder.timestamp_at(end) });
+        }
+        else if (is_batch)
+        {
+          add_batch(&index.m_frames, *reinterpret_cast<const object_report_batch_packet *>(packet), start, decoder.timestamp_at(end));
+        }
+        else if (id == PacketID::PeekResponse && packet_size >= sizeof(peek_response_packet) && info.version == 1)
+        {
+          // v1 recordings only contain settings in the form of peeked registers
+          const peek_response_packet *response = reinterpret_cast<const peek_response_packet *>(packet);
+          registers[(response->bank << 8) | response->address] = response->data;
+        }
+      });
+      offset = block.payload_offset + block.size;
+    }
+
+    index.m_frame_period_ns = decode_frame_period_ns(registers);
+    if (info.version == 1)
+    {
+      for (size_t i = 0; i < index.m_frames.size(); i++)
+      {
+        index.m_frames[i].timestamp_ns = i * index.m_frame_period_ns;
+      }
+    }
+
+    return index;
+  }
+
+  frame_index frame_index::load_or_build(const std::string &recording_file, const uint8_t *data, size_t size, size_t first_block, const metadata &info)
+  {
+    frame_index index;
+    std::string filename = sidecar_filename(recording_file);
+    if (index.load(filename, data, size))
+    {
+      return index;
+    }
+
+    index = build(data, size, first_block, info);
+    try
+    {
+      index.save(filename);
+    }
+    catch (const std::runtime_error &e)
+    {
+      // Index still works, it just has to be rebuilt next time
+      LOG_ERROR(e.what());
+    }
+    return index;
+  }
+
+  std::string frame_index::sidecar_filename(const std::string &recording_file)
+  {
+    return recording_file + ".idx";
+  }
+
+  bool frame_index::load(const std::string &filename, const uint8_t *data, size_t size)
+  {
+    std::ifstream fp(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!fp.is_open())
+    {
+      return false;
+    }
+
+    index_file_header header;
+    if (!fp.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        memcmp(header.magic, IndexMagic, sizeof(IndexMagic)) != 0 ||
+        header.version != IndexVersion ||
+        header.recording_size != size ||
+        header.content_hash != content_hash(data, size))
+    {
+      // Stale or foreign file
+      return false;
+    }
+
+    std::vector<frame_index_entry> frames(header.num_frames);
+    if (!fp.read(reinterpret_cast<char *>(frames.data()), frames.size() * sizeof(frame_index_entry)))
+    {
+      return false;
+    }
+
+    m_frames = std::move(frames);
+    m_frame_period_ns = header.frame_period_ns;
+    m_recording_size = size;
+    m_content_hash = header.content_hash;
+    return true;
+  }
+
+  void frame_index::save(const std::string &filename) const
+  {
+    std::ofstream fp(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!fp.is_open())
+    {
+      throw std::runtime_error(util::format() << "Failed to open '" << filename << "' for writing");
+    }
+
+    index_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+    header.version = IndexVersion;
+    header.recording_size = m_recording_size;
+    header.content_hash = m_content_hash;
+    header.frame_period_ns = m_frame_period_ns;
+    header.num_frames = m_frames.size();
+    fp.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    fp.write(reinterpret_cast<const char *>(m_frames.data()), m_frames.size() * sizeof(frame_index_entry));
+    if (!fp.good())
+    {
+      throw std::runtime_error(util::format() << "Failed to write '" << filename << "'");
+    }
+  }
+
+  bool frame_index::has_timing() const
+  {
+    return m_frames.size() > 1 && m_frames.back().timestamp_ns != m_frames.front().timestamp_ns;
+  }
+
+  std::chrono::nanoseconds frame_index::duration() const
+  {
+    if (m_frames.empty())
+    {
+      return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::nanoseconds(m_frames.back().timestamp_ns - m_frames.front().timestamp_ns);
+  }
+
+  size_t frame_index::frame_at_time(std::chrono::nanoseconds time) const
+  {
+    if (m_frames.empty())
+    {
+      return 0;
+    }
+
+    uint64_t timestamp_ns = m_frames.front().timestamp_ns + uint64_t(std::max<int64_t>(0, time.count()));
+    auto it = std::lower_bound(m_frames.begin(), m_frames.end(), timestamp_ns, [](const frame_index_entry &entry, uint64_t t) { return entry.timestamp_ns < t; });
+    size_t frame = it - m_frames.begin();
+    return std::min(frame, m_frames.size() - 1);
+  }
+} // recording
@@ -0,0 +1,254 @@
+#include "recording/object_columns.hpp"
+#include "util/format.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace recording
+{
+  namespace columns
+  {
+    size_t count_objects(const PA_object objs[16])
+    {
+      size_t count = 0;
+      for (int i = 0; i < 16; i++)
+      {
+        count += is_present(objs[i]) ? 1 : 0;
+      }
+      return count;
+    }
+
+    size_t element_size(object_column id)
+    {
+      switch (id)
+      {
+      case object_column::frame_timestamp_ns:
+      case object_column::frame_first_object:
+      case object_column::timestamp_ns:
+        return sizeof(uint64_t);
+      case object_column::frame:
+        return sizeof(uint32_t);
+      case object_column::area:
+      case object_column::cx:
+      case object_column::cy:
+        return sizeof(uint16_t);
+      default:
+        return sizeof(uint8_t);
+      }
+    }
+  } // columns
+
+  namespace
+  {
+    static uint64_t align(uint64_t offset)
+    {
+      return (offset + columns::ColumnAlignment - 1) & ~uint64_t(columns::ColumnAlignment - 1);
+    }
+
+    static uint64_t column_count(object_column id, uint64_t num_frames, uint64_t num_objects)
+    {
+      switch (id)
+      {
+      case object_column::frame_timestamp_ns:
+        return num_frames;
+      case object_column::frame_first_object:
+        return num_frames + 1;
+      default:
+        return num_objects;
+      }
+    }
+  }
+
+  object_columns_writer::object_columns_writer(const std::string &filename, uint64_t num_frames, uint64_t num_objects)
+    : m_filename(filename),
+      m_fp(filename.c_str(), std::ios::out | std::ios::binary),
+      m_num_frames(num_frames),
+      m_num_objects(num_objects)
+  {
+    if (!m_fp.is_open())
+    {
+      throw std::runtime_error(util::format() << "Failed to open '" << filename << "' for writing");
+    }
+
+    // Lay out the columns after the header and directory
+    const size_t num_columns = size_t(object_column::NumColumns);
+    uint64_t offset = align(sizeof(columns::file_header) + num_columns * sizeof(columns::column_entry));
+    m_columns.resize(num_columns);
+    for (size_t i = 0; i < num_columns; i++)
+    {
+      object_column id = object_column(i);
+      columns::column_entry &entry = m_columns[i].entry;
+      entry.id = id;
+      entry.element_size = uint32_t(columns::element_size(id));
+      entry.count = column_count(id, num_frames, num_objects);
+      entry.offset = offset;
+      offset = align(offset + entry.count * entry.element_size);
+    }
+
+    columns::file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, columns::Magic, sizeof(columns::Magic));
+    header.version = columns::Version;
+    header.num_columns = uint16_t(num_columns);
+    header.num_frames = num_frames;
+    header.num_objects = num_objects;
+    m_fp.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (auto &col: m_columns)
+    {
+      m_fp.write(reinterpret_cast<const char *>(&col.entry), sizeof(col.entry));
+    }
+  }
+
+  template <typename T>
+  void object_columns_writer::push(object_column id, T value)
+  {
+    column &col = m_columns[size_t(id)];
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    col.pending.insert(col.pending.end(), bytes, bytes + sizeof(T));
+    if (col.pending.size() >= ColumnBufferSize)
+    {
+      flush(&col);
+    }
+  }
+
+  void object_columns_writer::flush(column *col)
+  {
+    if (col->pending.empty())
+    {
+      return;
+    }
+    m_fp.seekp(col->entry.offset + col->written * col->entry.element_size);
+    m_fp.write(reinterpret_cast<const char *>(col->pending.data()), col->pending.size());
+    col->written += col->pending.size() / col->entry.element_size;
+    col->pending.clear();
+  }
+
+  void object_columns_writer::append_frame(uint64_t timestamp_ns, const PA_object objs[16])
+  {
+    size_t num_objects = columns::count_objects(objs);
+    if (m_frames >= m_num_frames || m_objects + num_objects > m_num_objects)
+    {
+      throw std::logic_error(util::format() << "More frames or objects exported to '" << m_filename << "' than were declared");
+    }
+
+    push(object_column::frame_timestamp_ns, timestamp_ns);
+    push(object_column::frame_first_object, m_objects);
+    for (int i = 0; i < 16; i++)
+    {
+      const PA_object &obj = objs[i];
+      if (!columns::is_present(obj))
+      {
+        continue;
+      }
+      push(object_column::frame, uint32_t(m_frames));
+      push(object_column::timestamp_ns, timestamp_ns);
+      push(object_column::slot, uint8_t(i));
+      push(object_column::area, obj.area);
+      push(object_column::cx, obj.cx);
+      push(object_column::cy, obj.cy);
+      push(object_column::average_brightness, obj.average_brightness);
+      push(object_column::max_brightness, obj.max_brightness);
+      push(object_column::range, obj.range);
+      push(object_column::radius, obj.radius);
+      push(object_column::boundary_left, obj.boundary_left);
+      push(object_column::boundary_right, obj.boundary_right);
+      push(object_column::boundary_up, obj.boundary_up);
+      push(object_column::boundary_down, obj.boundary_down);
+      push(object_column::aspect_ratio, obj.aspect_ratio);
+      push(object_column::vx, obj.vx);
+      push(object_column::vy, obj.vy);
+    }
+
+    m_frames++;
+    m_objects += num_objects;
+  }
+
+  void object_columns_writer::finish()
+  {
+    if (m_frames != m_num_frames || m_objects != m_num_objects)
+    {
+      throw std::logic_error(util::format() << "Exported " << m_frames << " frames and " << m_objects << " objects to '" << m_filename << "' but declared " << m_num_frames << " and " << m_num_objects);
+    }
+
+    // Closing entry of frame_first_object
+    push(object_column::frame_first_object, m_objects);
+    for (auto &col: m_columns)
+    {
+      flush(&col);
+    }
+
+    // Pad the file out to the end of the last column
+    const columns::column_entry &last = m_columns.back().entry;
+    uint64_t end = align(last.offset + last.count * last.element_size);
+    m_fp.seekp(0, std::ios::end);
+    uint64_t size = uint64_t(m_fp.tellp());
+    if (size < end)
+    {
+      std::vector<char> padding(end - size, 0);
+      m_fp.write(padding.data(), padding.size());
+    }
+
+    m_fp.close();
+    if (m_fp.fail())
+    {
+      throw std::runtime_error(util::format() << "Failed to write '" << m_filename << "'");
+    }
+  }
+
+  object_columns::object_columns(const std::string &filename)
+    : m_file(std::make_unique<util::mapped_file>(filename))
+  {
+    const uint8_t *data = m_file->data();
+    size_t size = m_file->size();
+
+    columns::file_header header;
+    if (size < sizeof(header))
+    {
+      throw std::runtime_error(util::format() << "'" << filename << "' is not a columnar export");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, columns::Magic, sizeof(columns::Magic)) != 0)
+    {
+      throw std::runtime_error(util::format() << "'" << filename << "' is not a columnar export");
+    }
+    if (header.version != columns::Version)
+    {
+      throw std::runtime_error(util::format() << "'" << filename << "' has unsupported columnar format version " << header.version);
+    }
+    if (size < sizeof(header) + header.num_columns * sizeof(columns::column_entry))
+    {
+      throw std::runtime_error(util::format() << "Column directory of '" << filename << "' is truncated");
+    }
+
+    m_num_frames = header.num_frames;
+    m_num_objects = header.num_objects;
+
+    for (size_t i = 0; i < header.num_columns; i++)
+    {
+      columns::column_entry entry;
+      memcpy(&entry, &data[sizeof(header) + i * sizeof(entry)], sizeof(entry));
+      if (size_t(entry.id) >= size_t(object_column::NumColumns))
+      {
+        // Added by a later version
+        continue;
+      }
+
+      if (entry.element_size != columns::element_size(entry.id) ||
+          entry.count != column_count(entry.id, m_num_frames, m_num_objects) ||
+          entry.offset % columns::ColumnAlignment != 0 ||
+          entry.offset > size ||
+          entry.count * entry.element_size > size - entry.offset)
+      {
+        throw std::runtime_error(util::format() << "Column " << uint32_t(entry.id) << " of '" << filename << "' is corrupt");
+      }
+      m_columns[size_t(entry.id)] = util::span<const uint8_t>(&data[entry.offset], entry.count * entry.element_size);
+    }
+
+    for (size_t i = 0; i < size_t(object_column::NumColumns); i++)
+    {
+      if (m_columns[i].data() == nullptr)
+      {
+        throw std::runtime_error(util::format() << "'" << filename << "' is missing column " << i);
+      }
+    }
+  }
+} // recording
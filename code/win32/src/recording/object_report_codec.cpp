@@ -0,0 +1,667 @@
+#include "recording/object_report_codec.hpp"
+#include "pa_driver/pixart_object.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace recording
+{
+  namespace
+  {
+    enum token: uint8_t
+    {
+      Literal = 0,
+      Packet,
+      ObjectReport,
+      TimedObjectReport,
+      CompactObjectReport,
+      TimedCompactObjectReport,
+      ObjectReportBatch
+    };
+
+    static const constexpr size_t ObjectStride = 16;
+    static const constexpr size_t ObjectDataSize = detail::NumSlots * ObjectStride;
+    static const constexpr size_t FormatOffset = sizeof(packet_header) + ObjectDataSize;
+
+    static const constexpr size_t TimingOffset = FormatOffset + 2;
+
+    static_assert(object_report_packet::LegacySize == TimingOffset, "Unexpected object_report_packet layout");
+    static_assert(sizeof(object_report_packet) == TimingOffset + sizeof(report_timing), "Unexpected object_report_packet layout");
+
+    static void to_fields(const PA_object &obj, int32_t *fields)
+    {
+      fields[0] = obj.area;
+      fields[1] = obj.cx;
+      fields[2] = obj.cy;
+      fields[3] = obj.average_brightness;
+      fields[4] = obj.max_brightness;
+      fields[5] = obj.range;
+      fields[6] = obj.radius;
+      fields[7] = obj.boundary_left;
+      fields[8] = obj.boundary_right;
+      fields[9] = obj.boundary_up;
+      fields[10] = obj.boundary_down;
+      fields[11] = obj.aspect_ratio;
+      fields[12] = obj.vx;
+      fields[13] = obj.vy;
+    }
+
+    static void from_fields(const int32_t *fields, PA_object *obj)
+    {
+      obj->area = uint16_t(fields[0]);
+      obj->cx = uint16_t(fields[1]);
+      obj->cy = uint16_t(fields[2]);
+      obj->average_brightness = uint8_t(fields[3]);
+      obj->max_brightness = uint8_t(fields[4]);
+      obj->range = uint8_t(fields[5]);
+      obj->radius = uint8_t(fields[6]);
+      obj->boundary_left = uint8_t(fields[7]);
+      obj->boundary_right = uint8_t(fields[8]);
+      obj->boundary_up = uint8_t(fields[9]);
+      obj->boundary_down = uint8_t(fields[10]);
+      obj->aspect_ratio = uint8_t(fields[11]);
+      obj->vx = uint8_t(fields[12]);
+      obj->vy = uint8_t(fields[13]);
+    }
+
+    // Decodes an object, provided that re-packing it reproduces its bytes
+    static bool to_exact_fields(const uint8_t *data, int format, int32_t *fields)
+    {
+      PA_object obj(data, format);
+      uint8_t repacked[ObjectStride];
+      obj.store(repacked, format);
+      if (memcmp(data, repacked, PA_object_size(format)) != 0)
+      {
+        return false;
+      }
+      to_fields(obj, fields);
+      return true;
+    }
+
+    // Decodes the objects of the occupied slots, packed as in
+    // compact_object_report_packet
+    static bool to_exact_fields(const uint8_t *objects, int format, uint16_t occupied, int32_t fields[detail::NumSlots][detail::NumFields])
+    {
+      for (size_t slot = 0; slot < detail::NumSlots; slot++)
+      {
+        if (occupied & (1 << slot))
+        {
+          if (!to_exact_fields(objects, format, fields[slot]))
+          {
+            return false;
+          }
+          objects += PA_object_size(format);
+        }
+      }
+      return true;
+    }
+
+    // Packs the objects of the occupied slots and returns their size
+    static size_t from_fields(const int32_t fields[detail::NumSlots][detail::NumFields], int format, uint16_t occupied, uint8_t *objects)
+    {
+      uint8_t *out = objects;
+      for (size_t slot = 0; slot < detail::NumSlots; slot++)
+      {
+        if (occupied & (1 << slot))
+        {
+          PA_object obj;
+          from_fields(fields[slot], &obj);
+          obj.store(out, format);
+          out += PA_object_size(format);
+        }
+      }
+      return out - objects;
+    }
+
+    // Size of a compact report up to any padding byte
+    static size_t unpadded_size(const compact_object_report_packet &report, bool timed)
+    {
+      return compact_object_report_packet::HeaderSize + report.objects_size() + (timed ? sizeof(report_timing) : 0);
+    }
+
+    static uint64_t zigzag(int64_t value)
+    {
+      return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t value)
+    {
+      return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    static void put_varint(std::vector<uint8_t> *out, uint64_t value)
+    {
+      while (value >= 0x80)
+      {
+        out->push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+      }
+      out->push_back(uint8_t(value));
+    }
+
+    // Bounds-checked reader over an encoded block
+    class token_reader
+    {
+    public:
+      token_reader(const uint8_t *data, size_t size)
+        : m_data(data),
+          m_size(size)
+      {
+      }
+
+      bool done() const
+      {
+        return m_idx >= m_size;
+      }
+
+      const uint8_t *bytes(size_t count)
+      {
+        if (count > m_size - m_idx)
+        {
+          throw std::runtime_error("Delta-encoded block is truncated");
+        }
+        const uint8_t *ptr = &m_data[m_idx];
+        m_idx += count;
+        return ptr;
+      }
+
+      uint8_t byte()
+      {
+        return *bytes(1);
+      }
+
+      uint64_t varint()
+      {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+          uint8_t b = byte();
+          value |= uint64_t(b & 0x7f) << shift;
+          if ((b & 0x80) == 0)
+          {
+            return value;
+          }
+        }
+        throw std::runtime_error("Delta-encoded block contains a malformed varint");
+      }
+
+      uint64_t timestamp(detail::report_state *state)
+      {
+        state->interval_ns += unzigzag(varint());
+        state->timestamp_ns += state->interval_ns;
+        return state->timestamp_ns;
+      }
+
+      report_timing timing(detail::report_state *state)
+      {
+        state->interval_micros += unzigzag(varint());
+        state->timing.timestamp_micros += uint32_t(state->interval_micros);
+        state->timing.frame += uint32_t(unzigzag(varint()));
+        return state->timing;
+      }
+
+      // Applies the slot and field deltas of an object report to the state
+      void objects(detail::report_state *state)
+      {
+        uint64_t slot_mask = varint();
+        for (size_t slot = 0; slot < detail::NumSlots; slot++)
+        {
+          if ((slot_mask & (1 << slot)) == 0)
+          {
+            continue;
+          }
+          uint64_t field_mask = varint();
+          for (size_t field = 0; field < detail::NumFields; field++)
+          {
+            if (field_mask & (1 << field))
+            {
+              state->fields[slot][field] += int32_t(unzigzag(varint()));
+            }
+          }
+        }
+      }
+
+      uint8_t format()
+      {
+        uint8_t format = byte();
+        if (format < 1 || format > 4)
+        {
+          throw std::runtime_error("Delta-encoded block contains an invalid report format");
+        }
+        return format;
+      }
+
+    private:
+      const uint8_t *m_data;
+      size_t m_size;
+      size_t m_idx = 0;
+    };
+  }
+
+  void object_report_encoder::append(const uint8_t *data, size_t size, uint64_t timestamp_ns)
+  {
+    // Framing is the same as span_packet_reader's
+    auto header_size = [this]()
+    {
+      return m_staged < sizeof(packet_header) ? sizeof(packet_header) : packet_header_size(m_packet);
+    };
+
+    size_t i = 0;
+    while (i < size)
+    {
+      if (m_staged < header_size())
+      {
+        m_packet[m_staged++] = data[i++];
+        while (m_staged >= header_size() && packet_size(m_packet) == 0)
+        {
+          // Not a valid header. Keep the byte and try again from the next.
+          m_literal.push_back(m_packet[0]);
+          memmove(m_packet, &m_packet[1], --m_staged);
+        }
+      }
+      else
+      {
+        size_t count = std::min(packet_size(m_packet) - m_staged, size - i);
+        memcpy(&m_packet[m_staged], &data[i], count);
+        m_staged += count;
+        i += count;
+      }
+
+      if (m_staged >= header_size() && m_staged == packet_size(m_packet))
+      {
+        encode_packet(m_packet, m_staged, timestamp_ns);
+        m_staged = 0;
+      }
+    }
+  }
+
+  bool object_report_encoder::take_block(std::vector<uint8_t> *payload, uint64_t *timestamp_ns, bool final)
+  {
+    if (final && m_staged > 0)
+    {
+      m_literal.insert(m_literal.end(), m_packet, m_packet + m_staged);
+      m_staged = 0;
+    }
+    flush_literal();
+    if (m_block.empty())
+    {
+      return false;
+    }
+
+    payload->swap(m_block);
+    m_block.clear();
+    *timestamp_ns = m_block_timestamp_ns;
+
+    // Blocks are decoded independently
+    m_num_packets = 0;
+    m_state = detail::report_state();
+    return true;
+  }
+
+  void object_report_encoder::encode_packet(const uint8_t *packet, size_t size, uint64_t timestamp_ns)
+  {
+    flush_literal();
+    if (m_num_packets++ == 0)
+    {
+      m_block_timestamp_ns = timestamp_ns;
+      m_state.timestamp_ns = timestamp_ns;
+    }
+
+    if (packet[1] == PacketID::ObjectReport || packet[1] == PacketID::CompactObjectReport || packet[1] == PacketID::ObjectReportBatch)
+    {
+      size_t start = m_block.size();
+      detail::report_state previous_state = m_state;
+      if (encode_report(packet, size, timestamp_ns))
+      {
+        return;
+      }
+
+      // Not representable. Undo and store verbatim.
+      m_block.resize(start);
+      m_state = previous_state;
+    }
+
+    m_block.push_back(token::Packet);
+    encode_timestamp(timestamp_ns);
+    m_block.insert(m_block.end(), packet, packet + size);
+  }
+
+  bool object_report_encoder::encode_report(const uint8_t *packet, size_t size, uint64_t timestamp_ns)
+  {
+    switch (packet[1])
+    {
+    default:
+      return false;
+
+    case PacketID::ObjectReport:
+    {
+      bool timed = size == sizeof(object_report_packet);
+      if (!timed && size != object_report_packet::LegacySize)
+      {
+        return false;
+      }
+      m_block.push_back(timed ? token::TimedObjectReport : token::ObjectReport);
+      encode_timestamp(timestamp_ns);
+      return encode_object_report(*reinterpret_cast<const object_report_packet *>(packet), timed);
+    }
+
+    case PacketID::CompactObjectReport:
+    {
+      const compact_object_report_packet &report = *reinterpret_cast<const compact_object_report_packet *>(packet);
+      if (!report.complete(size))
+      {
+        return false;
+      }
+      bool timed = report.timing() != nullptr;
+      m_block.push_back(timed ? token::TimedCompactObjectReport : token::CompactObjectReport);
+      encode_timestamp(timestamp_ns);
+      return encode_compact_report(report, size, timed);
+    }
+
+    case PacketID::ObjectReportBatch:
+      m_block.push_back(token::ObjectReportBatch);
+      encode_timestamp(timestamp_ns);
+      return encode_report_batch(*reinterpret_cast<const object_report_batch_packet *>(packet), size);
+    }
+  }
+
+  bool object_report_encoder::encode_object_report(const object_report_packet &report, bool timed)
+  {
+    if (report.format != 1)
+    {
+      return false;
+    }
+
+    // Objects must survive a round trip through PA_object exactly
+    int32_t fields[detail::NumSlots][detail::NumFields];
+    for (size_t slot = 0; slot < detail::NumSlots; slot++)
+    {
+      if (!to_exact_fields(&report.data[slot * ObjectStride], report.format, fields[slot]))
+      {
+        return false;
+      }
+    }
+
+    m_block.push_back(report.sequence);
+    if (timed)
+    {
+      encode_timing(report.frame_timing);
+    }
+    encode_objects(fields, 0xffff);
+    return true;
+  }
+
+  bool object_report_encoder::encode_compact_report(const compact_object_report_packet &report, size_t size, bool timed)
+  {
+    // Nothing may follow the objects and timing but a padding byte
+    size_t unpadded = unpadded_size(report, timed);
+    int32_t fields[detail::NumSlots][detail::NumFields];
+    if (size - unpadded > 1 || !to_exact_fields(report.data, report.format, report.occupied, fields))
+    {
+      return false;
+    }
+
+    m_block.push_back(report.format);
+    m_block.push_back(report.sequence);
+    if (timed)
+    {
+      encode_timing(*report.timing());
+    }
+    put_varint(&m_block, report.occupied);
+    encode_objects(fields, report.occupied);
+    if (size > unpadded)
+    {
+      m_block.push_back(reinterpret_cast<const uint8_t *>(&report)[unpadded]);
+    }
+    return true;
+  }
+
+  bool object_report_encoder::encode_report_batch(const object_report_batch_packet &batch, size_t size)
+  {
+    if (!batch.complete(size) || batch.count == 0)
+    {
+      return false;
+    }
+
+    // Entries must survive a round trip through PA_object exactly, and
+    // appending them to a new batch must reproduce this one
+    object_report_batch_packet rebuilt;
+    size_t unpadded = object_report_batch_packet::HeaderSize;
+    bool exact = true;
+    batch.for_each([&](const compact_object_report_packet &report)
+    {
+      int32_t fields[detail::NumSlots][detail::NumFields];
+      exact = exact && to_exact_fields(report.data, report.format, report.occupied, fields) && rebuilt.append(report);
+      unpadded += sizeof(object_report_batch_packet::entry_header) + report.objects_size();
+    });
+    if (!exact || rebuilt.size() != size || memcmp(&rebuilt, &batch, unpadded) != 0)
+    {
+      return false;
+    }
+
+    m_block.push_back(batch.format);
+    m_block.push_back(batch.count);
+    batch.for_each([&](const compact_object_report_packet &report)
+    {
+      int32_t fields[detail::NumSlots][detail::NumFields];
+      to_exact_fields(report.data, report.format, report.occupied, fields);
+      encode_timing(*report.timing());
+      put_varint(&m_block, report.occupied);
+      encode_objects(fields, report.occupied);
+    });
+    if (size > unpadded)
+    {
+      m_block.push_back(reinterpret_cast<const uint8_t *>(&batch)[unpadded]);
+    }
+    return true;
+  }
+
+  void object_report_encoder::encode_objects(const int32_t fields[detail::NumSlots][detail::NumFields], uint16_t slots)
+  {
+    uint32_t slot_mask = 0;
+    for (size_t slot = 0; slot < detail::NumSlots; slot++)
+    {
+      if ((slots & (1 << slot)) && memcmp(fields[slot], m_state.fields[slot], sizeof(fields[slot])) != 0)
+      {
+        slot_mask |= 1 << slot;
+      }
+    }
+    put_varint(&m_block, slot_mask);
+
+    for (size_t slot = 0; slot < detail::NumSlots; slot++)
+    {
+      if ((slot_mask & (1 << slot)) == 0)
+      {
+        continue;
+      }
+
+      uint32_t field_mask = 0;
+      for (size_t field = 0; field < detail::NumFields; field++)
+      {
+        if (fields[slot][field] != m_state.fields[slot][field])
+        {
+          field_mask |= 1 << field;
+        }
+      }
+      put_varint(&m_block, field_mask);
+
+      for (size_t field = 0; field < detail::NumFields; field++)
+      {
+        if (field_mask & (1 << field))
+        {
+          put_varint(&m_block, zigzag(fields[slot][field] - m_state.fields[slot][field]));
+          m_state.fields[slot][field] = fields[slot][field];
+        }
+      }
+    }
+  }
+
+  void object_report_encoder::encode_timestamp(uint64_t timestamp_ns)
+  {
+    int64_t interval_ns = int64_t(timestamp_ns - m_state.timestamp_ns);
+    put_varint(&m_block, zigzag(interval_ns - m_state.interval_ns));
+    m_state.timestamp_ns = timestamp_ns;
+    m_state.interval_ns = interval_ns;
+  }
+
+  void object_report_encoder::encode_timing(const report_timing &timing)
+  {
+    int32_t interval_micros = int32_t(timing.timestamp_micros - m_state.timing.timestamp_micros);
+    put_varint(&m_block, zigzag(int64_t(interval_micros) - m_state.interval_micros));
+    put_varint(&m_block, zigzag(int32_t(timing.frame - m_state.timing.frame)));
+    m_state.timing = timing;
+    m_state.interval_micros = interval_micros;
+  }
+
+  void object_report_encoder::flush_literal()
+  {
+    if (!m_literal.empty())
+    {
+      m_block.push_back(token::Literal);
+      put_varint(&m_block, m_literal.size());
+      m_block.insert(m_block.end(), m_literal.begin(), m_literal.end());
+      m_literal.clear();
+    }
+  }
+
+  void object_report_decoder::decode(const uint8_t *data, size_t size, uint64_t block_timestamp_ns, std::vector<uint8_t> *out, std::vector<timed_range> *times)
+  {
+    detail::report_state state;
+    state.timestamp_ns = block_timestamp_ns;
+    token_reader reader(data, size);
+
+    while (!reader.done())
+    {
+      uint8_t type = reader.byte();
+      switch (type)
+      {
+      default:
+        throw std::runtime_error("Delta-encoded block contains an unknown token");
+
+      case token::Literal:
+      {
+        size_t count = reader.varint();
+        const uint8_t *bytes = reader.bytes(count);
+        out->insert(out->end(), bytes, bytes + count);
+        break;
+      }
+
+      case token::Packet:
+      {
+        uint64_t timestamp_ns = reader.timestamp(&state);
+        uint8_t header[sizeof(extended_packet_header)];
+        memcpy(header, reader.bytes(sizeof(packet_header)), sizeof(packet_header));
+        size_t header_size = packet_header_size(header);
+        memcpy(&header[sizeof(packet_header)], reader.bytes(header_size - sizeof(packet_header)), header_size - sizeof(packet_header));
+        size_t bytes = packet_size(header);
+        if (bytes < header_size)
+        {
+          throw std::runtime_error("Delta-encoded block contains an invalid packet");
+        }
+        out->insert(out->end(), header, header + header_size);
+        const uint8_t *body = reader.bytes(bytes - header_size);
+        out->insert(out->end(), body, body + bytes - header_size);
+        times->push_back(timed_range{ out->size(), timestamp_ns });
+        break;
+      }
+
+      case token::ObjectReport:
+      case token::TimedObjectReport:
+      {
+        bool timed = type == token::TimedObjectReport;
+        uint64_t timestamp_ns = reader.timestamp(&state);
+        uint8_t sequence = reader.byte();
+        report_timing timing;
+        if (timed)
+        {
+          timing = reader.timing(&state);
+        }
+        reader.objects(&state);
+
+        uint8_t packet[sizeof(object_report_packet)];
+        size_t packet_size = timed ? sizeof(object_report_packet) : object_report_packet::LegacySize;
+        packet[0] = uint8_t(packet_size / 2);
+        packet[1] = PacketID::ObjectReport;
+        for (size_t slot = 0; slot < detail::NumSlots; slot++)
+        {
+          PA_object obj;
+          from_fields(state.fields[slot], &obj);
+          obj.store(&packet[sizeof(packet_header) + slot * ObjectStride], 1);
+        }
+        packet[FormatOffset] = 1;
+        packet[FormatOffset + 1] = sequence;
+        memcpy(&packet[TimingOffset], &timing, sizeof(timing));
+        out->insert(out->end(), packet, packet + packet_size);
+        times->push_back(timed_range{ out->size(), timestamp_ns });
+        break;
+      }
+
+      case token::CompactObjectReport:
+      case token::TimedCompactObjectReport:
+      {
+        bool timed = type == token::TimedCompactObjectReport;
+        uint64_t timestamp_ns = reader.timestamp(&state);
+        uint8_t format = reader.format();
+        uint8_t sequence = reader.byte();
+        report_timing timing;
+        if (timed)
+        {
+          timing = reader.timing(&state);
+        }
+        uint16_t occupied = uint16_t(reader.varint());
+        reader.objects(&state);
+
+        uint8_t objects[256];
+        from_fields(state.fields, format, occupied, objects);
+        compact_object_report_packet report(format, occupied, objects, timing);
+        report.sequence = sequence;
+
+        // Legacy reports end after the objects, where the timing was put
+        size_t unpadded = unpadded_size(report, timed);
+        size_t packet_size = (unpadded + 1) / 2 * 2;
+        uint8_t *packet = reinterpret_cast<uint8_t *>(&report);
+        packet[0] = uint8_t(packet_size / 2);
+        if (packet_size > unpadded)
+        {
+          packet[unpadded] = reader.byte();
+        }
+        out->insert(out->end(), packet, packet + packet_size);
+        times->push_back(timed_range{ out->size(), timestamp_ns });
+        break;
+      }
+
+      case token::ObjectReportBatch:
+      {
+        uint64_t timestamp_ns = reader.timestamp(&state);
+        uint8_t format = reader.format();
+        uint8_t count = reader.byte();
+        object_report_batch_packet batch;
+        size_t unpadded = object_report_batch_packet::HeaderSize;
+        for (size_t i = 0; i < count; i++)
+        {
+          report_timing timing = reader.timing(&state);
+          uint16_t occupied = uint16_t(reader.varint());
+          reader.objects(&state);
+
+          uint8_t objects[256];
+          size_t objects_size = from_fields(state.fields, format, occupied, objects);
+          if (!batch.append(compact_object_report_packet(format, occupied, objects, timing)))
+          {
+            throw std::runtime_error("Delta-encoded block contains an invalid report batch");
+          }
+          unpadded += sizeof(object_report_batch_packet::entry_header) + objects_size;
+        }
+
+        uint8_t *packet = reinterpret_cast<uint8_t *>(&batch);
+        if (batch.size() > unpadded)
+        {
+          packet[unpadded] = reader.byte();
+        }
+        out->insert(out->end(), packet, packet + batch.size());
+        times->push_back(timed_range{ out->size(), timestamp_ns });
+        break;
+      }
+      }
+    }
+  }
+} // recording
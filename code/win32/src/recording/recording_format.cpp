@@ -0,0 +1,130 @@
+#include "recording/recording_format.hpp"
+#include "pixart/camera_parameters.hpp"
+#include "util/format.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace recording
+{
+  metadata make_metadata(const pixart::register_snapshot &registers, const pixart::settings &settings)
+  {
+    metadata info;
+    info.version = Version;
+    info.settings = settings;
+    info.focal_length_x = pixart::camera_parameters::focal_length_x_pixels(settings.resolution_x);
+    info.focal_length_y = pixart::camera_parameters::focal_length_y_pixels(settings.resolution_y);
+    info.principal_point_x = 0.5 * settings.resolution_x;
+    info.principal_point_y = 0.5 * settings.resolution_y;
+    info.registers = registers;
+    return info;
+  }
+
+  std::vector<uint8_t> encode_header(const metadata &info)
+  {
+    if (info.registers.size() > 0xffff)
+    {
+      throw std::logic_error("Too many registers in snapshot");
+    }
+
+    file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.header_size = uint16_t(sizeof(file_header) + info.registers.size() * sizeof(pixart::register_value));
+    header.resolution_x = info.settings.resolution_x;
+    header.resolution_y = info.settings.resolution_y;
+    header.focal_length_x = info.focal_length_x;
+    header.focal_length_y = info.focal_length_y;
+    header.principal_point_x = info.principal_point_x;
+    header.principal_point_y = info.principal_point_y;
+    header.num_registers = uint16_t(info.registers.size());
+
+    std::vector<uint8_t> bytes(header.header_size);
+    memcpy(bytes.data(), &header, sizeof(header));
+    if (!info.registers.empty())
+    {
+      memcpy(&bytes[sizeof(header)], info.registers.data(), info.registers.size() * sizeof(pixart::register_value));
+    }
+    return bytes;
+  }
+
+  size_t decode_header(const uint8_t *data, size_t size, metadata *info)
+  {
+    *info = metadata();
+    if (size < sizeof(Magic) || memcmp(data, Magic, sizeof(Magic)) != 0)
+    {
+      info->version = 1;
+      return 0;
+    }
+
+    file_header header;
+    if (size < sizeof(header))
+    {
+      throw std::runtime_error("Recording header is truncated");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.version != Version)
+    {
+      throw std::runtime_error(util::format() << "Recording is version " << header.version << " but only versions 1 and " << Version << " are supported");
+    }
+
+    size_t registers_size = header.num_registers * sizeof(pixart::register_value);
+    if (header.header_size < sizeof(header) + registers_size || header.header_size > size)
+    {
+      throw std::runtime_error("Recording header is truncated");
+    }
+
+    info->version = header.version;
+    info->settings.resolution_x = header.resolution_x;
+    info->settings.resolution_y = header.resolution_y;
+    info->focal_length_x = header.focal_length_x;
+    info->focal_length_y = header.focal_length_y;
+    info->principal_point_x = header.principal_point_x;
+    info->principal_point_y = header.principal_point_y;
+    info->registers.resize(header.num_registers);
+    if (registers_size > 0)
+    {
+      memcpy(info->registers.data(), &data[sizeof(header)], registers_size);
+    }
+
+    // Later revisions of v2 may append fields, which header_size skips
+    return header.header_size;
+  }
+
+  size_t block_header_size(uint16_t version)
+  {
+    return version == 1 ? sizeof(uint32_t) : sizeof(block_header);
+  }
+
+  block_info decode_block_header(const uint8_t *data, size_t size, size_t offset, uint16_t version)
+  {
+    block_info block;
+    block.offset = offset;
+    block.payload_offset = offset + block_header_size(version);
+    if (block.payload_offset > size)
+    {
+      throw std::runtime_error("Encountered truncated block header");
+    }
+
+    if (version == 1)
+    {
+      memcpy(&block.size, &data[offset], sizeof(uint32_t));
+      block.encoding = block_encoding::raw;
+      block.timestamp_ns = 0;
+    }
+    else
+    {
+      block_header header;
+      memcpy(&header, &data[offset], sizeof(header));
+      block.size = header.size;
+      block.encoding = header.encoding;
+      block.timestamp_ns = header.timestamp_ns;
+    }
+
+    if (block.payload_offset + block.size > size)
+    {
+      throw std::runtime_error("Encountered block exceeding file size");
+    }
+    return block;
+  }
+} // recording
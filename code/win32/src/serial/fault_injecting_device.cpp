@@ -0,0 +1,182 @@
+#include "serial/fault_injecting_device.hpp"
+#include <utility>
+#include <cstring>
+#include <limits>
+
+fault_injecting_device::fault_injecting_device(std::unique_ptr<i_serial_device> serial_device, const fault_profile &profile)
+  : m_serial_device(std::move(serial_device)),
+    m_profile(profile),
+    m_byte_time(profile.bytes_per_second > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / profile.bytes_per_second)) : std::chrono::steady_clock::duration::zero()),
+    m_rng(profile.seed),
+    m_last_arrival(std::chrono::steady_clock::time_point::min())
+{
+  m_next_drop = draw_gap(m_profile.drop_probability);
+  m_next_flip = draw_gap(m_profile.bit_flip_probability);
+}
+
+// Number of intact bytes before the next fault
+uint64_t fault_injecting_device::draw_gap(double probability)
+{
+  if (probability <= 0)
+  {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  if (probability >= 1)
+  {
+    return 0;
+  }
+  return std::geometric_distribution<uint64_t>(probability)(m_rng);
+}
+
+void fault_injecting_device::stage(const uint8_t *data, size_t size)
+{
+  chunk c;
+  c.data.reserve(size);
+  c.pos = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    if (m_next_drop-- == 0)
+    {
+      m_bytes_dropped++;
+      m_fault_offsets.push_back(m_bytes_staged);
+      m_next_drop = draw_gap(m_profile.drop_probability);
+      continue;
+    }
+
+    uint8_t value = data[i];
+    if (m_next_flip-- == 0)
+    {
+      value ^= uint8_t(1 << (m_rng() % 8));
+      m_bits_flipped++;
+      m_fault_offsets.push_back(m_bytes_staged);
+      m_next_flip = draw_gap(m_profile.bit_flip_probability);
+    }
+    c.data.push_back(value);
+    m_bytes_staged++;
+  }
+
+  if (c.data.empty())
+  {
+    return;
+  }
+
+  auto delay = m_profile.latency;
+  if (m_profile.jitter.count() > 0)
+  {
+    delay += std::chrono::microseconds(std::uniform_int_distribution<int64_t>(0, m_profile.jitter.count())(m_rng));
+  }
+  c.arrival = std::max(std::chrono::steady_clock::now() + delay, m_last_arrival + m_byte_time);
+  m_last_arrival = c.arrival + int64_t(c.data.size() - 1) * m_byte_time;
+  m_staged_bytes += c.data.size();
+  m_chunks.emplace_back(std::move(c));
+}
+
+// Moves whatever the wrapped device has received into staging without
+// blocking
+void fault_injecting_device::pull()
+{
+  uint8_t buffer[ChunkSize];
+  while (m_staged_bytes < MaxStagedBytes)
+  {
+    uint32_t bytes_read = m_serial_device->read(buffer, sizeof(buffer));
+    if (bytes_read == 0)
+    {
+      break;
+    }
+    stage(buffer, bytes_read);
+  }
+}
+
+size_t fault_injecting_device::arrived_bytes(const chunk &c, std::chrono::steady_clock::time_point now) const
+{
+  if (now < c.arrival)
+  {
+    return 0;
+  }
+  if (m_byte_time.count() == 0)
+  {
+    return c.data.size();
+  }
+  return std::min<size_t>(c.data.size(), (now - c.arrival) / m_byte_time + 1);
+}
+
+uint32_t fault_injecting_device::deliver(uint8_t *buffer, uint32_t buf_size)
+{
+  uint32_t limit = buf_size;
+  if (m_profile.max_fragment > 0)
+  {
+    limit = std::min(limit, std::uniform_int_distribution<uint32_t>(1, m_profile.max_fragment)(m_rng));
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  uint32_t delivered = 0;
+  while (delivered < limit && !m_chunks.empty())
+  {
+    chunk &c = m_chunks.front();
+    size_t available = arrived_bytes(c, now) - c.pos;
+    size_t count = std::min<size_t>(available, limit - delivered);
+    memcpy(&buffer[delivered], &c.data[c.pos], count);
+    c.pos += count;
+    delivered += uint32_t(count);
+    if (c.pos < c.data.size())
+    {
+      // Rest has not arrived yet or does not fit
+      break;
+    }
+    m_chunks.pop_front();
+  }
+
+  m_staged_bytes -= delivered;
+  m_bytes_delivered += delivered;
+  while (!m_fault_offsets.empty() && m_fault_offsets.front() < m_bytes_delivered)
+  {
+    m_last_fault_offset = m_fault_offsets.front();
+    m_fault_offsets.pop_front();
+    m_faults_delivered++;
+  }
+  return delivered;
+}
+
+uint32_t fault_injecting_device::read(uint8_t *buffer, uint32_t buf_size)
+{
+  pull();
+  return deliver(buffer, buf_size);
+}
+
+uint32_t fault_injecting_device::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  while (true)
+  {
+    pull();
+    uint32_t bytes_read = deliver(buffer, buf_size);
+    auto now = std::chrono::steady_clock::now();
+    if (bytes_read > 0 || now >= deadline || !is_connected())
+    {
+      return bytes_read;
+    }
+
+    if (m_chunks.empty())
+    {
+      // Wait on the wrapped device itself
+      uint8_t data[ChunkSize];
+      uint32_t received = m_serial_device->read(data, sizeof(data), deadline);
+      stage(data, received);
+    }
+    else
+    {
+      // Sleep until the next byte arrives
+      const chunk &c = m_chunks.front();
+      std::this_thread::sleep_until(std::min(deadline, c.arrival + int64_t(c.pos) * m_byte_time));
+    }
+  }
+}
+
+bool fault_injecting_device::write(const uint8_t *buffer, uint32_t buf_size)
+{
+  return m_serial_device->write(buffer, buf_size);
+}
+
+bool fault_injecting_device::is_connected() const
+{
+  return m_staged_bytes > 0 || m_serial_device->is_connected();
+}
@@ -0,0 +1,122 @@
+#include "serial/framed_serial_device.hpp"
+#include "arduino/packet_dispatcher.hpp"
+#include "util/logging.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+framed_serial_device::framed_serial_device(std::unique_ptr<i_serial_device> serial_device)
+  : m_serial_device(std::move(serial_device))
+{
+}
+
+void framed_serial_device::decode(uint32_t size)
+{
+  m_decoder.feed(m_read_buffer, size, [this](const uint8_t *packet, size_t packet_size)
+  {
+    m_packets.insert(m_packets.end(), packet, packet + packet_size);
+  });
+}
+
+uint32_t framed_serial_device::deliver(uint8_t *buffer, uint32_t buf_size)
+{
+  size_t count = std::min<size_t>(buf_size, m_packets.size() - m_packets_pos);
+  if (count == 0)
+  {
+    return 0;
+  }
+  memcpy(buffer, m_packets.data() + m_packets_pos, count);
+  m_packets_pos += count;
+  if (m_packets_pos == m_packets.size())
+  {
+    m_packets.clear();
+    m_packets_pos = 0;
+  }
+  return uint32_t(count);
+}
+
+uint32_t framed_serial_device::read(uint8_t *buffer, uint32_t buf_size)
+{
+  if (m_packets_pos == m_packets.size())
+  {
+    decode(m_serial_device->read(m_read_buffer, sizeof(m_read_buffer)));
+  }
+  return deliver(buffer, buf_size);
+}
+
+uint32_t framed_serial_device::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  // A read may yield only part of a frame, or a corrupted one, so keep going
+  // until a packet is complete
+  while (m_packets_pos == m_packets.size())
+  {
+    uint32_t bytes_read = m_serial_device->read(m_read_buffer, sizeof(m_read_buffer), deadline);
+    if (bytes_read == 0)
+    {
+      return 0;
+    }
+    decode(bytes_read);
+  }
+  return deliver(buffer, buf_size);
+}
+
+bool framed_serial_device::write(const uint8_t *buffer, uint32_t buf_size)
+{
+  // Packets may be written in pieces
+  m_write_staging.insert(m_write_staging.end(), buffer, buffer + buf_size);
+  m_frames.clear();
+  size_t pos = 0;
+  while (m_write_staging.size() - pos >= sizeof(packet_header) && m_write_staging.size() - pos >= packet_header_size(&m_write_staging[pos]))
+  {
+    size_t bytes = packet_size(&m_write_staging[pos]);
+    if (bytes == 0 || m_write_staging.size() - pos < bytes)
+    {
+      break;
+    }
+    write_frame(&m_write_staging[pos], bytes, [this](const uint8_t *data, size_t size)
+    {
+      m_frames.insert(m_frames.end(), data, data + size);
+    });
+    pos += bytes;
+  }
+  m_write_staging.erase(m_write_staging.begin(), m_write_staging.begin() + pos);
+  return m_frames.empty() || m_serial_device->write(m_frames.data(), uint32_t(m_frames.size()));
+}
+
+bool framed_serial_device::is_connected() const
+{
+  return m_serial_device->is_connected();
+}
+
+namespace
+{
+  struct framing_response_handler
+  {
+    FramingMode mode = FramingMode::Unframed;
+
+    void on_packet(const set_framing_response_packet &response)
+    {
+      mode = response.mode;
+    }
+  };
+}
+
+std::unique_ptr<i_serial_device> negotiate_framing(std::unique_ptr<i_serial_device> serial_device, std::chrono::milliseconds timeout)
+{
+  serial_device->write(set_framing_packet(FramingMode::SyncCRC16));
+
+  // The response is the last unframed packet, so read no further than it
+  framing_response_handler handler;
+  auto reader = make_packet_reader(handler);
+  if (!reader.wait_for_packets(serial_device.get(), 1, std::chrono::steady_clock::now() + timeout))
+  {
+    LOG_INFO("Firmware does not support framing. Using unframed packets.");
+    return serial_device;
+  }
+  if (handler.mode != FramingMode::SyncCRC16)
+  {
+    LOG_INFO("Firmware declined framing. Using unframed packets.");
+    return serial_device;
+  }
+  return std::make_unique<framed_serial_device>(std::move(serial_device));
+}
@@ -51,7 +51,6 @@ serial_port::serial_port(const std::string &port_name, unsigned baud_rate)
       {
         m_connected = true;
         PurgeComm(m_handler, PURGE_RXCLEAR | PURGE_TXCLEAR);
-        Sleep(ARDUINO_WAIT_TIME);
       }
     }
   }
@@ -82,6 +81,42 @@ uint32_t serial_port::read(uint8_t *buffer, uint32_t buf_size)
   return bytes_read;
 }
 
+uint32_t serial_port::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  uint32_t bytes_read = read(buffer, buf_size);
+  auto now = std::chrono::steady_clock::now();
+  if (bytes_read > 0 || buf_size == 0 || now >= deadline)
+  {
+    return bytes_read;
+  }
+
+  // With these timeouts, ReadFile() returns as soon as a byte arrives or
+  // once the constant timeout has elapsed
+  DWORD timeout_ms = std::max<DWORD>(1, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count());
+  if (timeout_ms != m_read_timeout)
+  {
+    COMMTIMEOUTS timeouts = {0};
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = timeout_ms;
+    if (!SetCommTimeouts(m_handler, &timeouts))
+    {
+      return 0;
+    }
+    m_read_timeout = timeout_ms;
+  }
+
+  DWORD blocking_bytes_read = 0;
+  ReadFile(m_handler, buffer, 1, &blocking_bytes_read, NULL);
+  if (blocking_bytes_read == 0)
+  {
+    return 0;
+  }
+
+  // Pick up anything else that arrived along with the first byte
+  return 1 + read(buffer + 1, buf_size - 1);
+}
+
 bool serial_port::write(const uint8_t *buffer, uint32_t buf_size)
 {
   DWORD bytes_sent;
@@ -101,3 +136,20 @@ bool serial_port::is_connected() const
 {
   return m_connected;
 }
+
+bool serial_port::set_baud_rate(unsigned baud_rate)
+{
+  DCB dcb_serial_params = {0};
+  FlushFileBuffers(m_handler);
+  if (!GetCommState(m_handler, &dcb_serial_params))
+  {
+    return false;
+  }
+  dcb_serial_params.BaudRate = baud_rate;
+  if (!SetCommState(m_handler, &dcb_serial_params))
+  {
+    return false;
+  }
+  PurgeComm(m_handler, PURGE_RXCLEAR);
+  return true;
+}
@@ -0,0 +1,238 @@
+/*
+ * Linux serial port implementation.
+ *
+ * The port is opened non-blocking in raw mode. Non-blocking reads behave like
+ * the Win32 version (return 0 when nothing is queued) and the timed read
+ * sleeps in epoll_wait() rather than spinning, so an idle reader costs no CPU
+ * time. ASYNC_LOW_LATENCY is requested from drivers that support it (e.g.,
+ * FTDI and 8250 UARTs), which disables the driver's receive batching timer.
+ */
+
+#include "serial/serial_port.hpp"
+#include "util/format.hpp"
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+// B0 if unsupported
+static speed_t baud_rate_to_speed(unsigned baud_rate)
+{
+  switch (baud_rate)
+  {
+  case 300:     return B300;
+  case 600:     return B600;
+  case 1200:    return B1200;
+  case 2400:    return B2400;
+  case 4800:    return B4800;
+  case 9600:    return B9600;
+  case 19200:   return B19200;
+  case 38400:   return B38400;
+  case 57600:   return B57600;
+  case 115200:  return B115200;
+  case 230400:  return B230400;
+  case 460800:  return B460800;
+  case 500000:  return B500000;
+  case 921600:  return B921600;
+  case 1000000: return B1000000;
+  case 1500000: return B1500000;
+  case 2000000: return B2000000;
+  default:      return B0;
+  }
+}
+
+static void request_low_latency(int fd)
+{
+  // Not all drivers (notably pseudo-terminals and CDC-ACM) implement this
+  struct serial_struct serial_info;
+  if (ioctl(fd, TIOCGSERIAL, &serial_info) == 0)
+  {
+    serial_info.flags |= ASYNC_LOW_LATENCY;
+    ioctl(fd, TIOCSSERIAL, &serial_info);
+  }
+}
+
+serial_port::serial_port(const std::string &port_name, unsigned baud_rate)
+  : m_connected(false)
+{
+  speed_t speed = baud_rate_to_speed(baud_rate);
+  if (speed == B0)
+  {
+    throw std::runtime_error(util::format() << "Unsupported baud rate: " << baud_rate);
+  }
+
+  m_fd = open(port_name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (m_fd < 0)
+  {
+    int error = errno;
+    if (error == ENOENT || error == EBUSY)
+    {
+      throw std::runtime_error(util::format() << "Unable to open '" << port_name << "'. Is it busy or disconnected?");
+    }
+    else
+    {
+      throw std::runtime_error(util::format() << "Unable to open '" << port_name << "' (" << strerror(error) << ')');
+    }
+  }
+
+  // Exclusive access, as on Windows
+  ioctl(m_fd, TIOCEXCL);
+
+  struct termios tty;
+  if (tcgetattr(m_fd, &tty) != 0)
+  {
+    close(m_fd);
+    throw std::runtime_error("Failed to obtain current serial port parameters");
+  }
+
+  // 8N1, raw, no flow control. VMIN = VTIME = 0 because blocking is done with
+  // epoll.
+  cfmakeraw(&tty);
+  tty.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+  tty.c_cflag |= CS8 | CREAD | CLOCAL;
+  tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+
+  if (tcsetattr(m_fd, TCSANOW, &tty) != 0)
+  {
+    close(m_fd);
+    throw std::runtime_error("Failed to set serial port parameters");
+  }
+
+  request_low_latency(m_fd);
+
+  int dtr = TIOCM_DTR;
+  ioctl(m_fd, TIOCMBIS, &dtr);
+
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = m_fd;
+  if (m_epoll_fd < 0 || epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_fd, &event) != 0)
+  {
+    if (m_epoll_fd >= 0)
+    {
+      close(m_epoll_fd);
+    }
+    close(m_fd);
+    throw std::runtime_error(util::format() << "Failed to create epoll instance for '" << port_name << "' (" << strerror(errno) << ')');
+  }
+
+  m_connected = true;
+  tcflush(m_fd, TCIOFLUSH);
+}
+
+serial_port::~serial_port()
+{
+  if (m_epoll_fd >= 0)
+  {
+    close(m_epoll_fd);
+  }
+  if (m_fd >= 0)
+  {
+    m_connected = false;
+    close(m_fd);
+  }
+}
+
+uint32_t serial_port::read(uint8_t *buffer, uint32_t buf_size)
+{
+  ssize_t bytes_read = ::read(m_fd, buffer, buf_size);
+  if (bytes_read < 0)
+  {
+    if (errno != EAGAIN && errno != EINTR)
+    {
+      // EIO when a USB adapter is unplugged
+      m_connected = false;
+    }
+    return 0;
+  }
+  return uint32_t(bytes_read);
+}
+
+uint32_t serial_port::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  while (m_connected && buf_size > 0)
+  {
+    uint32_t bytes_read = read(buffer, buf_size);
+    auto now = std::chrono::steady_clock::now();
+    if (bytes_read > 0 || now >= deadline)
+    {
+      return bytes_read;
+    }
+
+    // Round up so that we do not wake early and spin on a zero timeout
+    auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now);
+    int timeout_ms = int(std::min<int64_t>((remaining.count() + 999) / 1000, 60 * 1000));
+    struct epoll_event event;
+    int num_events = epoll_wait(m_epoll_fd, &event, 1, timeout_ms);
+    if (num_events < 0 && errno != EINTR)
+    {
+      m_connected = false;
+    }
+    else if (num_events > 0 && (event.events & (EPOLLERR | EPOLLHUP)) && !(event.events & EPOLLIN))
+    {
+      m_connected = false;
+    }
+  }
+  return 0;
+}
+
+bool serial_port::write(const uint8_t *buffer, uint32_t buf_size)
+{
+  while (buf_size > 0)
+  {
+    ssize_t bytes_written = ::write(m_fd, buffer, buf_size);
+    if (bytes_written < 0)
+    {
+      if (errno == EAGAIN)
+      {
+        // Transmit buffer is full. Wait for it to drain.
+        struct pollfd pfd = { m_fd, POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      else if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    buffer += bytes_written;
+    buf_size -= uint32_t(bytes_written);
+  }
+  return true;
+}
+
+bool serial_port::is_connected() const
+{
+  return m_connected;
+}
+
+bool serial_port::set_baud_rate(unsigned baud_rate)
+{
+  speed_t speed = baud_rate_to_speed(baud_rate);
+  struct termios tty;
+  if (speed == B0 || tcgetattr(m_fd, &tty) != 0)
+  {
+    return false;
+  }
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  if (tcsetattr(m_fd, TCSADRAIN, &tty) != 0)
+  {
+    return false;
+  }
+  tcflush(m_fd, TCIFLUSH);
+  return true;
+}
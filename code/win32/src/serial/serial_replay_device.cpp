@@ -2,6 +2,9 @@
 #include "util/logging.hpp"
 #include "util/format.hpp"
 #include <utility>
+#include <cstring>
+#include <algorithm>
+#include <thread>
 #include <stdexcept>
 
 bool serial_replay_device::is_recording() const
@@ -9,97 +12,242 @@ bool serial_replay_device::is_recording() const
   return m_serial_device != nullptr;
 }
 
-// Block is 32-bit size followed by bytes
-void serial_replay_device::sync_to_block_boundary()
+bool serial_replay_device::at_end() const
 {
-  if (m_read_idx == m_next_block_idx)
+  return m_block_pos == m_block.size() && m_next_block_idx >= m_buffer_size;
+}
+
+// Block is a header (just a 32-bit size in v1) followed by bytes, which are
+// decoded to the bytes originally received
+void serial_replay_device::enter_block(size_t block_idx)
+{
+  try
+  {
+    recording::block_info block = recording::decode_block_header(m_buffer, m_buffer_size, block_idx, m_metadata.version);
+    m_block = m_decoder.decode(m_buffer, block);
+    m_block_idx = block_idx;
+    m_block_pos = 0;
+    m_next_block_idx = block.payload_offset + block.size;
+    m_block_timestamp_ns = block.timestamp_ns;
+  }
+  catch (const std::runtime_error &e)
   {
-    uint32_t size = *(uint32_t *) &m_buffer[m_read_idx];
-    m_read_idx += sizeof(uint32_t);
-    m_next_block_idx = m_read_idx + size;
+    throw std::runtime_error(util::format() << e.what() << " in '" << m_filename << "'. File is corrupt or has incorrect format.");
+  }
 
-    if (m_next_block_idx > m_buffer_size)
-    {
-      throw std::runtime_error(util::format() << "Encountered block exceeding file size in '" <<m_filename << "'. File is corrupt or has incorrect format.");
-    }
+  // Keep resident memory flat regardless of recording length
+  if (block_idx < m_released_idx)
+  {
+    m_released_idx = block_idx;
+  }
+  else if (block_idx - m_released_idx >= ReleaseGranularity)
+  {
+    m_file->release(m_released_idx, block_idx - m_released_idx);
+    m_released_idx = block_idx;
   }
 }
 
-uint32_t serial_replay_device::read_from_block(uint8_t *buffer, uint32_t buf_size)
+// Returns the number of bytes of the current block that may be handed out
+// now, limited by pacing. Moves on to the next block once the current one is
+// exhausted, looping back to the start if enabled.
+size_t serial_replay_device::readable_bytes(std::chrono::steady_clock::time_point deadline)
 {
-  if (m_read_idx == m_buffer_size)
+  bool rewound = false;
+  while (m_block_pos == m_block.size())
   {
-    return 0;
+    if (m_next_block_idx < m_buffer_size)
+    {
+      enter_block(m_next_block_idx);
+    }
+    else if (m_loop && !rewound && m_first_block_idx < m_buffer_size)
+    {
+      rewind();
+      rewound = true;
+    }
+    else
+    {
+      return 0;
+    }
   }
 
-  sync_to_block_boundary();
+  size_t end = m_block.size();
+  if (m_speed > 0)
+  {
+    end = std::min(end, paced_end(deadline));
+  }
+  return end > m_block_pos ? end - m_block_pos : 0;
+}
 
-  size_t bytes_read = buf_size;
-  size_t end = m_read_idx + buf_size;
-  if (end >= m_next_block_idx)
+// Frame data become available at the recorded rate, scaled by the speed.
+// Bytes up to the start of the first frame not yet due may be read. Waits
+// until the deadline for another frame to become due if none can be read.
+// Returns a position in the current block.
+size_t serial_replay_device::paced_end(std::chrono::steady_clock::time_point deadline)
+{
+  const recording::frame_index &index = frame_index();
+  if (!m_pacing_anchored)
   {
-    // Consume only up to the end of the current block
-    bytes_read = m_next_block_idx - m_read_idx;
-    end = m_next_block_idx;
+    // Next frame is due immediately
+    m_paced_frame = next_frame();
+    m_pacing_origin_ns = m_paced_frame < index.num_frames() ? index[m_paced_frame].timestamp_ns : 0;
+    m_pacing_start = std::chrono::steady_clock::now();
+    m_pacing_anchored = true;
   }
 
-  if (end >= m_buffer_size)
+  auto due_time = [&](size_t frame)
   {
-    if (end == m_buffer_size)
+    double elapsed_ns = double(index[frame].timestamp_ns - m_pacing_origin_ns) / m_speed;
+    return m_pacing_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::nano>(elapsed_ns));
+  };
+
+  while (true)
+  {
+    auto now = std::chrono::steady_clock::now();
+    while (m_paced_frame < index.num_frames() && due_time(m_paced_frame) <= now)
     {
-      LOG_INFO("Finished replay");
+      m_paced_frame++;
     }
-    else
+
+    if (m_paced_frame >= index.num_frames())
+    {
+      return m_block.size();
+    }
+
+    const recording::frame_index_entry &frame = index[m_paced_frame];
+    size_t end = m_block_pos;
+    if (frame.block_offset == m_block_idx)
     {
-      throw std::runtime_error(util::format() << "Attempted to read past end of file '" << m_filename << "'. File is corrupt or has incorrect format.");
+      end = std::max<size_t>(end, frame.position);
     }
+    else if (frame.block_offset > m_block_idx)
+    {
+      end = m_block.size();
+    }
+
+    auto wake_time = std::min(deadline, due_time(m_paced_frame));
+    if (end > m_block_pos || wake_time <= now)
+    {
+      return end;
+    }
+    std::this_thread::sleep_until(wake_time);
   }
+}
 
-  memcpy(buffer, &m_buffer[m_read_idx], bytes_read);
-  m_read_idx += bytes_read;
-  return bytes_read;
+uint32_t serial_replay_device::read_from_block(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  size_t bytes_read = std::min<size_t>(buf_size, readable_bytes(deadline));
+  memcpy(buffer, m_block.data() + m_block_pos, bytes_read);
+  advance(bytes_read);
+  return uint32_t(bytes_read);
 }
 
-serial_replay_device::serial_replay_device(const std::string &capture_file, std::unique_ptr<i_serial_device> serial_device)
-  : m_serial_device(std::move(serial_device)),
-    m_filename(capture_file)
+void serial_replay_device::advance(size_t num_bytes)
 {
-  m_of.open(capture_file.c_str(), std::ios::out | std::ios::binary);
-  if (!m_of.is_open())
+  m_block_pos += num_bytes;
+  if (num_bytes > 0 && at_end())
   {
-    throw std::runtime_error(util::format() << "Failed to open '" << capture_file << "' for writing");
+    LOG_INFO((m_loop ? "Looping replay" : "Finished replay"));
   }
 }
 
+void serial_replay_device::rewind()
+{
+  m_block = util::span<const uint8_t>();
+  m_block_pos = 0;
+  m_block_idx = m_first_block_idx;
+  m_next_block_idx = m_first_block_idx;
+  m_pacing_anchored = false;
+}
+
+serial_replay_device::serial_replay_device(const std::string &capture_file, std::unique_ptr<i_serial_device> serial_device, const recording::metadata &metadata, recording::block_encoding encoding, size_t buffer_size, std::chrono::milliseconds flush_interval)
+  : m_serial_device(std::move(serial_device)),
+    m_filename(capture_file),
+    m_metadata(metadata),
+    m_recorder(std::make_unique<util::async_file_writer>(capture_file, buffer_size, flush_interval)),
+    m_encoding(encoding)
+{
+  m_metadata.version = recording::Version;
+  std::vector<uint8_t> header = recording::encode_header(m_metadata);
+  m_recorder->append(header.data(), header.size());
+}
+
 serial_replay_device::serial_replay_device(const std::string &replay_file)
-  : m_filename(replay_file)
+  : m_filename(replay_file),
+    m_file(std::make_unique<util::mapped_file>(replay_file))
 {
-  std::ifstream file(replay_file.c_str(), std::ios::in | std::ios::ate | std::ios::binary);
-  if (!file.is_open())
+  m_buffer = m_file->data();
+  m_buffer_size = m_file->size();
+  m_first_block_idx = recording::decode_header(m_buffer, m_buffer_size, &m_metadata);
+  if (m_metadata.version == 1 && m_buffer_size < recording::block_header_size(1))
   {
-    throw std::runtime_error(util::format() << "Failed to open '" << replay_file << "' for reading");
+    throw std::runtime_error(util::format() << "File '" << replay_file << "' appears to have incorrect format");
   }
-  m_buffer_size = file.tellg();
-  m_buffer = std::make_unique<uint8_t[]>(m_buffer_size);
-  file.seekg(0);
-  file.read((char *) m_buffer.get(), m_buffer_size);
-  if (!file)
+  m_file->advise_sequential();
+  m_released_idx = m_first_block_idx;
+  rewind();
+  if (m_first_block_idx < m_buffer_size)
   {
-    throw std::runtime_error(util::format() << "Failed to read from '" << replay_file << "'");
+    enter_block(m_first_block_idx);
   }
-  file.close();
-  if (m_buffer_size < 4)
+}
+
+serial_replay_device::~serial_replay_device()
+{
+  if (m_recorder)
   {
-    throw std::runtime_error(util::format() << "File '" << replay_file << "' appears to have incorrect format");
+    if (m_encoding != recording::block_encoding::raw)
+    {
+      write_encoded_block(true);
+    }
+    uint64_t bytes_written = m_recorder->bytes_queued();
+    uint64_t high_water_mark = m_recorder->high_water_mark();
+    uint64_t producer_stalls = m_recorder->producer_stalls();
+    m_recorder.reset();   // writes out everything still queued
+    LOG_INFO("Recording finished. Received " << m_bytes_received << " bytes and wrote " << bytes_written << " bytes. Peak backlog was " << high_water_mark << " bytes and reads stalled on the disk " << producer_stalls << " times.");
   }
-  sync_to_block_boundary();
 }
 
-serial_replay_device::~serial_replay_device()
+void serial_replay_device::record_block(const uint8_t *buffer, uint32_t num_bytes)
 {
-  if (m_of.is_open())
+  if (num_bytes == 0)
   {
-    m_of.close();
+    return;
+  }
+
+  m_bytes_received += num_bytes;
+  uint64_t timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (m_encoding == recording::block_encoding::raw)
+  {
+    write_block(m_encoding, timestamp_ns, buffer, num_bytes);
+    return;
+  }
+
+  m_encoder.append(buffer, num_bytes, timestamp_ns);
+  bool block_full = m_encoder.num_packets() >= PacketsPerEncodedBlock;
+  bool block_old = m_encoder.num_packets() > 0 && timestamp_ns - m_encoder.block_timestamp_ns() >= uint64_t(std::chrono::nanoseconds(EncodedBlockDuration).count());
+  if (block_full || block_old)
+  {
+    write_encoded_block(false);
+  }
+}
+
+void serial_replay_device::write_block(recording::block_encoding encoding, uint64_t timestamp_ns, const uint8_t *payload, size_t size)
+{
+  recording::block_header header;
+  memset(&header, 0, sizeof(header));
+  header.size = uint32_t(size);
+  header.encoding = encoding;
+  header.timestamp_ns = timestamp_ns;
+  m_recorder->append(&header, sizeof(header));
+  m_recorder->append(payload, size);
+}
+
+void serial_replay_device::write_encoded_block(bool final)
+{
+  uint64_t timestamp_ns;
+  if (m_encoder.take_block(&m_encoded, &timestamp_ns, final))
+  {
+    write_block(m_encoding, timestamp_ns, m_encoded.data(), m_encoded.size());
   }
 }
 
@@ -108,17 +256,47 @@ uint32_t serial_replay_device::read(uint8_t *buffer, uint32_t buf_size)
   if (is_recording())
   {
     uint32_t num_bytes = m_serial_device->read(buffer, buf_size);
-    if (num_bytes > 0)
-    {
-      m_of.write((const char *) &num_bytes, sizeof(uint32_t));
-      m_of.write((const char *) buffer, num_bytes);
-    }
+    record_block(buffer, num_bytes);
+    return num_bytes;
+  }
+  else
+  {
+    return read_from_block(buffer, buf_size, std::chrono::steady_clock::time_point::min());
+  }
+}
+
+uint32_t serial_replay_device::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  if (is_recording())
+  {
+    uint32_t num_bytes = m_serial_device->read(buffer, buf_size, deadline);
+    record_block(buffer, num_bytes);
     return num_bytes;
   }
   else
   {
-    return read_from_block(buffer, buf_size);
+    return read_from_block(buffer, buf_size, deadline);
+  }
+}
+
+bool serial_replay_device::read_span(util::span<const uint8_t> *data, std::chrono::steady_clock::time_point deadline)
+{
+  if (is_recording())
+  {
+    // Recorded bytes must pass through read()
+    return false;
   }
+
+  // Hand out the remainder of the current block straight from the mapping
+  // (or, for encoded blocks, the decode buffer)
+  size_t size = readable_bytes(deadline);
+  *data = m_block.subspan(m_block_pos, size);
+  return true;
+}
+
+void serial_replay_device::consume(size_t size)
+{
+  advance(size);
 }
 
 bool serial_replay_device::write(const uint8_t *buffer, uint32_t buf_size)
@@ -143,6 +321,109 @@ bool serial_replay_device::is_connected() const
   else
   {
     // "Disconnect" when replay is finished
-    return m_read_idx >= m_buffer_size ? false : true;
+    if (m_loop && m_first_block_idx < m_buffer_size)
+    {
+      return true;
+    }
+    return !at_end();
+  }
+}
+
+const recording::metadata &serial_replay_device::metadata() const
+{
+  return m_metadata;
+}
+
+uint64_t serial_replay_device::block_timestamp_ns() const
+{
+  return m_block_timestamp_ns;
+}
+
+const recording::frame_index &serial_replay_device::frame_index()
+{
+  if (is_recording())
+  {
+    throw std::logic_error("Frame index is only available when replaying");
   }
+
+  if (!m_index)
+  {
+    try
+    {
+      m_index = std::make_unique<recording::frame_index>(recording::frame_index::load_or_build(m_filename, m_buffer, m_buffer_size, m_first_block_idx, m_metadata));
+    }
+    catch (const std::runtime_error &e)
+    {
+      throw std::runtime_error(util::format() << "Unable to index '" << m_filename << "': " << e.what());
+    }
+  }
+  return *m_index;
+}
+
+void serial_replay_device::seek_to_frame(size_t frame)
+{
+  const recording::frame_index &index = frame_index();
+  if (frame >= index.num_frames())
+  {
+    throw std::out_of_range(util::format() << "Frame " << frame << " is beyond the end of '" << m_filename << "' (" << index.num_frames() << " frames)");
+  }
+
+  // Enter the block containing the frame, then skip to the packet
+  enter_block(index[frame].block_offset);
+  m_block_pos = index[frame].position;
+  m_pacing_anchored = false;
+}
+
+void serial_replay_device::set_speed(double speed)
+{
+  if (speed > 0 && !frame_index().has_timing())
+  {
+    LOG_ERROR("'" << m_filename << "' contains no timing information. Replaying as fast as possible.");
+    speed = 0;
+  }
+  m_speed = speed;
+  m_pacing_anchored = false;
+}
+
+void serial_replay_device::set_loop(bool loop)
+{
+  m_loop = loop;
+}
+
+size_t serial_replay_device::next_frame()
+{
+  const recording::frame_index &index = frame_index();
+  recording::frame_index_entry position{ m_block_idx, m_block_pos, 0 };
+  size_t lo = 0;
+  size_t hi = index.num_frames();
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (index[mid] < position)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+size_t serial_replay_device::seek_to_time(std::chrono::nanoseconds time)
+{
+  const recording::frame_index &index = frame_index();
+  if (!index.has_timing())
+  {
+    throw std::runtime_error(util::format() << "'" << m_filename << "' contains no timing information");
+  }
+  size_t frame = index.frame_at_time(time);
+  seek_to_frame(frame);
+  return frame;
+}
+
+const util::async_file_writer *serial_replay_device::recorder() const
+{
+  return m_recorder.get();
 }
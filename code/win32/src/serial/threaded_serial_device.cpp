@@ -0,0 +1,122 @@
+#include "serial/threaded_serial_device.hpp"
+#include <utility>
+
+// How long the I/O thread blocks in a single read. Synchronous reads and
+// writes on a Win32 handle are serialized, so a write issued by the consumer
+// can be held up for this long there.
+#ifdef _WIN32
+static constexpr auto k_read_timeout = std::chrono::milliseconds(1);
+#else
+static constexpr auto k_read_timeout = std::chrono::milliseconds(50);
+#endif
+
+void threaded_serial_device::io_thread()
+{
+  while (!m_stop.load(std::memory_order_relaxed))
+  {
+    util::span<uint8_t> free_region = m_ring.write_span();
+    if (free_region.empty())
+    {
+      // Consumer has fallen behind. Let the device's own buffering absorb
+      // the data until it catches up.
+      m_ring_full_stalls.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+      continue;
+    }
+
+    uint32_t bytes_read = m_serial_device->read(free_region.data(), uint32_t(free_region.size()), std::chrono::steady_clock::now() + k_read_timeout);
+    if (bytes_read > 0)
+    {
+      m_ring.commit(bytes_read);
+    }
+    if (!m_serial_device->is_connected())
+    {
+      m_connected = false;
+    }
+
+    // Pairs with the fence in read(): either the consumer sees the new data
+    // or we see that it is waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((bytes_read > 0 || !m_connected) && m_consumer_waiting.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_data_available.notify_one();
+    }
+
+    if (!m_connected)
+    {
+      break;
+    }
+  }
+}
+
+threaded_serial_device::threaded_serial_device(std::unique_ptr<i_serial_device> serial_device, size_t ring_size)
+  : m_serial_device(std::move(serial_device)),
+    m_ring(ring_size)
+{
+  m_thread = std::thread(&threaded_serial_device::io_thread, this);
+}
+
+threaded_serial_device::~threaded_serial_device()
+{
+  m_stop = true;
+  m_thread.join();
+}
+
+uint32_t threaded_serial_device::read(uint8_t *buffer, uint32_t buf_size)
+{
+  return uint32_t(m_ring.read(buffer, buf_size));
+}
+
+void threaded_serial_device::wait_for_data(std::chrono::steady_clock::time_point deadline)
+{
+  if (!m_ring.empty() || std::chrono::steady_clock::now() >= deadline)
+  {
+    return;
+  }
+
+  m_consumer_waiting = true;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_data_available.wait_until(lock, deadline, [this]() { return !m_ring.empty() || !m_connected; });
+  }
+  m_consumer_waiting = false;
+}
+
+uint32_t threaded_serial_device::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  if (buf_size > 0)
+  {
+    wait_for_data(deadline);
+  }
+  return read(buffer, buf_size);
+}
+
+bool threaded_serial_device::read_span(util::span<const uint8_t> *data, std::chrono::steady_clock::time_point deadline)
+{
+  wait_for_data(deadline);
+  *data = m_ring.read_span();
+  return true;
+}
+
+void threaded_serial_device::consume(size_t size)
+{
+  m_ring.consume(size);
+}
+
+bool threaded_serial_device::write(const uint8_t *buffer, uint32_t buf_size)
+{
+  return m_serial_device->write(buffer, buf_size);
+}
+
+bool threaded_serial_device::is_connected() const
+{
+  // Remain connected until everything received has been consumed
+  return m_connected || !m_ring.empty();
+}
+
+uint64_t threaded_serial_device::ring_full_stalls() const
+{
+  return m_ring_full_stalls;
+}
@@ -0,0 +1,626 @@
+#include "serial/virtual_sensor_device.hpp"
+#include "pixart/camera_parameters.hpp"
+#include "util/math.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+  typedef double matrix3[3][3];
+
+  static void multiply(const matrix3 &a, const matrix3 &b, matrix3 *out)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      for (int j = 0; j < 3; j++)
+      {
+        (*out)[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+      }
+    }
+  }
+
+  // Yaw about y, then pitch about x, then roll about z, applied to the
+  // constellation facing the camera (rotated 180 degrees about x so that its
+  // +y is up in the image and it faces -z)
+  static void euler_to_rotation(double yaw, double pitch, double roll, matrix3 *out)
+  {
+    double cy = std::cos(yaw), sy = std::sin(yaw);
+    double cp = std::cos(pitch), sp = std::sin(pitch);
+    double cr = std::cos(roll), sr = std::sin(roll);
+    matrix3 ry = { { cy, 0, sy }, { 0, 1, 0 }, { -sy, 0, cy } };
+    matrix3 rx = { { 1, 0, 0 }, { 0, cp, -sp }, { 0, sp, cp } };
+    matrix3 rz = { { cr, -sr, 0 }, { sr, cr, 0 }, { 0, 0, 1 } };
+    matrix3 facing = { { 1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 } };
+    matrix3 ryx, ryxz;
+    multiply(ry, rx, &ryx);
+    multiply(ryx, rz, &ryxz);
+    multiply(ryxz, facing, out);
+  }
+
+  struct projected_led
+  {
+    double x;               // resolution units
+    double y;
+    double radius;          // sensor pixels
+  };
+
+  // What the sensor reports in a slot without an object
+  static const uint8_t s_empty_object[16] = { 0x00, 0x00, 0xff, 0x0f, 0xff, 0x0f, 0x00, 0x00, 0x00, 0x7f, 0x7f, 0x7f, 0x7f, 0x00, 0x00, 0x00 };
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const poke_packet &poke)
+{
+  device->set_register(poke.bank, poke.address, poke.data);
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const peek_packet &peek)
+{
+  auto it = device->m_registers.find((peek.bank << 8) | peek.address);
+  peek_response_packet response(peek.bank, peek.address, it == device->m_registers.end() ? 0 : it->second);
+  device->send(&response, sizeof(response));
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const peek_range_packet &peek)
+{
+  peek_range_response_packet response(peek.sequence, peek.bank, peek.start, is_valid_register_range(peek.start, peek.count) ? peek.count : 0);
+  for (size_t i = 0; i < response.count; i++)
+  {
+    auto it = device->m_registers.find((peek.bank << 8) | (peek.start + i));
+    response.data[i] = it == device->m_registers.end() ? 0 : it->second;
+  }
+  device->send(&response, response.size());
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const poke_block_packet &poke)
+{
+  uint8_t count = is_valid_register_range(poke.start, poke.count) ? poke.count : 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    device->set_register(poke.bank, uint8_t(poke.start + i), poke.data[i]);
+  }
+  poke_block_response_packet response(poke.sequence, count);
+  device->send(&response, sizeof(response));
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const object_report_request_packet &request)
+{
+  if (device->m_config.real_time)
+  {
+    // Reported at the next frame
+    device->m_report_credits = std::max<uint16_t>(device->m_report_credits, 1);
+  }
+  else
+  {
+    device->send_report(device->m_frame++);
+  }
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const grant_report_credits_packet &grant)
+{
+  device->m_report_credits = uint16_t(std::min<uint32_t>(uint32_t(device->m_report_credits) + grant.credits, 0xffff));
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const clock_sync_ping_packet &ping)
+{
+  double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - device->m_created).count();
+  clock_sync_response_packet response(ping.host_time_ns, device->sensor_micros(time));
+  device->send(&response, sizeof(response));
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const set_framing_packet &set_framing)
+{
+  // Acknowledged unframed, before switching
+  FramingMode mode = set_framing.mode == FramingMode::SyncCRC16 ? FramingMode::SyncCRC16 : FramingMode::Unframed;
+  set_framing_response_packet response(mode);
+  device->append_output(reinterpret_cast<const uint8_t *>(&response), sizeof(response));
+  if (mode == FramingMode::SyncCRC16 && device->m_framing != mode)
+  {
+    device->m_frame_decoder.reset();
+  }
+  device->m_framing = mode;
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const hello_packet &hello)
+{
+  // New session. Also confirms the baud rate.
+  device->m_baud_rate_unconfirmed = false;
+  device->m_framing = FramingMode::Unframed;
+  device->m_report_credits = 0;
+  device->m_subscribed = false;
+  device->m_report_encoding = ReportEncoding::FullReport;
+  device->m_report_format = 1;
+  device->m_report_batch_size = 0;
+  device->m_report_batch.clear();
+
+  hello_response_packet response;
+  response.protocol_version = PROTOCOL_VERSION;
+  response.report_formats = (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4);
+  response.features = FirmwareFeature::FramingFeature | FirmwareFeature::StreamingFeature | FirmwareFeature::CompactReportFeature | FirmwareFeature::BaudRateFeature | FirmwareFeature::RegisterBlockFeature | FirmwareFeature::ReportBatchFeature | FirmwareFeature::ReportCreditFeature | FirmwareFeature::ClockSyncFeature;
+  response.max_baud_rate = device->m_config.max_baud_rate;
+  strncpy(response.firmware_build, "virtual", sizeof(response.firmware_build) - 1);
+  device->append_output(reinterpret_cast<const uint8_t *>(&response), sizeof(response));
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const subscribe_packet &subscribe)
+{
+  device->m_subscribed = true;
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const unsubscribe_packet &unsubscribe)
+{
+  device->send_report_batch();
+  device->m_subscribed = false;
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const set_report_batching_packet &set_batching)
+{
+  device->m_report_batch_size = uint8_t(std::min<size_t>(set_batching.reports, object_report_batch_packet::MaxReports));
+  if (device->m_report_batch_size <= 1)
+  {
+    device->send_report_batch();
+  }
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const set_report_encoding_packet &set_encoding)
+{
+  device->m_report_encoding = set_encoding.encoding == ReportEncoding::CompactReport ? ReportEncoding::CompactReport : ReportEncoding::FullReport;
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const set_report_format_packet &set_format)
+{
+  if (set_format.format >= 1 && set_format.format <= 4)
+  {
+    device->m_report_format = set_format.format;
+  }
+}
+
+void virtual_sensor_device::host_packet_handler::on_packet(const set_baud_rate_packet &set_baud_rate)
+{
+  // Answered at the current rate, before switching
+  bool accept = set_baud_rate.baud_rate <= device->m_config.max_baud_rate;
+  set_baud_rate_response_packet response(accept ? set_baud_rate.baud_rate : device->m_baud_rate);
+  device->send(&response, sizeof(response));
+  if (accept && set_baud_rate.baud_rate != device->m_baud_rate)
+  {
+    device->m_previous_baud_rate = device->m_baud_rate;
+    device->m_baud_rate = set_baud_rate.baud_rate;
+    device->m_baud_rate_unconfirmed = true;
+    device->m_baud_rate_changed = std::chrono::steady_clock::now();
+  }
+}
+
+virtual_sensor_device::virtual_sensor_device(const virtual_sensor_config &config)
+  : m_config(config),
+    m_rng(config.seed),
+    m_handler{ this },
+    m_reader(packet_dispatcher<host_packet_handler>(m_handler)),
+    m_baud_rate(config.initial_baud_rate),
+    m_host_baud_rate(config.initial_baud_rate),
+    m_anchor_clock(std::chrono::steady_clock::now()),
+    m_boot_complete(m_anchor_clock + config.boot_time),
+    m_created(m_anchor_clock)
+{
+  uint32_t frame_period_reg = uint32_t(std::lround(1e7 / std::max(1.0, config.frame_rate)));
+  m_registers =
+  {
+    { 0x0002, 0x25 },   // product ID
+    { 0x0003, 0x70 },
+    { 0x000b, 0x00 },   // DSP max area threshold
+    { 0x000c, 0x20 },
+    { 0x000f, 0x0a },   // DSP noise threshold
+    { 0x0010, 0x00 },   // DSP orientation ratio
+    { 0x0011, 0x00 },   // DSP orientation factor
+    { 0x0019, 0x10 },   // DSP maximum object number
+    { 0x0105, 0x10 },   // sensor gain 1
+    { 0x0106, 0x00 },   // sensor gain 2
+    { 0x010e, 0x00 },   // sensor exposure length
+    { 0x010f, 0x20 },
+    { 0x0c60, uint8_t(config.resolution_x & 0xff) },
+    { 0x0c61, uint8_t((config.resolution_x >> 8) & 0x0f) },
+    { 0x0c62, uint8_t(config.resolution_y & 0xff) },
+    { 0x0c63, uint8_t((config.resolution_y >> 8) & 0x0f) },
+    { 0x0c07, uint8_t(frame_period_reg & 0xff) },
+    { 0x0c08, uint8_t((frame_period_reg >> 8) & 0xff) },
+    { 0x0c09, uint8_t((frame_period_reg >> 16) & 0xff) }
+  };
+
+  std::uniform_real_distribution<double> frequency(0.05, 0.5);
+  std::uniform_real_distribution<double> phase(0, 2 * util::math::Pi);
+  for (auto &m: m_motion)
+  {
+    m.frequency = frequency(m_rng);
+    m.phase = phase(m_rng);
+  }
+}
+
+uint16_t virtual_sensor_device::register_pair(uint8_t bank, uint8_t address) const
+{
+  auto value = [&](uint8_t a) -> uint16_t
+  {
+    auto it = m_registers.find((bank << 8) | a);
+    return it == m_registers.end() ? 0 : it->second;
+  };
+  return (value(address + 1) << 8) | value(address);
+}
+
+double virtual_sensor_device::frame_period() const
+{
+  // Register is in units of 100 ns
+  uint32_t frame_period_reg = (uint32_t(register_pair(0x0c, 0x08)) << 8) | (register_pair(0x0c, 0x07) & 0xff);
+  return std::max(1u, frame_period_reg) * 100e-9;
+}
+
+double virtual_sensor_device::frame_time(uint64_t frame) const
+{
+  return m_anchor_time + (frame - m_anchor_frame) * frame_period();
+}
+
+uint32_t virtual_sensor_device::sensor_micros(double time) const
+{
+  return uint32_t(uint64_t(time * (1 + m_config.clock_drift_ppm * 1e-6) * 1e6));
+}
+
+std::chrono::steady_clock::time_point virtual_sensor_device::frame_clock(uint64_t frame) const
+{
+  return m_anchor_clock + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((frame - m_anchor_frame) * frame_period()));
+}
+
+void virtual_sensor_device::set_register(uint8_t bank, uint8_t address, uint8_t value)
+{
+  bool frame_period_changed = bank == 0x0c && address >= 0x07 && address <= 0x09;
+  if (frame_period_changed)
+  {
+    m_anchor_time = frame_time(m_frame);
+    m_anchor_clock = frame_clock(m_frame);
+    m_anchor_frame = m_frame;
+  }
+  m_registers[(bank << 8) | address] = value;
+}
+
+void virtual_sensor_device::produce_frames(std::chrono::steady_clock::time_point now)
+{
+  if (!m_config.real_time)
+  {
+    // A subscriber, or a host with credits, gets the next frame (or batch)
+    // once it has read the last
+    while ((m_subscribed || m_report_credits > 0) && m_output_pos == m_output.size())
+    {
+      send_report(m_frame++);
+      m_report_credits -= m_subscribed ? 0 : 1;
+    }
+    return;
+  }
+  if (now < frame_clock(m_frame))
+  {
+    return;
+  }
+
+  // Frames produced since the last call. A subscriber is sent all of them,
+  // as the firmware would have while the host was not reading, otherwise
+  // as many as there are credits.
+  uint64_t last_frame = m_anchor_frame + uint64_t(std::chrono::duration<double>(now - m_anchor_clock).count() / frame_period());
+  uint64_t first_frame = std::max(m_frame, last_frame + 1 - std::min(last_frame + 1, MaxStreamBacklog));
+  for (uint64_t frame = first_frame; frame <= last_frame && (m_subscribed || m_report_credits > 0); frame++)
+  {
+    send_report(frame);
+    m_report_credits -= m_subscribed ? 0 : 1;
+  }
+  m_frame = std::max(m_frame + 1, last_frame + 1);
+}
+
+void virtual_sensor_device::send_report(uint64_t frame)
+{
+  virtual_frame truth;
+  truth.frame = frame;
+  truth.time = frame_time(frame);
+  truth.pose = pose(truth.time);
+
+  object_report_packet report(m_report_format);
+  report.sequence = uint8_t(frame);
+  report.frame_timing.timestamp_micros = sensor_micros(truth.time);
+  report.frame_timing.frame = uint32_t(frame);
+  truth.num_visible = render(truth.pose, report.format, report.data);
+  if (m_subscribed && m_report_batch_size > 1)
+  {
+    compact_object_report_packet compact(report.data, report.format, report.frame_timing);
+    compact.sequence = report.sequence;
+    if (!m_report_batch.append(compact))
+    {
+      send_report_batch();
+      m_report_batch.append(compact);
+    }
+    if (m_report_batch.count >= m_report_batch_size)
+    {
+      send_report_batch();
+    }
+  }
+  else if (m_report_encoding == ReportEncoding::CompactReport)
+  {
+    compact_object_report_packet compact(report.data, report.format, report.frame_timing);
+    compact.sequence = report.sequence;
+    send(&compact, compact.size());
+  }
+  else
+  {
+    send(&report, sizeof(report));
+  }
+
+  m_ground_truth.push_back(truth);
+  if (m_ground_truth.size() > MaxGroundTruth)
+  {
+    m_ground_truth.pop_front();
+  }
+}
+
+void virtual_sensor_device::send_report_batch()
+{
+  if (m_report_batch.count > 0)
+  {
+    send(&m_report_batch, m_report_batch.size());
+    m_report_batch.clear();
+  }
+}
+
+size_t virtual_sensor_device::render(const virtual_pose &pose, int format, uint8_t *report_data)
+{
+  uint16_t resolution_x = register_pair(0x0c, 0x60) & 0xfff;
+  uint16_t resolution_y = register_pair(0x0c, 0x62) & 0xfff;
+  double fx = pixart::camera_parameters::focal_length_x_pixels(resolution_x);
+  double fy = pixart::camera_parameters::focal_length_y_pixels(resolution_y);
+  double cx = 0.5 * resolution_x;
+  double cy = 0.5 * resolution_y;
+  double sensor_focal_length = pixart::camera_parameters::focal_length_x_pixels();
+
+  std::normal_distribution<double> noise(0, m_config.centroid_noise);
+  std::bernoulli_distribution dropout(m_config.dropout_probability);
+
+  std::vector<projected_led> visible;
+  for (auto &led: m_config.leds)
+  {
+    double p[3];
+    for (int i = 0; i < 3; i++)
+    {
+      p[i] = pose.rotation[i][0] * led[0] + pose.rotation[i][1] * led[1] + pose.rotation[i][2] * led[2] + pose.translation[i];
+    }
+
+    bool dropped = m_config.dropout_probability > 0 && dropout(m_rng);
+    if (p[2] <= 0 || dropped)
+    {
+      continue;
+    }
+
+    projected_led projected;
+    projected.x = fx * p[0] / p[2] + cx + (m_config.centroid_noise > 0 ? noise(m_rng) : 0);
+    projected.y = fy * p[1] / p[2] + cy + (m_config.centroid_noise > 0 ? noise(m_rng) : 0);
+    projected.radius = sensor_focal_length * m_config.led_radius / p[2];
+    if (projected.x >= 0 && projected.x < resolution_x && projected.y >= 0 && projected.y < resolution_y)
+    {
+      visible.push_back(projected);
+    }
+  }
+
+  // Sensor reports objects in scan order
+  std::sort(visible.begin(), visible.end(), [](const projected_led &a, const projected_led &b)
+  {
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+  });
+  size_t max_objects = std::min<size_t>(16, std::max<size_t>(1, m_registers[0x0019]));
+  visible.resize(std::min(visible.size(), max_objects));
+
+  for (size_t i = 0; i < 16; i++)
+  {
+    PA_object obj(s_empty_object, 1);
+    if (i < visible.size())
+    {
+      const projected_led &led = visible[i];
+      double sensor_x = led.x * pixart::camera_parameters::pixels_x / resolution_x;
+      double sensor_y = led.y * pixart::camera_parameters::pixels_y / resolution_y;
+      auto clamp_pixel = [](double value)
+      {
+        return uint8_t(std::clamp(value, 0.0, pixart::camera_parameters::pixels_x - 1));
+      };
+
+      obj.area = uint16_t(std::clamp(std::lround(util::math::Pi * led.radius * led.radius), 1L, 0x3fffL));
+      obj.cx = uint16_t(std::lround(led.x));
+      obj.cy = uint16_t(std::lround(led.y));
+      obj.average_brightness = 0xf0;
+      obj.max_brightness = 0xff;
+      obj.range = 0;
+      obj.radius = uint8_t(std::clamp(std::lround(led.radius), 0L, 15L));
+      obj.boundary_left = clamp_pixel(std::floor(sensor_x - led.radius));
+      obj.boundary_right = clamp_pixel(std::ceil(sensor_x + led.radius));
+      obj.boundary_up = clamp_pixel(std::floor(sensor_y - led.radius));
+      obj.boundary_down = clamp_pixel(std::ceil(sensor_y + led.radius));
+      obj.aspect_ratio = uint8_t(std::min(255, 16 * (obj.boundary_down - obj.boundary_up + 1) / (obj.boundary_right - obj.boundary_left + 1)));
+      obj.vx = 0;
+      obj.vy = 0;
+    }
+    obj.store(&report_data[i * PA_object_size(format)], format);
+  }
+
+  return visible.size();
+}
+
+bool virtual_sensor_device::link_ok() const
+{
+  return m_baud_rate == m_host_baud_rate && (m_config.max_link_baud_rate == 0 || m_baud_rate <= m_config.max_link_baud_rate);
+}
+
+void virtual_sensor_device::check_baud_rate(std::chrono::steady_clock::time_point now)
+{
+  if (m_baud_rate_unconfirmed && now - m_baud_rate_changed > std::chrono::milliseconds(BaudRateConfirmTimeoutMilliseconds))
+  {
+    m_baud_rate = m_previous_baud_rate;
+    m_baud_rate_unconfirmed = false;
+  }
+}
+
+void virtual_sensor_device::send(const void *packet, size_t size)
+{
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(packet);
+  if (m_framing == FramingMode::SyncCRC16)
+  {
+    write_frame(bytes, size, [this](const uint8_t *data, size_t size) { append_output(data, size); });
+  }
+  else
+  {
+    append_output(bytes, size);
+  }
+}
+
+void virtual_sensor_device::append_output(const uint8_t *data, size_t size)
+{
+  size_t start = m_output.size();
+  m_output.insert(m_output.end(), data, data + size);
+  if (!link_ok())
+  {
+    for (size_t i = start; i < m_output.size(); i++)
+    {
+      m_output[i] ^= 0xff;
+    }
+  }
+}
+
+uint32_t virtual_sensor_device::read_output(uint8_t *buffer, uint32_t buf_size)
+{
+  size_t count = std::min<size_t>(buf_size, m_output.size() - m_output_pos);
+  if (count == 0)
+  {
+    return 0;
+  }
+  memcpy(buffer, m_output.data() + m_output_pos, count);
+  m_output_pos += count;
+  if (m_output_pos == m_output.size())
+  {
+    m_output.clear();
+    m_output_pos = 0;
+  }
+  return uint32_t(count);
+}
+
+uint32_t virtual_sensor_device::read(uint8_t *buffer, uint32_t buf_size)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto now = std::chrono::steady_clock::now();
+  check_baud_rate(now);
+  produce_frames(now);
+  return read_output(buffer, buf_size);
+}
+
+uint32_t virtual_sensor_device::read(uint8_t *buffer, uint32_t buf_size, std::chrono::steady_clock::time_point deadline)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    auto now = std::chrono::steady_clock::now();
+    check_baud_rate(now);
+    produce_frames(now);
+    uint32_t bytes_read = read_output(buffer, buf_size);
+    if (bytes_read > 0 || now >= deadline)
+    {
+      return bytes_read;
+    }
+
+    // Sleep until a report is due or a request is written
+    auto wake_time = m_report_credits > 0 || m_subscribed ? std::min(deadline, frame_clock(m_frame)) : deadline;
+    m_request_received.wait_until(lock, wake_time);
+  }
+}
+
+bool virtual_sensor_device::write(const uint8_t *buffer, uint32_t buf_size)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    check_baud_rate(now);
+    if (now < m_boot_complete || !link_ok())
+    {
+      return true;
+    }
+    produce_frames(now);
+    if (m_framing == FramingMode::SyncCRC16)
+    {
+      m_frame_decoder.feed(buffer, buf_size, [this](const uint8_t *packet, size_t size) { m_reader.feed(packet, size); });
+    }
+    else
+    {
+      m_reader.feed(buffer, buf_size);
+    }
+  }
+  m_request_received.notify_all();
+  return true;
+}
+
+bool virtual_sensor_device::is_connected() const
+{
+  return true;
+}
+
+bool virtual_sensor_device::set_baud_rate(unsigned baud_rate)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_host_baud_rate = baud_rate;
+  m_output.clear();
+  m_output_pos = 0;
+  return true;
+}
+
+bool virtual_sensor_device::pop_ground_truth(virtual_frame *frame)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_ground_truth.empty())
+  {
+    return false;
+  }
+  *frame = m_ground_truth.front();
+  m_ground_truth.pop_front();
+  return true;
+}
+
+virtual_pose virtual_sensor_device::pose(double time) const
+{
+  double position[3];
+  double angles[3];
+
+  if (!m_config.keyframes.empty())
+  {
+    const auto &keys = m_config.keyframes;
+    double t = keys.back().time > 0 ? std::fmod(time, keys.back().time) : 0;
+    size_t i = 0;
+    while (i + 1 < keys.size() && keys[i + 1].time <= t)
+    {
+      i++;
+    }
+    const virtual_keyframe &a = keys[i];
+    const virtual_keyframe &b = keys[std::min(i + 1, keys.size() - 1)];
+    double s = b.time > a.time ? (t - a.time) / (b.time - a.time) : 0;
+    for (int j = 0; j < 3; j++)
+    {
+      position[j] = a.position[j] + s * (b.position[j] - a.position[j]);
+      angles[j] = a.euler_degrees[j] + s * (b.euler_degrees[j] - a.euler_degrees[j]);
+    }
+  }
+  else
+  {
+    auto wander = [&](size_t dof)
+    {
+      const motion &m1 = m_motion[dof * 2 + 0];
+      const motion &m2 = m_motion[dof * 2 + 1];
+      return 0.5 * (std::sin(2 * util::math::Pi * m1.frequency * time + m1.phase) + std::sin(2 * util::math::Pi * m2.frequency * time + m2.phase));
+    };
+    for (int j = 0; j < 3; j++)
+    {
+      position[j] = (j == 2 ? m_config.distance : 0) + m_config.position_amplitude * wander(j);
+      angles[j] = m_config.angle_amplitude * wander(3 + j);
+    }
+  }
+
+  virtual_pose result;
+  euler_to_rotation(angles[0] * util::math::Deg2Rad, angles[1] * util::math::Deg2Rad, angles[2] * util::math::Deg2Rad, &result.rotation);
+  for (int j = 0; j < 3; j++)
+  {
+    result.translation[j] = position[j];
+  }
+  return result;
+}
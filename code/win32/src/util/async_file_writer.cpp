@@ -0,0 +1,118 @@
+#include "util/async_file_writer.hpp"
+#include "util/format.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace util
+{
+  async_file_writer::async_file_writer(const std::string &filename, size_t buffer_size, std::chrono::milliseconds flush_interval)
+    : m_filename(filename),
+      m_buffer_size(std::max<size_t>(buffer_size, 1)),
+      m_flush_interval(flush_interval)
+  {
+    m_of.open(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!m_of.is_open())
+    {
+      throw std::runtime_error(util::format() << "Failed to open '" << filename << "' for writing");
+    }
+
+    // Preallocate both buffers so that appending never allocates
+    m_active.reserve(m_buffer_size);
+    m_pending.reserve(m_buffer_size);
+    m_last_flush = std::chrono::steady_clock::now();
+    m_thread = std::thread(&async_file_writer::writer_thread, this);
+  }
+
+  async_file_writer::~async_file_writer()
+  {
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+    m_of.close();
+  }
+
+  void async_file_writer::append(const void *data, size_t size)
+  {
+    if (m_write_failed)
+    {
+      throw std::runtime_error(util::format() << "Failed to write to '" << m_filename << "'");
+    }
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    m_bytes_queued += size;
+    m_high_water_mark = std::max<uint64_t>(m_high_water_mark, m_bytes_queued - m_bytes_written);
+
+    while (size > 0)
+    {
+      size_t count = std::min(size, m_buffer_size - m_active.size());
+      m_active.insert(m_active.end(), bytes, bytes + count);
+      bytes += count;
+      size -= count;
+      if (m_active.size() == m_buffer_size)
+      {
+        flush();
+      }
+    }
+
+    if (!m_active.empty() && std::chrono::steady_clock::now() - m_last_flush >= m_flush_interval)
+    {
+      flush();
+    }
+  }
+
+  void async_file_writer::flush()
+  {
+    m_last_flush = std::chrono::steady_clock::now();
+    if (m_active.empty())
+    {
+      return;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_have_pending)
+      {
+        // Writer has fallen behind by an entire buffer
+        m_producer_stalls++;
+        m_cv.wait(lock, [this]() { return !m_have_pending; });
+      }
+      std::swap(m_active, m_pending);
+      m_have_pending = true;
+    }
+    m_cv.notify_all();
+  }
+
+  void async_file_writer::writer_thread()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+      m_cv.wait(lock, [this]() { return m_have_pending || m_stop; });
+      if (!m_have_pending)
+      {
+        // Stopping and nothing left to write
+        return;
+      }
+
+      // The producer does not touch the pending buffer until it is released
+      lock.unlock();
+      m_of.write(reinterpret_cast<const char *>(m_pending.data()), m_pending.size());
+      m_of.flush();
+      if (!m_of.good())
+      {
+        m_write_failed = true;
+      }
+      m_bytes_written += m_pending.size();
+      m_pending.clear();
+      lock.lock();
+
+      m_have_pending = false;
+      m_cv.notify_all();
+    }
+  }
+} // util
@@ -116,6 +116,52 @@ namespace util
       }
     };
 
+    struct real_parameter_definition: public detail::parameter_definition
+    {
+      bool validate(const std::string &option_name, const std::string &value, size_t parameter_num) const override
+      {
+        double v;
+        bool not_a_number = false;
+        try
+        {
+          v = boost::lexical_cast<double>(value);
+        }
+        catch (boost::bad_lexical_cast &e)
+        {
+          not_a_number = true;
+        }
+        bool out_of_bounds = bounds_check_required && !not_a_number ? !(v >= lower_bound && v <= upper_bound) : false;
+        if (out_of_bounds)
+        {
+          LOG_ERROR("Argument " << parameter_num << " to '" << option_name << "' must be a number within range [" << lower_bound << "," << upper_bound << "].");
+          return true;
+        }
+        else if (not_a_number)
+        {
+          LOG_ERROR("Argument " << parameter_num << " to '" << option_name << "' must be a number.");
+          return true;
+        }
+        return false;
+      }
+
+      const double lower_bound = std::numeric_limits<double>::lowest();
+      const double upper_bound = std::numeric_limits<double>::max();
+      const bool bounds_check_required = false;
+
+      real_parameter_definition(const std::string &parameter_name)
+        : detail::parameter_definition(parameter_name)
+      {
+      }
+
+      real_parameter_definition(const std::string &parameter_name, double lower, double upper)
+        : detail::parameter_definition(parameter_name),
+          lower_bound(std::min(lower, upper)),
+          upper_bound(std::max(lower, upper)),
+          bounds_check_required(true)
+      {
+      }
+    };
+
     //
     // Parameter type definition emitters
     //
@@ -145,6 +191,16 @@ namespace util
       return std::make_shared<integer_parameter_definition>(name, lower, upper);
     }
 
+    std::shared_ptr<parameter_definition> real(const std::string &name)
+    {
+      return std::make_shared<real_parameter_definition>(name);
+    }
+
+    std::shared_ptr<parameter_definition> real(const std::string &name, double lower, double upper)
+    {
+      return std::make_shared<real_parameter_definition>(name, lower, upper);
+    }
+
     //
     // Actions (called when options are found or not found, allowing config
     // tree to be manipulated appropriately for the option type)
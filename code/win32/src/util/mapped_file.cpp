@@ -0,0 +1,147 @@
+#include "util/mapped_file.hpp"
+#include "util/format.hpp"
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace util
+{
+#ifdef _WIN32
+
+  mapped_file::mapped_file(const std::string &filename)
+  {
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      throw std::runtime_error(util::format() << "Failed to open '" << filename << "' for reading");
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+      CloseHandle(file);
+      throw std::runtime_error(util::format() << "Failed to obtain size of '" << filename << "'");
+    }
+    m_size = size_t(size.QuadPart);
+    if (m_size == 0)
+    {
+      return;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+      if (mapping)
+      {
+        CloseHandle(mapping);
+      }
+      CloseHandle(file);
+      throw std::runtime_error(util::format() << "Failed to map '" << filename << "'");
+    }
+    m_mapping = mapping;
+    m_data = reinterpret_cast<const uint8_t *>(view);
+  }
+
+  mapped_file::~mapped_file()
+  {
+    if (m_data)
+    {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping)
+    {
+      CloseHandle(m_mapping);
+    }
+    if (m_file)
+    {
+      CloseHandle(m_file);
+    }
+  }
+
+  void mapped_file::advise_sequential()
+  {
+    // Handled by FILE_FLAG_SEQUENTIAL_SCAN when the file is opened
+  }
+
+  void mapped_file::release(size_t offset, size_t size)
+  {
+    // Unlocking pages that are not locked removes them from the working set
+    if (m_data && size > 0)
+    {
+      VirtualUnlock(const_cast<uint8_t *>(m_data + offset), size);
+    }
+  }
+
+#else
+
+  mapped_file::mapped_file(const std::string &filename)
+  {
+    m_fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+      throw std::runtime_error(util::format() << "Failed to open '" << filename << "' for reading");
+    }
+
+    struct stat info;
+    if (fstat(m_fd, &info) != 0)
+    {
+      close(m_fd);
+      throw std::runtime_error(util::format() << "Failed to obtain size of '" << filename << "'");
+    }
+    m_size = size_t(info.st_size);
+    if (m_size == 0)
+    {
+      return;
+    }
+
+    void *addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (addr == MAP_FAILED)
+    {
+      close(m_fd);
+      throw std::runtime_error(util::format() << "Failed to map '" << filename << "'");
+    }
+    m_data = reinterpret_cast<const uint8_t *>(addr);
+  }
+
+  mapped_file::~mapped_file()
+  {
+    if (m_data)
+    {
+      munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+    if (m_fd >= 0)
+    {
+      close(m_fd);
+    }
+  }
+
+  void mapped_file::advise_sequential()
+  {
+    if (m_data)
+    {
+      madvise(const_cast<uint8_t *>(m_data), m_size, MADV_SEQUENTIAL);
+    }
+  }
+
+  void mapped_file::release(size_t offset, size_t size)
+  {
+    // madvise() requires a page-aligned start. Shrink the range inward.
+    size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    size_t start = (offset + page_size - 1) & ~(page_size - 1);
+    size_t end = (offset + size) & ~(page_size - 1);
+    if (m_data && end > start)
+    {
+      madvise(const_cast<uint8_t *>(m_data + start), end - start, MADV_DONTNEED);
+    }
+  }
+
+#endif
+} // util